@@ -0,0 +1,83 @@
+// Microbenchmark for the UTF-8 helpers: runs each function over ASCII and
+// CJK-heavy text with the SIMD kernels switched off and on.
+//
+// Build with -DSUBZERO_BUILD_BENCHMARKS=ON and run ./utf8_bench.
+#include "utf8_utils.h"
+#include "cpu_features.h"
+#include <cstdio>
+#include <ctime>
+#include <string>
+
+using namespace subzero;
+
+namespace {
+
+const size_t TEXT_SIZE = 1024 * 1024;
+const int ROUNDS = 20;
+
+// Keeps results alive so the calls are not optimised away
+volatile size_t g_sink;
+
+std::string makeAsciiText() {
+    const char* words[] = { "int ", "main", "(void) ", "{ return ", "value", "; } ", "// note\t" };
+    std::string text;
+    for (size_t i = 0; text.size() < TEXT_SIZE; ++i) {
+        text += words[i % 7];
+    }
+    return text;
+}
+
+std::string makeCjkText() {
+    // Mostly three-byte characters with some ASCII punctuation
+    const char* words[] = { "漢字", "かな", "カナ", "한국어", ", ", "中文", "é" };
+    std::string text;
+    for (size_t i = 0; text.size() < TEXT_SIZE; ++i) {
+        text += words[i % 7];
+    }
+    return text;
+}
+
+double secondsSince(clock_t start) {
+    return static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Runs one function over the text and returns the throughput in MB/s
+double measure(int function, const std::string& text) {
+    size_t chars = utf8::length(text);
+    clock_t start = clock();
+    for (int round = 0; round < ROUNDS; ++round) {
+        switch (function) {
+            case 0: g_sink = utf8::length(text); break;
+            case 1: g_sink = utf8::isValid(text); break;
+            case 2: g_sink = utf8::charToByte(text, chars - 1); break;
+            case 3: g_sink = utf8::byteToChar(text, text.size() - 1); break;
+            case 4: g_sink = utf8::substr(text, chars / 2, 80).size(); break;
+        }
+    }
+    double seconds = secondsSince(start);
+    return seconds > 0 ? (static_cast<double>(text.size()) * ROUNDS) / seconds / 1e6 : 0;
+}
+
+void run(const char* name, const std::string& text) {
+    const char* functions[] = { "length", "isValid", "charToByte", "byteToChar", "substr" };
+
+    printf("\n%s text (%lu bytes)\n", name, static_cast<unsigned long>(text.size()));
+    printf("  %-12s %12s %12s %9s\n", "function", "scalar MB/s", "SIMD MB/s", "speedup");
+    for (int function = 0; function < 5; ++function) {
+        utf8::setSimdEnabled(false);
+        double scalar = measure(function, text);
+        utf8::setSimdEnabled(true);
+        double simd = measure(function, text);
+        printf("  %-12s %12.0f %12.0f %8.1fx\n", functions[function], scalar, simd,
+               scalar > 0 ? simd / scalar : 0.0);
+    }
+}
+
+} // anonymous namespace
+
+int main() {
+    printf("SIMD kernels: %s\n", cpu::hasAVX2() ? "AVX2" : (cpu::hasSSE2() ? "SSE2" : "none (scalar only)"));
+    run("ASCII", makeAsciiText());
+    run("CJK", makeCjkText());
+    return 0;
+}
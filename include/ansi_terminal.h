@@ -0,0 +1,94 @@
+#pragma once
+#include "terminal.h"
+
+#if defined(LINUX_PLATFORM) || defined(MINTOS_PLATFORM)
+#include <termios.h>
+
+namespace subzero {
+
+// Terminal driven directly with termios and ANSI/VT escape sequences,
+// without ncurses.
+//
+// Output is collected in memory and refresh() sends the whole frame with
+// one write(), inside a synchronized update (DEC mode 2026) when the
+// terminal reports that it has one, so it never shows a half drawn frame.
+// Colors are only sent when they change and the cursor is only moved when
+// the text doesn't already continue where it is, so a run of cells from
+// GridTerminal costs its text and little else.
+class AnsiTerminal : public ITerminal {
+private:
+    bool m_initialized;
+    bool m_raw_mode;
+    bool m_synchronized;        // Terminal has synchronized updates
+    std::string m_last_error;
+
+    struct termios m_saved_termios;     // Restored on shutdown
+    mutable TerminalSize m_size;
+
+    std::string m_output;       // The frame so far
+    Position m_cursor;          // Where refresh() leaves the cursor
+    Position m_output_cursor;   // Where the output leaves it, row -1 if unknown
+    bool m_cursor_visible;
+    int m_fg;                   // Colors the output leaves set
+    int m_bg;
+
+    std::string m_input;        // Bytes read but not yet returned as keys
+
+    // Milliseconds to wait for the rest of an escape sequence, and for the
+    // terminal to answer queries at startup
+    static const int ESCAPE_DELAY_MS = 25;
+    static const int QUERY_TIMEOUT_MS = 200;
+
+    void querySize() const;
+    bool probeSynchronizedUpdate();
+    bool takeReply(const std::string& prefix, char final, std::string& params);
+    bool readInput(int timeout_ms);
+    KeyPress readEscape();
+    bool writeAll(const std::string& data);
+    void moveTo(const Position& pos);
+    void setSgr(int fg, int bg);    // Colors as Color::Value, -1 for the terminal's own
+    void putText(const std::string& text, const Position& pos, int fg, int bg);
+
+public:
+    AnsiTerminal();
+    virtual ~AnsiTerminal();
+
+    // Whether TERM names a terminal that understands the VT100 sequences
+    // used here (xterm and its descendants, the Linux console, tmux, ...)
+    static bool isSupported();
+
+    // ITerminal interface
+    bool initialize();
+    void shutdown();
+    bool isInitialized() const;
+
+    TerminalSize getSize() const;
+    void clear();
+    void refresh();
+    bool scrollRegion(int top, int bottom, int lines);
+
+    void setCursor(const Position& pos);
+    Position getCursor() const;
+    void showCursor(bool visible);
+
+    void putChar(const std::string& utf8_char, const Position& pos);
+    void putString(const std::string& utf8_str, const Position& pos);
+    void putStringWithColor(const std::string& utf8_str, const Position& pos,
+                           Color::Value fg, Color::Value bg = Color::BLACK);
+
+    KeyPress getKey();
+    bool hasInput();
+
+    void setColors(Color::Value fg, Color::Value bg);
+    void resetAttributes();
+
+    void enableRawMode();
+    void disableRawMode();
+    bool isRawMode() const;
+
+    std::string getLastError() const;
+};
+
+} // namespace subzero
+
+#endif // LINUX_PLATFORM
@@ -0,0 +1,69 @@
+#pragma once
+#include "compat.h"
+#include <string>
+#include <vector>
+
+namespace subzero {
+
+// Replaces a file so that it ends up either completely rewritten or
+// untouched, never half written.
+//
+// Data is written to a temporary file in the target's directory, synced to
+// disk and then renamed over the target, keeping the target's permissions.
+// write() only records the caller's pointers and sends them to the file in
+// large vectored batches, so the data must stay valid until the next
+// write() call that fills a batch, or until commit().
+//
+// The new file gets the target's owner and group as well. Where that is
+// not possible, where the target has other hard links, or where no
+// temporary file can be made (e.g. the directory is not writable), the
+// target is overwritten in place instead. Its old contents stay as they
+// were until the first write(). A target we may not write is refused.
+class AtomicFileWriter {
+public:
+    AtomicFileWriter();
+    ~AtomicFileWriter();   // Discards the temporary file unless committed
+
+    bool open(const std::string& filename);
+    bool write(const char* data, size_t length);
+    bool commit();
+    void abort();
+
+    std::string getLastError() const { return m_last_error; }
+
+    // After open(): true where the old file stays readable through existing
+    // mappings while the new one is written, so it need not be copied out
+    // before the first write()
+    bool replacesByRename() const;
+    bool isInPlace() const { return m_in_place; }
+
+private:
+    std::string m_target;
+    std::string m_temp;
+    std::string m_last_error;
+    bool m_open;
+    bool m_in_place;                 // Writing to the target itself
+
+#if defined(LINUX_PLATFORM) || defined(MACOS_PLATFORM)
+    int m_fd;
+    int m_mode;                      // Permissions to give the new file, -1 for default
+    uint64_t m_written;              // Bytes sent to the file so far
+    std::vector<const char*> m_batch_data;
+    std::vector<size_t> m_batch_length;
+
+    bool flush();
+    bool openInPlace();
+#else
+    void* m_file;                    // FILE* being written, opened late when in place
+
+    bool openTarget();
+#endif
+
+    bool fail(const std::string& message);
+
+    // Non-copyable: owns an open file
+    AtomicFileWriter(const AtomicFileWriter&);
+    AtomicFileWriter& operator=(const AtomicFileWriter&);
+};
+
+} // namespace subzero
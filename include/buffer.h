@@ -1,7 +1,13 @@
 #pragma once
 #include "compat.h"
 #include "utf8_utils.h"
+#include "piece_table.h"
+#include "line_index.h"
+#include "line_scanner.h"
+#include "atomic_file_writer.h"
+#include "undo_file.h"
 #include <vector>
+#include <deque>
 #include <string>
 #include <fstream>
 
@@ -22,41 +28,160 @@ struct BufferPosition {
     }
 };
 
+// Immutable copy of a buffer's contents, taken in O(1) by sharing the
+// buffer's storage. Edits made after the snapshot was taken do not show in
+// it, so it can be read by background work (saving, search, highlighting)
+// while the buffer keeps being edited.
+struct BufferSnapshot {
+    TextSnapshot text;          // Document without its final line ending
+    std::string final_eol;
+    std::string filename;
+
+    size_t size() const { return text.size() + final_eol.size(); }
+};
+
+// One edit, as reported to buffer observers. Line numbers are those of the
+// buffer before the edit; lines after the replaced ones shift by
+// new_line_count - old_line_count.
+struct BufferChange {
+    size_t first_line;          // First line touched by the edit
+    size_t old_line_count;      // Lines replaced, starting at first_line
+    size_t new_line_count;      // Lines now in their place
+    size_t byte_offset;         // Start of the edited bytes
+    size_t erased_bytes;
+    size_t inserted_bytes;
+    uint64_t version;           // Buffer version after the edit
+};
+
+class Buffer;
+
+// Interface for views and caches that follow the contents of a buffer
+class IBufferObserver {
+public:
+    virtual ~IBufferObserver() {}
+    
+    // Called after every edit, including those made by undo and redo
+    virtual void bufferChanged(const Buffer& buffer, const BufferChange& change) = 0;
+    
+    // Called after the whole contents were replaced (loading, clearing)
+    virtual void bufferReset(const Buffer& buffer) = 0;
+};
+
 class Buffer {
 private:
-    std::vector<std::string> m_lines;
+    PieceTable m_text;          // Document bytes, lines separated by '\n' or "\r\n"
+    LineIndex m_line_index;     // Line lengths with byte and character prefix sums
+    LineScanner m_scanner;      // Scans the rest of the file in the background
+    size_t m_scan_offset;       // Original text before this offset is in m_line_index
+    size_t m_scan_end;          // End of the original text that needs scanning
+    bool m_fully_indexed;       // False while the tail of the file is still unscanned
+    LineScanStats m_file_stats; // Line endings and ASCII-ness of the loaded file
+    std::string m_eol;          // Line ending used for newly created lines
+    std::string m_final_eol;    // Line ending after the last line, kept out of m_text
     std::string m_filename;
+    std::string m_last_error;
     bool m_modified;
     bool m_readonly;
+    bool m_saved_in_place;      // The last save overwrote the file itself
     BufferPosition m_cursor;
     
-    // Undo/redo support (simplified for now)
-    struct UndoEntry {
-        enum Type { INSERT_CHAR, DELETE_CHAR, INSERT_LINE, DELETE_LINE };
-        Type type;
-        BufferPosition position;
-        std::string data;
+    // Sparse character -> byte checkpoints for recently used non-ASCII
+    // lines, so column lookups do not walk the line from its start
+    struct CharCheckpoints {
+        size_t line;
+        std::vector<size_t> bytes;     // Byte offset of every CHECKPOINT_INTERVAL-th character
+        bool complete;                 // The checkpoints reach the end of the line
+    };
+    static const size_t CHECKPOINT_INTERVAL = 64;
+    static const size_t MAX_CHECKPOINT_LINES = 8;
+    mutable std::vector<CharCheckpoints> m_checkpoints;   // Most recently used last
+    
+    // Undo history. Every edit is recorded as the bytes it replaced and the
+    // bytes it put in their place, so undoing costs as much as the edit did.
+    // Edits made between beginUndoGroup() and endUndoGroup() are undone
+    // together; other edits form a group each.
+    //
+    // Saving also appends the history to an undo file next to the file, and
+    // loading picks it up again. Groups stored there are only read when they
+    // are undone, and are the first to be unloaded when over budget.
+    struct UndoGroup {
+        std::vector<UndoEntry> entries;
+        BufferPosition cursor;      // Cursor before the first edit
+        size_t bytes;               // Memory charged to the group
+        uint64_t file_offset;       // Record in the undo file, NO_FILE_OFFSET if none
+        bool loaded;                // entries is filled in
     };
-    std::vector<UndoEntry> m_undo_stack;
-    size_t m_undo_index;
+    static const uint64_t NO_FILE_OFFSET = ~static_cast<uint64_t>(0);
+    std::deque<UndoGroup> m_undo_groups;
+    size_t m_undo_index;            // Groups before this index are applied
+    size_t m_undo_bytes;            // Memory held by all groups
+    size_t m_undo_budget;           // Older groups are unloaded or dropped beyond this
+    size_t m_saved_index;           // m_undo_index when last saved, npos if lost
+    int m_group_depth;              // Nesting of beginUndoGroup() calls
+    bool m_group_open;              // The current explicit group has a record
+    bool m_replaying;               // Undo/redo in progress; do not record
+    
+    // State of the undo file. Group numbers count from the start of the
+    // whole history, including groups dropped from m_undo_groups.
+    std::string m_undo_path;
+    size_t m_undo_base;             // Number of the first group in m_undo_groups
+    size_t m_undo_disk_count;       // Leading groups that match the file's list
+    size_t m_undo_disk_length;      // Length of the file's list, npos to rewrite it
+    uint64_t m_undo_loaded_hash;    // Text hash the file was saved with
+    bool m_undo_verified;           // Loaded text checked against the hash
+    size_t m_undo_unload_hint;      // Groups before this have nothing to unload
+    bool m_undo_file_enabled;       // Read and write the undo file at all
+    
+    // Change notification
+    std::vector<IBufferObserver*> m_observers;
+    uint64_t m_version;             // Incremented by every edit and reset
     
 public:
     Buffer();
     explicit Buffer(const std::string& filename);
     
-    // File operations
-    bool loadFromFile(const std::string& filename);
+    // File operations. A file loaded read-only is only viewed: it keeps no
+    // undo history and its line index is sparse, so files larger than
+    // memory can be paged through.
+    bool loadFromFile(const std::string& filename, bool read_only = false);
     bool loadFromStream(std::istream& stream);
     bool saveToFile(const std::string& filename = "");
+    std::string getLastError() const { return m_last_error; }
+    bool wasSavedInPlace() const { return m_saved_in_place; }
     bool isModified() const { return m_modified; }
+    BufferSnapshot getSnapshot() const;
     bool isReadonly() const { return m_readonly; }
     const std::string& getFilename() const { return m_filename; }
     void setFilename(const std::string& filename) { m_filename = filename; }
     
+    // Background line indexing. Loading scans the first screenful and
+    // leaves the rest of the file to a worker; getLineCount() reports the
+    // lines indexed so far until isFullyIndexed() returns true. The ensure
+    // functions wait only until the requested part has been indexed.
+    bool isFullyIndexed() const { return m_fully_indexed; }
+    bool isLineIndexed(size_t line_num) const { return m_fully_indexed || line_num < m_line_index.getLineCount(); }
+    bool isOffsetIndexed(size_t byte_offset) const { return m_fully_indexed || byte_offset < m_line_index.getTotalBytes(); }
+    int getIndexingProgress() const;             // Percent of the file indexed
+    const LineScanStats& getFileStats() const { return m_file_stats; }  // Indexed part of the file
+    bool pollIndexing(int wait_ms = 0);          // Index one more chunk; false if none was ready
+    void ensureLineIndexed(size_t line_num);
+    void ensureOffsetIndexed(size_t byte_offset);
+    void ensureFullyIndexed();
+    
     // Content access
-    size_t getLineCount() const { return m_lines.size(); }
-    const std::string& getLine(size_t line_num) const;
+    size_t getLineCount() const { return m_line_index.getLineCount(); }
+    std::string getLine(size_t line_num) const;
+    bool getLineView(size_t line_num, const char*& data, size_t& length) const;
     std::string getLineSubstring(size_t line_num, size_t start_col, size_t length = std::string::npos) const;
+    bool isLineAscii(size_t line_num) const { return m_line_index.getLine(line_num).isAscii(); }
+    
+    // Offset conversion (O(log n) line lookup through the line index)
+    size_t getByteCount() const { return m_text.size() + m_final_eol.size(); }
+    size_t getCharCount() const { return m_line_index.getTotalChars() + m_final_eol.size(); }  // Indexed part
+    size_t getByteOffset(const BufferPosition& pos) const;
+    size_t getCharOffset(const BufferPosition& pos) const;
+    BufferPosition getPositionAtByte(size_t byte_offset) const;
+    BufferPosition getPositionAtChar(size_t char_offset) const;
     
     // Cursor operations
     const BufferPosition& getCursor() const { return m_cursor; }
@@ -86,9 +211,11 @@ public:
     void pasteBefore(const std::string& text);
     void pasteAfter(const std::string& text);
     
-    // Search operations
-    BufferPosition findNext(const std::string& pattern, const BufferPosition& start) const;
-    BufferPosition findPrevious(const std::string& pattern, const BufferPosition& start) const;
+    // Search operations. findNext() finds the first match starting in
+    // [from, to) and findPrevious() the last, by scanning the text itself,
+    // so they do not wait for the line index to get there.
+    bool findNext(const std::string& pattern, size_t from, size_t to, size_t& match) const;
+    bool findPrevious(const std::string& pattern, size_t from, size_t to, size_t& match) const;
     
     // Word/character navigation
     BufferPosition getNextWord() const;
@@ -98,19 +225,75 @@ public:
     BufferPosition getBufferBegin() const;
     BufferPosition getBufferEnd() const;
     
+    // Memory held by the line index. compactMemory() repacks the index when
+    // edits have left it sparse, and returns true if it did.
+    size_t getIndexMemory() const { return m_line_index.getMemoryUsage(); }
+    bool compactMemory();
+    
+    // Change notification. Observers are not owned and must be removed
+    // before they are destroyed.
+    void addObserver(IBufferObserver* observer);
+    void removeObserver(IBufferObserver* observer);
+    uint64_t getVersion() const { return m_version; }
+    
     // Undo/redo
     bool canUndo() const { return m_undo_index > 0; }
-    bool canRedo() const { return m_undo_index < m_undo_stack.size(); }
-    void undo();
-    void redo();
+    bool canRedo() const { return m_undo_index < m_undo_groups.size(); }
+    bool undo();
+    bool redo();
+    void beginUndoGroup();
+    void endUndoGroup();
+    size_t getUndoMemory() const { return m_undo_bytes; }
+    void setUndoBudget(size_t bytes);
+    static const size_t DEFAULT_UNDO_BUDGET = 32 * 1024 * 1024;
+    
+    // Whether loading and saving use the undo file; set before loading
+    void setUndoFileEnabled(bool enabled) { m_undo_file_enabled = enabled; }
+    bool isUndoFileEnabled() const { return m_undo_file_enabled; }
     
     // Utility
     void clear();
-    bool isEmpty() const { return m_lines.empty() || (m_lines.size() == 1 && m_lines[0].empty()); }
+    bool isEmpty() const { return m_text.empty(); }
     
 private:
+    // Line geometry within the piece table
+    size_t getLineOffset(size_t line_num) const { return m_line_index.getLineOffset(line_num); }
+    void getLineExtent(size_t line_num, size_t& offset, size_t& length, size_t& eol_length) const;
+    void detectLineEnding();
+    void beginIndexing();
+    
+    // Touches no buffer state, so it can run on a snapshot off the main thread
+    static bool writeSnapshot(const BufferSnapshot& snapshot, AtomicFileWriter& writer, uint64_t& hash,
+                              std::string& error);
+    bool indexMore(int wait_ms);
+    
+    // Every modification of the text goes through here
+    void replaceText(size_t offset, size_t erase_length, const std::string& text);
+    bool replaceWithinLine(size_t line_num, size_t offset, const std::string& erased, const std::string& text);
+    
+    // Column <-> byte conversion within a line; O(1) for ASCII lines
+    size_t columnToByte(size_t line_num, size_t column) const;
+    size_t byteToColumn(size_t line_num, size_t byte_in_line) const;
+    CharCheckpoints& getCheckpoints(size_t line_num) const;
+    void extendCheckpoints(CharCheckpoints& checkpoints, size_t column, size_t byte_in_line) const;
+    size_t skipColumns(size_t line_num, size_t byte_in_line, size_t columns) const;
+    void updateCheckpoints(size_t first_line, size_t last_line, size_t new_line_count, size_t byte_in_line);
+    void notifyChange(size_t first_line, size_t old_line_count, size_t new_line_count, size_t offset,
+                      size_t erased_bytes, size_t inserted_bytes);
+    void notifyReset();
+    
+
     void ensureValidCursor();
-    void addUndoEntry(const UndoEntry& entry);
+    void recordEdit(size_t offset, const std::string& erased, const std::string& inserted);
+    void trimUndoHistory();
+    void forgetUndoHistory();
+    void resetUndoHistory();
+    void loadUndoFile();
+    void saveUndoFile(uint64_t size, uint64_t hash);
+    bool loadUndoGroup(size_t index);
+    bool verifyUndoFile();
+    void dropOldestUndoGroups(size_t count);
+    void dropNewestUndoGroups(size_t from);
     void setModified(bool modified = true) { m_modified = modified; }
     size_t getLineLength(size_t line_num) const;
     bool isWordChar(char32_t ch) const;
@@ -0,0 +1,23 @@
+#pragma once
+
+// Compile-time and runtime detection of SIMD instruction sets.
+//
+// SUBZERO_X86_SIMD is defined when the compiler can build SSE2 code and
+// per-function AVX2 code (GCC 4.9+ or Clang on x86). Kernels that use
+// AVX2 are marked SUBZERO_TARGET_AVX2 and must only be called after
+// cpu::hasAVX2() returned true. Every kernel keeps a portable scalar
+// version for other compilers and targets such as the Atari build.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define SUBZERO_X86_SIMD
+#define SUBZERO_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace subzero {
+namespace cpu {
+
+bool hasSSE2();
+bool hasAVX2();
+
+} // namespace cpu
+} // namespace subzero
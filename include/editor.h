@@ -1,6 +1,7 @@
 #pragma once
 #include "buffer.h"
 #include "window.h"
+#include "window_layout.h"
 #include "terminal.h"
 #include "syntax_highlighter_manager.h"
 #include "compat.h"
@@ -18,13 +19,32 @@ enum EditorMode {
     SEARCH      // Search mode (/, ?)
 };
 
+// Jumps waiting for background indexing to reach their target
+enum PendingJump {
+    JUMP_NONE,
+    JUMP_LINE,
+    JUMP_LAST_LINE,
+    JUMP_BYTE
+};
+
+// What has to be redrawn on the next frame; the levels combine as flags
+enum Invalidation {
+    INVALIDATE_NONE = 0,
+    INVALIDATE_CURSOR = 1,      // Cursor position only
+    INVALIDATE_STATUS = 2,      // Status bar text
+    INVALIDATE_LINES = 4,       // Edited lines and line numbers, which the window tracks itself
+    INVALIDATE_VIEWPORT = 8     // Every row of the window (scrolled, resized, new buffer)
+};
+
 // Remove KeyBinding struct for C++98 compatibility
 
 class Editor {
 private:
     shared_ptr<ITerminal> m_terminal;
     shared_ptr<Buffer> m_buffer;  // Current active buffer
-    shared_ptr<Window> m_window;
+    shared_ptr<Window> m_window;   // Active window, showing m_buffer
+    shared_ptr<WindowLayout> m_layout;
+    TerminalSize m_layout_size;   // Terminal size the windows were arranged for
     
     // Buffer management
     std::vector<shared_ptr<Buffer> > m_buffers;
@@ -38,6 +58,9 @@ private:
     std::string m_search_pattern;
     std::string m_last_search;
     bool m_search_forward;
+    bool m_highlight_search;    // Show matches of the last search until :noh
+    bool m_undo_file;           // Keep undo history in a file next to each file
+    BufferPosition m_visual_anchor;     // Where visual mode started
     
     // Status and messages
     std::string m_status_message;
@@ -45,9 +68,14 @@ private:
     
     // Editor state
     bool m_running;
-    bool m_dirty_display;
-    bool m_fast_mode;  // Disable expensive operations during rapid typing
-    int m_render_delay_counter;  // Defer rendering during rapid typing
+    unsigned m_invalid;         // Invalidation flags for the next render
+    const Buffer* m_rendered_buffer;    // What the last render showed
+    uint64_t m_rendered_version;
+    BufferPosition m_rendered_cursor;
+    unsigned long m_last_frame_ms;  // When the last frame finished
+    unsigned long m_frame_cost_ms;  // Smoothed time a frame takes to draw
+    PendingJump m_pending_jump;  // G, :N or :goto issued before the target was indexed
+    size_t m_pending_target;
     
     // Command sequence handling
     std::string m_command_sequence;
@@ -74,7 +102,7 @@ public:
     void quit() { m_running = false; }
     
     // File operations
-    bool openFile(const std::string& filename);
+    bool openFile(const std::string& filename, bool read_only = false);  // read_only: view only
     bool saveFile(const std::string& filename = "");
     bool newFile();
     
@@ -88,6 +116,14 @@ public:
     int getCurrentBufferIndex() const { return m_current_buffer_index; }
     size_t getBufferCount() const { return m_buffers.size(); }
     
+    // Window management
+    bool splitWindow(bool vertical);
+    bool closeWindow();
+    void onlyWindow();
+    void focusWindow(shared_ptr<Window> window);
+    void windowCommand(const std::string& key);    // The key after Ctrl-W
+    size_t getWindowCount() const { return m_layout ? m_layout->getWindows().size() : 0; }
+    
     // Mode management
     EditorMode getMode() const { return m_mode; }
     void setMode(EditorMode mode);
@@ -96,6 +132,7 @@ public:
     // Display
     void render();
     void renderStatusBar();
+    void renderWindowFrames();
     void setStatusMessage(const std::string& message);
     void setErrorMessage(const std::string& message);
     
@@ -119,6 +156,8 @@ public:
     void moveFirstLine();
     void moveLastLine();
     void movePage(bool down);
+    void moveToLine(size_t line);        // 0-based line number
+    void moveToByte(size_t byte_offset); // 0-based byte offset in the file
     
     // Edit commands (Normal mode)
     void enterInsertMode();
@@ -146,7 +185,6 @@ public:
     
     // Search helper methods
     bool findInBuffer(const std::string& pattern, bool forward, bool wrap_around = true);
-    bool findInLine(const std::string& line, const std::string& pattern, int start_pos, int& found_pos, bool case_sensitive = true);
     bool matchesAtPosition(const std::string& text, const std::string& pattern, size_t pos, bool case_sensitive = true);
     std::string getCurrentWord();
     void executeSearch();
@@ -154,7 +192,9 @@ public:
     // Command mode
     void enterCommandMode();
     void executeCommand(const std::string& command);
+    void setOption(const std::string& option);    // :set
     void showHelp();
+    void showMemoryUsage();
     
     // Visual mode
     void enterVisualMode();
@@ -166,9 +206,25 @@ private:
     void parseRepeatCount(const KeyPress& key);
     // Remove applyRepeatCount for C++98 compatibility
     void clearMessages();
+    void invalidate(unsigned levels) { m_invalid |= levels; }
     TerminalSize getEditorArea() const;
+    void layoutWindows();
+    void replaceBufferInWindows(const shared_ptr<Buffer>& closed);
     void refreshDisplay();
     
+    // Frame pacing: keys arriving in a burst are handled in batches, with
+    // a frame at most every getFrameInterval() milliseconds
+    static const unsigned long MIN_FRAME_INTERVAL_MS = 33;
+    static const unsigned long MAX_FRAME_INTERVAL_MS = 100;
+    void renderFrame();
+    unsigned long getFrameInterval() const;
+    
+    // Background indexing
+    static const int INDEX_POLL_MS = 20;
+    void waitForInput();
+    bool completePendingJump();
+    void deferJump(PendingJump jump, size_t target);
+    
     // Command sequence handling
     void handleCommandSequence(const std::string& key);
     void executeCommandSequence();
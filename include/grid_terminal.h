@@ -0,0 +1,68 @@
+#pragma once
+#include "terminal.h"
+#include "screen_grid.h"
+#include "compat.h"
+
+namespace subzero {
+
+// Terminal wrapper that only sends what changed.
+//
+// Output is composed into a back grid instead of going straight to the
+// terminal. refresh() compares it with the front grid, which holds what
+// the terminal is showing, and sends just the runs of cells that differ,
+// so moving the cursor or typing a character costs a few bytes rather
+// than a screen. Input and mode control pass straight through.
+class GridTerminal : public ITerminal {
+private:
+    shared_ptr<ITerminal> m_terminal;
+    ScreenGrid m_front;         // What the terminal shows
+    ScreenGrid m_back;          // The frame being composed
+    Position m_cursor;
+
+    // Unchanged cells between two changed ones are resent rather than
+    // moving the cursor over gaps shorter than this
+    static const int MAX_GAP = 4;
+
+    void syncSize();
+    void flushRow(int row);
+    void sendRun(int row, int first, int end);
+
+public:
+    explicit GridTerminal(shared_ptr<ITerminal> terminal);
+
+    // Forget what the terminal shows, so the next refresh() resends every cell
+    void invalidate();
+
+    // ITerminal interface
+    bool initialize();
+    void shutdown();
+    bool isInitialized() const;
+
+    TerminalSize getSize() const;
+    void clear();
+    void refresh();
+    bool scrollRegion(int top, int bottom, int lines);
+
+    void setCursor(const Position& pos);
+    Position getCursor() const;
+    void showCursor(bool visible);
+
+    void putChar(const std::string& utf8_char, const Position& pos);
+    void putString(const std::string& utf8_str, const Position& pos);
+    void putStringWithColor(const std::string& utf8_str, const Position& pos,
+                           Color::Value fg, Color::Value bg = Color::BLACK);
+
+    KeyPress getKey();
+    bool hasInput();
+
+    void setColors(Color::Value fg, Color::Value bg);
+    void resetAttributes();
+
+    void enableRawMode();
+    void disableRawMode();
+    bool isRawMode() const;
+
+    std::string getLastError() const;
+};
+
+} // namespace subzero
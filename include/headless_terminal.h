@@ -0,0 +1,102 @@
+#pragma once
+#include "terminal.h"
+#include "screen_grid.h"
+#include <cstdio>
+#include <deque>
+
+namespace subzero {
+
+// Terminal that needs no tty: keys come from a script and output is drawn
+// into an in-memory grid, with every call and byte counted. It lets the
+// editor run unattended, to measure what rendering costs and to check the
+// screen it leaves.
+//
+// Keys are handed out one at a time, as typed, so every key gets a frame
+// of its own and the counts don't depend on timing. Once the script runs
+// out the terminal shuts itself down, which ends Editor::run().
+class HeadlessTerminal : public ITerminal {
+public:
+    // What the editor sent, since the start or resetStats()
+    struct Stats {
+        size_t put_calls;       // putChar, putString and putStringWithColor
+        size_t bytes;           // Text bytes in those calls
+        size_t refreshes;
+        size_t scrolls;         // scrollRegion calls
+        size_t clears;
+        size_t keys;            // Keys handed to the editor
+
+        Stats() : put_calls(0), bytes(0), refreshes(0), scrolls(0), clears(0), keys(0) {}
+    };
+
+    explicit HeadlessTerminal(const TerminalSize& size = TerminalSize(24, 80));
+    virtual ~HeadlessTerminal();
+
+    // Queue keys in vim's notation: characters stand for themselves, and
+    // <Esc>, <CR>, <BS>, <Tab>, <Del>, <Up>, <Down>, <Left>, <Right>,
+    // <Home>, <End>, <PageUp>, <PageDown>, <F1>..<F12>, <C-a>..<C-z> and
+    // <lt> (for '<') for the others. Returns false, having queued nothing,
+    // if a <...> names no key.
+    bool addKeys(const std::string& script);
+    void addKey(const KeyPress& key);
+    size_t getPendingKeys() const { return m_keys.size(); }
+
+    // Resize as a window would; the editor notices on its next frame
+    void setSize(const TerminalSize& size);
+
+    const ScreenGrid& getScreen() const { return m_screen; }
+    std::string getRowText(int row) const;     // Without trailing blanks
+    const Stats& getStats() const { return m_stats; }
+    void resetStats() { m_stats = Stats(); }
+
+    // The screen, then the counts, as plain text
+    void writeReport(FILE* out) const;
+
+    // ITerminal interface
+    bool initialize();
+    void shutdown();
+    bool isInitialized() const;
+
+    TerminalSize getSize() const;
+    void clear();
+    void refresh();
+    bool scrollRegion(int top, int bottom, int lines);
+
+    void setCursor(const Position& pos);
+    Position getCursor() const;
+    void showCursor(bool visible);
+
+    void putChar(const std::string& utf8_char, const Position& pos);
+    void putString(const std::string& utf8_str, const Position& pos);
+    void putStringWithColor(const std::string& utf8_str, const Position& pos,
+                           Color::Value fg, Color::Value bg = Color::BLACK);
+
+    KeyPress getKey();
+    bool hasInput();
+
+    void setColors(Color::Value fg, Color::Value bg);
+    void resetAttributes();
+
+    void enableRawMode();
+    void disableRawMode();
+    bool isRawMode() const;
+
+    std::string getLastError() const;
+
+private:
+    bool m_initialized;
+    bool m_raw_mode;
+    std::string m_last_error;
+
+    TerminalSize m_size;
+    ScreenGrid m_screen;
+    Position m_cursor;
+    bool m_cursor_visible;
+
+    std::deque<KeyPress> m_keys;
+    Stats m_stats;
+
+    void putText(const std::string& text, const Position& pos, uint8_t fg, uint8_t bg);
+    static bool parseKeyName(const std::string& name, KeyPress& key);
+};
+
+} // namespace subzero
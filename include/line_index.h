@@ -0,0 +1,208 @@
+#pragma once
+#include "compat.h"
+#include <string>
+#include <vector>
+
+namespace subzero {
+
+// Per-line metadata kept by the line index. Lengths are 40 bits, split
+// so that the entry stays 12 bytes; no file longer than MAX_LENGTH is
+// indexed, so no line can overflow them.
+struct LineInfo {
+    uint32_t bytes_low;     // Content length in bytes, excluding the line ending
+    uint32_t chars_low;     // Content length in characters
+    uint8_t bytes_high;
+    uint8_t chars_high;
+    uint8_t eol;            // Length of the line ending (0 for the last line, 1 or 2)
+
+    static const uint64_t MAX_LENGTH = (static_cast<uint64_t>(1) << 40) - 1;
+
+    LineInfo(size_t b = 0, size_t c = 0, uint8_t e = 0) : eol(e) {
+        setBytes(b);
+        setChars(c);
+    }
+
+    size_t bytes() const { return join(bytes_low, bytes_high); }
+    size_t chars() const { return join(chars_low, chars_high); }
+    void setBytes(size_t b) { split(b, bytes_low, bytes_high); }
+    void setChars(size_t c) { split(c, chars_low, chars_high); }
+
+    size_t totalBytes() const { return bytes() + eol; }
+    size_t totalChars() const { return chars() + eol; }
+
+    // Every character is a single byte, so columns are byte offsets
+    bool isAscii() const { return bytes_low == chars_low && bytes_high == chars_high; }
+
+private:
+    static size_t join(uint32_t low, uint8_t high) {
+        return static_cast<size_t>((static_cast<uint64_t>(high) << 32) | low);
+    }
+    static void split(uint64_t length, uint32_t& low, uint8_t& high) {
+        low = static_cast<uint32_t>(length);
+        high = static_cast<uint8_t>(length >> 32);
+    }
+};
+
+// Summary of scanned text, gathered in the same pass as its lines
+struct LineScanStats {
+    size_t lf_lines;     // Lines ending in "\n"
+    size_t crlf_lines;   // Lines ending in "\r\n"
+    bool ascii;          // No bytes above 0x7F
+
+    LineScanStats() : lf_lines(0), crlf_lines(0), ascii(true) {}
+
+    void add(const LineScanStats& other) {
+        lf_lines += other.lf_lines;
+        crlf_lines += other.crlf_lines;
+        ascii = ascii && other.ascii;
+    }
+};
+
+// Index over the lines of a document that answers line <-> byte offset <->
+// character offset queries in O(log n).
+//
+// Lines are stored in blocks of a few hundred entries. Each block keeps its
+// line, byte and character totals, and three Fenwick trees over the blocks
+// give prefix sums of those totals. Editing a line updates its block and the
+// trees incrementally; only splitting, merging or removing blocks rebuilds
+// the trees, which happens at most once every few hundred lines inserted or
+// deleted: a block that deletions leave nearly empty is merged into its
+// neighbour, so later edits there stay inside one block.
+//
+// Blocks have a fixed capacity and are carved out of slabs that grow in
+// size as the index grows, so indexing a file with millions of lines makes
+// only a few dozen allocations, and clear() releases them just as quickly.
+// Edits leave partly filled blocks and free slots behind; compact() packs
+// them together again.
+//
+// For text that never changes, such as a file opened read-only, the index
+// can instead be sparse: each appended run of lines only records its line,
+// byte and character totals, and lines are rescanned from the text when
+// they are looked up. The index then stays a few bytes per megabyte of
+// text however many lines there are, but replace() is not available.
+class LineIndex {
+public:
+    LineIndex();
+    ~LineIndex();
+
+    void clear();
+
+    // Clear and index the given text sparsely from now on. The text must
+    // stay valid until the next clear().
+    void clearSparse(const char* text);
+    bool isSparse() const { return m_sparse_text != NULL; }
+
+    // Totals
+    size_t getLineCount() const { return m_line_count; }
+    size_t getTotalBytes() const { return m_total_bytes; }
+    size_t getTotalChars() const { return m_total_chars; }
+
+    // Line lookup
+    const LineInfo& getLine(size_t line) const;
+    size_t getLineOffset(size_t line) const;       // Byte offset of the line start
+    size_t getLineCharOffset(size_t line) const;   // Character offset of the line start
+    size_t findLineByOffset(size_t byte_offset) const;
+    size_t findLineByCharOffset(size_t char_offset) const;
+
+    // Modification
+    void append(const LineInfo& info);
+    void append(const std::vector<LineInfo>& lines);
+    void replace(size_t first, size_t count, const std::vector<LineInfo>& lines);
+
+    // Memory held by the index, and whether compact() would give back a
+    // noticeable part of it
+    size_t getMemoryUsage() const;
+    bool needsCompaction() const;
+    void compact();
+
+    // How often the trees were rebuilt from the blocks, which takes time
+    // linear in their number; for tests and benchmarks
+    size_t getTreeRebuilds() const { return m_tree_rebuilds; }
+
+    // Characters are counted as bytes that do not continue a UTF-8 sequence
+    static size_t countChars(const char* data, size_t length);
+
+    // Split text into line records. Every line break ends a line; the text
+    // after the last break is only reported when final_line is set, since
+    // it is then the (possibly empty) last line of the document. Uses SSE2
+    // or AVX2 where available to find breaks and count characters in blocks.
+    static void scanLines(const char* data, size_t length, bool final_line, std::vector<LineInfo>& out,
+                          LineScanStats* stats = NULL);
+
+private:
+    static const size_t BLOCK_SIZE = 480;       // Lines per block when building
+    static const size_t MAX_BLOCK_SIZE = 512;   // Capacity of a block
+    static const size_t MAX_SLAB_BLOCKS = 32;   // Blocks per slab once the index is large
+    static const size_t MIN_BLOCK_SIZE = 64;    // Smaller blocks are merged into a neighbour
+
+    struct Block {
+        size_t count;   // Lines in use
+        size_t bytes;   // Including line endings
+        size_t chars;   // Including line endings
+        LineInfo lines[MAX_BLOCK_SIZE];
+
+        void recount();
+    };
+
+    struct Slab {
+        Block* blocks;
+        size_t capacity;
+    };
+
+    std::vector<Block*> m_blocks;
+    std::vector<Slab> m_slabs;
+    std::vector<Block*> m_free_blocks;
+    size_t m_line_count;
+    size_t m_total_bytes;
+    size_t m_total_chars;
+
+    // Fenwick trees over block totals (1-based), rebuilt lazily
+    mutable std::vector<size_t> m_tree_lines;
+    mutable std::vector<size_t> m_tree_bytes;
+    mutable std::vector<size_t> m_tree_chars;
+    mutable bool m_tree_valid;
+    mutable size_t m_tree_rebuilds;
+
+    Block* allocateBlock();
+    void releaseBlock(Block* block);
+    void insertLines(size_t block_index, size_t local, const LineInfo* lines, size_t count);
+    void removeEmptyBlocks(size_t first, size_t last);
+    void mergeSmallBlock(size_t index);
+    void mergeBlocks();
+    void releaseSparseSlabs();
+
+    void ensureTree() const;
+    void updateTree(size_t block, size_t lines_delta, size_t bytes_delta, size_t chars_delta);
+    size_t prefixSum(const std::vector<size_t>& tree, size_t blocks) const;
+    size_t findBlock(const std::vector<size_t>& tree, size_t value, size_t& before) const;
+    size_t findBlockByLine(size_t line, size_t& lines_before) const;
+
+    // Sparse mode: prefix sums over the appended runs ("spans") of lines,
+    // with one more entry than there are spans
+    struct SpanLines {
+        size_t span;
+        std::vector<LineInfo> lines;
+        std::vector<size_t> bytes;      // Prefix sums within the span
+        std::vector<size_t> chars;
+        unsigned long used;             // Last use, for eviction
+    };
+
+    static const size_t SPAN_CACHE_SIZE = 4;
+
+    const char* m_sparse_text;
+    std::vector<size_t> m_span_lines;
+    std::vector<size_t> m_span_bytes;
+    std::vector<size_t> m_span_chars;
+    mutable std::vector<SpanLines> m_span_cache;
+    mutable unsigned long m_span_clock;
+
+    void appendSpan(const LineInfo* lines, size_t count);
+    const SpanLines& loadSpan(size_t span) const;
+    static size_t findSpan(const std::vector<size_t>& sums, size_t value);
+
+    // Non-copyable: owns its slabs
+    LineIndex(const LineIndex&);
+    LineIndex& operator=(const LineIndex&);
+};
+
+} // namespace subzero
@@ -0,0 +1,87 @@
+#pragma once
+#include "buffer.h"
+#include "compat.h"
+#include <deque>
+#include <vector>
+#include <stdint.h>
+
+namespace subzero {
+
+// Screen columns of the characters of one line. Tabs reach the next tab
+// stop, East Asian wide characters and control characters (shown as ^X)
+// take two columns, combining marks none, and everything else one.
+struct LineColumns {
+    size_t chars;                   // Characters in the line
+    size_t width;                   // Columns of the whole line
+    std::vector<uint32_t> starts;   // Column of each character, then width;
+                                    // empty if every character takes one
+
+    LineColumns() : chars(0), width(0) {}
+
+    // Column where a character starts; past the end of the line every
+    // character takes one column
+    size_t columnOf(size_t ch) const;
+
+    // The character covering a column, passing over combining marks that
+    // belong to the character before it; past the end of the line, as
+    // columnOf
+    size_t charAt(size_t column) const;
+};
+
+// How buffer lines are laid out on screen: the columns of their
+// characters and, when they are soft wrapped, where they break into rows.
+//
+// Laying a line out means reading it and measuring every character, so
+// the layout of the lines around the view is kept, for a run of
+// consecutive lines. Edits only drop the layout of the lines they touched;
+// lines after an edit that added or removed lines keep theirs and just
+// move. Drawing, placing the cursor and scrolling then cost O(rows shown),
+// not a pass over every line on every frame.
+class LineLayout {
+public:
+    LineLayout();
+
+    // Tab stops, in columns; changing them drops every line's layout
+    void setTabWidth(size_t tab_width);
+
+    // Width of a wrapped row, 0 for lines that do not wrap; changing it
+    // drops every line's rows but keeps their columns
+    void setWrapWidth(size_t width);
+    void clear();
+
+    const LineColumns& getColumns(const Buffer& buffer, size_t line);
+
+    // Columns where each of a line's rows starts; the first is 0, so a line
+    // that fits has one
+    const std::vector<size_t>& getRowStarts(const Buffer& buffer, size_t line);
+    size_t getRowCount(const Buffer& buffer, size_t line) { return getRowStarts(buffer, line).size(); }
+
+    // The row of a line holding the given character
+    size_t getRowOf(const Buffer& buffer, size_t line, size_t ch);
+
+    // Follow an edit reported by the buffer
+    void linesChanged(const BufferChange& change);
+
+private:
+    // Lines kept at most; the run moves to where lines are asked for
+    static const size_t MAX_LINES = 4096;
+
+    struct Entry {
+        bool measured;
+        LineColumns columns;
+        std::vector<size_t> row_starts;     // Empty until broken
+
+        Entry() : measured(false) {}
+    };
+
+    size_t m_tab_width;
+    size_t m_wrap_width;
+    size_t m_first;                 // Line of m_lines.front()
+    std::deque<Entry> m_lines;
+
+    Entry& getEntry(const Buffer& buffer, size_t line);
+    void measureLine(const std::string& text, LineColumns& columns) const;
+    void breakLine(const LineColumns& columns, std::vector<size_t>& starts) const;
+};
+
+} // namespace subzero
@@ -0,0 +1,56 @@
+#pragma once
+#include "compat.h"
+#include "line_index.h"
+#include <vector>
+
+namespace subzero {
+
+// Scans read-only text for line breaks in chunks of whole lines.
+//
+// Where threads are available the chunks are produced by a worker thread
+// ahead of time and handed over with takeChunk(); elsewhere takeChunk()
+// scans the next chunk itself. The text must stay valid and unchanged
+// until stop() is called.
+class LineScanner {
+public:
+    struct Chunk {
+        size_t end;                   // Offset just past the scanned text
+        bool last;                    // Chunk ends the text
+        std::vector<LineInfo> lines;
+        LineScanStats stats;
+    };
+
+    LineScanner();
+    ~LineScanner();
+
+    void start(const char* data, size_t begin, size_t end);
+    void stop();
+
+    // True while chunks remain to be taken
+    bool isActive() const { return m_active; }
+
+    // Take the next chunk in order. Waits up to wait_ms milliseconds for
+    // the worker (forever if negative) and returns false on timeout.
+    bool takeChunk(Chunk& chunk, int wait_ms);
+
+    // Scan one chunk of roughly chunk_size bytes starting at begin,
+    // extended to the next line break
+    static void scanChunk(const char* data, size_t begin, size_t end, size_t chunk_size, Chunk& chunk);
+
+    static const size_t CHUNK_SIZE = 1024 * 1024;
+
+private:
+    struct Worker;                    // Platform thread state
+
+    const char* m_data;
+    size_t m_end;
+    size_t m_next;                    // Start of the next chunk to take
+    bool m_active;
+    Worker* m_worker;
+
+    // Non-copyable: owns a running thread
+    LineScanner(const LineScanner&);
+    LineScanner& operator=(const LineScanner&);
+};
+
+} // namespace subzero
@@ -0,0 +1,60 @@
+#pragma once
+#include "compat.h"
+#include <string>
+
+namespace subzero {
+
+// Read-only view of a whole file.
+//
+// On platforms with memory mapping the file is mapped into the address space
+// and pages are only read from disk when they are touched. Elsewhere the file
+// is read into memory once, so callers see the same interface everywhere.
+// Small files, and files that report no size, are always read.
+class MappedFile {
+public:
+    static const long MIN_MAP_SIZE = 64 * 1024;
+
+
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const std::string& filename);
+    void close();
+
+    bool isOpen() const { return m_open; }
+    bool isMapped() const { return m_mapped; }
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    const std::string& getFilename() const { return m_filename; }
+    std::string getLastError() const { return m_last_error; }
+
+    // True if the mapped file was truncated or written to since it was
+    // opened, so the mapping may no longer hold the text that was read.
+    // Replacing the file by renaming another over it does not count.
+    bool hasChanged() const;
+
+private:
+    std::string m_filename;
+    const char* m_data;
+    size_t m_size;
+    bool m_open;
+    bool m_mapped;
+    std::string m_contents;   // Used when the file could not be mapped
+    std::string m_last_error;
+    uint64_t m_mtime;         // Modification time when mapped
+
+#if defined(LINUX_PLATFORM) || defined(MACOS_PLATFORM)
+    int m_fd;                 // Kept open to notice changes to the file
+#elif defined(WINDOWS_PLATFORM)
+    void* m_file_handle;
+    void* m_mapping_handle;
+#endif
+
+    bool readWholeFile(const std::string& filename);
+
+    // Non-copyable: the mapping is owned by exactly one object
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+} // namespace subzero
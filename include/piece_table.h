@@ -0,0 +1,118 @@
+#pragma once
+#include "compat.h"
+#include "mapped_file.h"
+#include <string>
+#include <vector>
+
+namespace subzero {
+
+// Read-only view of piece table text.
+//
+// Copying a TextSnapshot is O(1): the original text, the add buffer and the
+// piece list are shared, not copied. A PieceTable never modifies anything a
+// snapshot of it can see, so a snapshot stays valid and unchanged while
+// editing continues, and may be read on another thread.
+class TextSnapshot {
+public:
+    enum Source { ORIGINAL, ADD };
+
+    struct Piece {
+        Source source;
+        size_t start;        // Byte offset into the source buffer
+        size_t length;       // Length in bytes
+
+        Piece(Source s = ORIGINAL, size_t st = 0, size_t len = 0)
+            : source(s), start(st), length(len) {}
+    };
+
+    TextSnapshot();
+
+    // Size information
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t getPieceCount() const { return m_pieces->size(); }
+
+    // The bytes of one piece; walking all pieces in order yields the document
+    void getPieceData(size_t index, const char*& data, size_t& length) const;
+
+    // Byte access
+    char byteAt(size_t offset) const;
+    void read(size_t offset, size_t length, std::string& out) const;
+    std::string read(size_t offset, size_t length) const;
+
+    // Point directly at a range that lies inside a single piece, without
+    // copying. Returns false if the range spans several pieces.
+    bool getSpan(size_t offset, size_t length, const char*& data) const;
+
+    // Find the first occurrence of pattern starting in [from, to)
+    bool find(const std::string& pattern, size_t from, size_t to, size_t& match) const;
+
+    // Find the last occurrence of pattern starting in [from, to)
+    bool findLast(const std::string& pattern, size_t from, size_t to, size_t& match) const;
+
+protected:
+    shared_ptr<MappedFile> m_mapping;
+    shared_ptr<std::string> m_original;     // Owns the original unless it is mapped
+    const char* m_original_data;
+    size_t m_original_size;
+    shared_ptr<std::string> m_add;
+    const char* m_add_data;                 // Add buffer bytes visible to this view
+    shared_ptr<std::vector<Piece> > m_pieces;
+    size_t m_size;
+
+    const char* sourceData(Source source) const;
+    size_t findPiece(size_t offset, size_t& piece_offset) const;
+};
+
+// Piece table text storage.
+//
+// The document is described by a list of pieces, each referring to a span of
+// either the original text (never modified, never copied) or the append-only
+// add buffer that receives every inserted byte. Inserting or erasing text only
+// splits or trims pieces, so the cost of an edit depends on the number of
+// pieces rather than on the size of the document.
+//
+// snapshot() shares the storage with the returned view. The next edit copies
+// the piece list, and the add buffer is only copied if it has to grow beyond
+// its capacity; bytes appended within capacity lie past everything the
+// snapshot refers to.
+class PieceTable : public TextSnapshot {
+public:
+    PieceTable();
+
+    // Replace the whole document. The string is taken over by swapping, so
+    // the caller's copy is left empty and no bytes are duplicated. A mapped
+    // file is referenced directly and only paged in as it is read.
+    void reset();
+    void reset(std::string& original);
+    void reset(shared_ptr<MappedFile> file);
+
+    // Copy a mapped original into memory, e.g. before the file is overwritten
+    void detach();
+    bool isMapped() const { return m_mapping.get() != NULL; }
+    bool mappingChanged() const { return m_mapping.get() != NULL && m_mapping->hasChanged(); }
+
+    // The original text, which pieces may refer to but never modify
+    const char* getOriginalData() const { return m_original_data; }
+    size_t getOriginalSize() const { return m_original_size; }
+
+    // O(1) immutable view of the current text
+    TextSnapshot snapshot() const;
+
+    // Editing
+    void insert(size_t offset, const std::string& text);
+    void erase(size_t offset, size_t length);
+
+private:
+    mutable bool m_pieces_shared;   // A snapshot refers to m_pieces
+    mutable bool m_add_shared;      // A snapshot refers to m_add
+
+    std::vector<Piece>& editPieces();
+    size_t appendAdd(const std::string& text);
+
+    // Copying would share the add buffer between two writers
+    PieceTable(const PieceTable&);
+    PieceTable& operator=(const PieceTable&);
+};
+
+} // namespace subzero
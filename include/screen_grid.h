@@ -0,0 +1,64 @@
+#pragma once
+#include "compat.h"
+#include "terminal_types.h"
+#include <string>
+#include <vector>
+
+namespace subzero {
+
+// One character cell of the screen: a glyph and its colors
+struct ScreenCell {
+    uint32_t glyph;     // UTF-8 bytes of one character (and any combining
+                        // marks that fit), first byte lowest
+    uint8_t fg;         // Color::Value, or DEFAULT_COLOR
+    uint8_t bg;
+
+    static const uint8_t DEFAULT_COLOR = 0xFF;    // The terminal's own colors
+    static const uint32_t WIDE_TAIL = 0xFFFFFFFF;  // Right half of a wide character
+
+    ScreenCell(uint32_t g = ' ', uint8_t f = DEFAULT_COLOR, uint8_t b = DEFAULT_COLOR)
+        : glyph(g), fg(f), bg(b) {}
+
+    bool operator==(const ScreenCell& other) const {
+        return glyph == other.glyph && fg == other.fg && bg == other.bg;
+    }
+    bool operator!=(const ScreenCell& other) const { return !(*this == other); }
+    bool sameColors(const ScreenCell& other) const { return fg == other.fg && bg == other.bg; }
+
+    void appendGlyph(std::string& out) const;
+};
+
+// A rows x cols grid of cells, one per terminal column. A wide character
+// takes two: its glyph followed by a WIDE_TAIL cell.
+class ScreenGrid {
+public:
+    ScreenGrid();
+
+    int getRows() const { return m_rows; }
+    int getCols() const { return m_cols; }
+
+    // Resize and fill every cell with the given one
+    void reset(int rows, int cols, const ScreenCell& fill = ScreenCell());
+
+    ScreenCell& at(int row, int col) { return m_cells[static_cast<size_t>(row) * m_cols + col]; }
+    const ScreenCell& at(int row, int col) const { return m_cells[static_cast<size_t>(row) * m_cols + col]; }
+
+    // Move rows top..bottom up by lines (down if negative), filling the
+    // rows that scroll in with the given cell
+    void scroll(int top, int bottom, int lines, const ScreenCell& fill = ScreenCell());
+
+    // Write UTF-8 text from pos, clipped to the row; returns the number of
+    // cells written
+    int put(const Position& pos, const std::string& utf8, uint8_t fg, uint8_t bg);
+
+private:
+    int m_rows;
+    int m_cols;
+    std::vector<ScreenCell> m_cells;
+
+    // Overwriting half of a wide character blanks the other half, as
+    // terminals do
+    void set(int row, int col, const ScreenCell& cell);
+};
+
+} // namespace subzero
@@ -9,6 +9,7 @@
 #include "terminal_types.h"
 #include "terminal.h"
 #include "terminal_factory.h"
+#include "headless_terminal.h"
 #include "utf8_utils.h"
 
 // Editor components
@@ -7,8 +7,8 @@
 namespace subzero {
 
 struct SyntaxToken {
-    size_t start_pos;      // Character position in line (not byte position)
-    size_t length;         // Length in characters
+    size_t start_pos;      // Byte offset in the line
+    size_t length;         // Length in bytes
     Color::Value color;    // Foreground color
     Color::Value bg_color; // Background color (usually BLACK)
     bool bold;             // Bold text
@@ -17,6 +17,11 @@ public:
     virtual void clear() = 0;
     virtual void refresh() = 0;
     
+    // Move the contents of rows top..bottom up by lines (down if negative),
+    // blanking the rows that scroll in. Returns false if the terminal can't,
+    // in which case the rows have to be redrawn.
+    virtual bool scrollRegion(int top, int bottom, int lines) = 0;
+    
     // Cursor management
     virtual void setCursor(const Position& pos) = 0;
     virtual Position getCursor() const = 0;
@@ -0,0 +1,81 @@
+#pragma once
+#include "compat.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace subzero {
+
+// One recorded edit: the bytes removed at offset and the bytes put in
+// their place
+struct UndoEntry {
+    size_t offset;
+    std::string erased;
+    std::string inserted;
+};
+
+// 64-bit hash of a byte stream, independent of how the stream is split
+// into update() calls
+class ContentHash {
+public:
+    ContentHash();
+    void update(const char* data, size_t length);
+    uint64_t value() const;
+
+private:
+    uint64_t m_hash;
+    uint64_t m_length;
+    unsigned char m_tail[8];        // Bytes waiting for a whole word
+    size_t m_tail_size;
+
+    void mix(uint64_t word);
+};
+
+// Undo history kept on disk next to a file, so it survives closing the file.
+//
+// The file is an append-only sequence of records: undo groups, truncations
+// of the group list (after undoing and then making new changes) and save
+// markers that tie the list to the text that was saved. Opening only reads
+// the record headers; groups are read one at a time when they are undone.
+class UndoFile {
+public:
+    struct Index {
+        std::vector<uint64_t> groups;   // File offsets of the listed groups
+        uint64_t saved_count;           // Groups applied to the saved text
+        uint64_t saved_size;            // Size of the saved text
+        uint64_t saved_hash;            // ContentHash of the saved text
+        bool clean;                     // Nothing follows the last save marker
+    };
+
+    UndoFile();
+    ~UndoFile();
+
+    // ".name.sz-undo" in the directory of the file
+    static std::string pathFor(const std::string& filename);
+
+    static bool readIndex(const std::string& path, Index& index);
+    static bool readGroup(const std::string& path, uint64_t offset, std::vector<UndoEntry>& entries,
+                          size_t& cursor_line, size_t& cursor_column);
+
+    // Open for appending, or start a new empty file if truncate is set.
+    // The file gets the read and write permissions of source.
+    bool open(const std::string& path, bool truncate, const std::string& source);
+    bool writeGroup(const std::vector<UndoEntry>& entries, size_t cursor_line, size_t cursor_column,
+                    uint64_t& offset);
+    bool writeTruncate(uint64_t count);
+    bool writeSave(uint64_t count, uint64_t size, uint64_t hash);
+    bool close();
+
+private:
+    FILE* m_file;
+    uint64_t m_offset;              // End of the file
+    std::string m_buffer;           // Record being assembled
+
+    bool writeRecord(char type);
+
+    // Non-copyable: owns an open file
+    UndoFile(const UndoFile&);
+    UndoFile& operator=(const UndoFile&);
+};
+
+} // namespace subzero
@@ -32,8 +32,17 @@ bool isValid(const std::string& str);
 // Validate a single UTF-8 character starting at position
 bool isValidChar(const std::string& str, size_t pos);
 
+// Terminal columns taken by the character at position: 2 for East Asian
+// wide and fullwidth characters, 0 for combining marks and other
+// zero-width characters, otherwise 1
+int charWidth(const std::string& str, size_t pos);
+
 // Get substring by character positions (not byte positions)
 std::string substr(const std::string& str, size_t char_start, size_t char_length = std::string::npos);
 
+// The functions above use SSE2/AVX2 kernels when the CPU has them. This
+// switches back to the plain byte-at-a-time code, e.g. for benchmarking.
+void setSimdEnabled(bool enabled);
+
 } // namespace utf8
 } // namespace subzero
\ No newline at end of file
@@ -41,6 +41,7 @@ public:
     TerminalSize getSize() const;
     void clear();
     void refresh();
+    bool scrollRegion(int top, int bottom, int lines);
     
     void setCursor(const Position& pos);
     Position getCursor() const;
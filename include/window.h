@@ -3,11 +3,27 @@
 #include "terminal.h"
 #include "terminal_types.h"
 #include "syntax_highlighter.h"
+#include "line_layout.h"
 #include "compat.h"
 
 namespace subzero {
 
-class Window {
+// Colors of a stretch of text; plain text keeps the terminal's own colors
+struct TextStyle {
+    bool plain;
+    Color::Value fg;
+    Color::Value bg;
+    
+    TextStyle() : plain(true), fg(Color::WHITE), bg(Color::BLACK) {}
+    TextStyle(Color::Value f, Color::Value b) : plain(false), fg(f), bg(b) {}
+    
+    bool operator==(const TextStyle& other) const {
+        return plain == other.plain && (plain || (fg == other.fg && bg == other.bg));
+    }
+    bool operator!=(const TextStyle& other) const { return !(*this == other); }
+};
+
+class Window : public IBufferObserver {
 private:
     shared_ptr<Buffer> m_buffer;
     shared_ptr<ITerminal> m_terminal;
@@ -18,22 +34,76 @@ private:
     
     // Viewport (what part of buffer is visible)
     size_t m_top_line;          // First visible line in buffer
-    size_t m_left_column;       // First visible column in buffer
+    size_t m_top_row;           // First visible row of m_top_line when wrapping
+    size_t m_left_column;       // First visible screen column of the lines
     
     // Cursor display
     Position m_screen_cursor;   // Cursor position on screen
+    BufferPosition m_cursor;    // Buffer cursor while another window is active
+    bool m_cursor_saved;        // m_cursor holds the cursor, the window being inactive
     
     // Display settings
     bool m_show_line_numbers;
+    bool m_relative_numbers;    // Count lines from the cursor line
     bool m_wrap_lines;
     size_t m_tab_width;
     bool m_force_full_clear;    // Force full screen clear on next render
     
+    // Line number gutter: its width is kept while the line count stays in
+    // [m_number_width_low, m_number_width_high), and numbers are formatted
+    // into one reused string
+    mutable size_t m_number_width;
+    mutable size_t m_number_width_low;
+    mutable size_t m_number_width_high;
+    std::string m_gutter_text;
+    mutable LineLayout m_line_layout;   // Columns and row breaks of lines near the view
+    
     // Syntax highlighting
     ISyntaxHighlighter* m_syntax_highlighter;
     
+    // Visual selection and search matches, drawn over the syntax colors
+    bool m_selection_active;
+    bool m_selection_lines;             // Whole lines (V)
+    BufferPosition m_selection_start;   // Inclusive, start <= end
+    BufferPosition m_selection_end;
+    std::string m_search_highlight;
+    
+    // Buffer lines edited since the last render, [m_dirty_first, m_dirty_end)
+    size_t m_dirty_first;
+    size_t m_dirty_end;
+    
+    // One row of the window: a row of a buffer line (always 0 unless
+    // wrapping), or no line below the end of the buffer
+    struct ScreenRow {
+        size_t line;
+        size_t row;
+        
+        ScreenRow(size_t l, size_t r) : line(l), row(r) {}
+        bool operator==(const ScreenRow& other) const { return line == other.line && row == other.row; }
+        bool operator!=(const ScreenRow& other) const { return !(*this == other); }
+    };
+    
+    // Layout of the last render; rows only need repainting for edited lines
+    // or where they show another part of the buffer while it stays the same
+    bool m_layout_valid;
+    std::vector<ScreenRow> m_rendered_rows;
+    std::vector<size_t> m_rendered_numbers;     // Line number in each row's gutter
+    size_t m_rendered_top_line;
+    size_t m_rendered_cursor_line;
+    size_t m_rendered_top_row;
+    size_t m_rendered_left_column;
+    size_t m_rendered_number_width;
+    TerminalSize m_rendered_size;
+    Position m_rendered_pos;
+    ISyntaxHighlighter* m_rendered_highlighter;
+    
 public:
     Window(shared_ptr<ITerminal> terminal, shared_ptr<Buffer> buffer);
+    ~Window();
+    
+    // IBufferObserver
+    virtual void bufferChanged(const Buffer& buffer, const BufferChange& change);
+    virtual void bufferReset(const Buffer& buffer);
     
     // Window management
     void setPosition(const Position& pos) { m_window_pos = pos; }
@@ -46,12 +116,24 @@ public:
     shared_ptr<Buffer> getBuffer() const { return m_buffer; }
     
     // Display control
-    void setShowLineNumbers(bool show) { m_show_line_numbers = show; }
-    void setWrapLines(bool wrap) { m_wrap_lines = wrap; }
-    void setTabWidth(size_t width) { m_tab_width = width; }
+    void setShowLineNumbers(bool show) { m_show_line_numbers = show; m_layout_valid = false; }
+    bool getShowLineNumbers() const { return m_show_line_numbers; }
+    void setRelativeNumbers(bool relative) { m_relative_numbers = relative; m_layout_valid = false; }
+    bool getRelativeNumbers() const { return m_relative_numbers; }
+    bool gutterChanged() const;     // Relative line numbers have to follow the cursor
+    void setWrapLines(bool wrap);
+    bool getWrapLines() const { return m_wrap_lines; }
+    void setTabWidth(size_t width);
     
     // Syntax highlighting
     void setSyntaxHighlighter(ISyntaxHighlighter* highlighter) { m_syntax_highlighter = highlighter; }
+    ISyntaxHighlighter* getSyntaxHighlighter() const { return m_syntax_highlighter; }
+    
+    // Selection and search matches; changes mark the affected lines dirty
+    void setSelection(const BufferPosition& anchor, const BufferPosition& cursor, bool whole_lines);
+    void clearSelection();
+    void setSearchHighlight(const std::string& pattern);
+    bool hasDirtyLines() const { return m_dirty_first < m_dirty_end; }
     
     // Viewport operations
     void scrollUp(size_t lines = 1);
@@ -60,11 +142,15 @@ public:
     void scrollRight(size_t columns = 1);
     void scrollToLine(size_t line);
     void centerOnCursor();
+    size_t getTopLine() const { return m_top_line; }
+    size_t getLeftColumn() const { return m_left_column; }
+    void copyView(const Window& other);     // Show what other shows, with the same options
     
     // Rendering
     void render();
     void renderLine(size_t buffer_line, size_t screen_row);
-    void forceFullRefresh();  // Force complete screen clear and redraw
+    void forceFullRefresh();  // Clear and redraw every row on the next render
+    bool layoutChanged() const;   // The next render has to redraw every row
     void updateCursor();
     
     // Coordinate conversion
@@ -75,15 +161,32 @@ public:
     void ensureCursorVisible();
     Position getScreenCursor() const { return m_screen_cursor; }
     
+    // The buffer holds one cursor, which windows showing it take turns
+    // with: saveCursor() when the window stops being active, and
+    // restoreCursor() when it becomes active again
+    void saveCursor();
+    void restoreCursor();
+    
 private:
     void calculateScreenCursor();
+    void markLinesDirty(size_t first, size_t end);
+    bool viewChanged() const;   // Anything but the top line changed since the last render
+    bool scrollScreen(int rows);    // Move the rows on screen up (down if negative)
+    void buildRows(std::vector<ScreenRow>& rows) const;
+    void setTopAbove(size_t line, size_t row, size_t rows_above);
+    size_t rowsFromTop(size_t line, size_t row, size_t limit) const;
     size_t getTextAreaWidth() const;
     size_t getLineNumberWidth() const;
-    std::string formatLineNumber(size_t line_num) const;
-    std::string expandTabs(const std::string& line) const;
-    void renderLineNumbers(size_t screen_row, size_t buffer_line);
-    void renderText(const std::string& text, size_t screen_row, size_t start_col);
-    void renderSyntaxHighlightedText(const std::string& text, size_t buffer_line, size_t screen_row, size_t start_col);
+    size_t getCursorLine() const;
+    size_t getGutterNumber(size_t buffer_line, bool first_row) const;
+    size_t getDisplayColumn(const BufferPosition& pos) const;
+    void formatLineNumber(size_t number, bool left_aligned);
+    void renderLineNumbers(size_t screen_row, size_t number);
+    void renderRow(size_t buffer_line, size_t first_column, size_t width, bool first_row, size_t screen_row);
+    void styleLine(const std::string& line, size_t buffer_line, size_t first, std::vector<TextStyle>& styles) const;
+    size_t renderStyledText(const std::string& line, const LineColumns& columns, size_t first,
+                            const std::vector<TextStyle>& styles, size_t first_column, size_t end_column,
+                            size_t screen_row, size_t start_col);
 };
 
 } // namespace subzero
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+#include "window.h"
+#include "terminal_types.h"
+#include "compat.h"
+#include <vector>
+
+namespace subzero {
+
+enum WindowDirection {
+    WINDOW_LEFT,
+    WINDOW_RIGHT,
+    WINDOW_UP,
+    WINDOW_DOWN
+};
+
+// A column of '|' between side by side windows
+struct WindowSeparator {
+    Position pos;
+    int rows;
+
+    WindowSeparator(const Position& p, int r) : pos(p), rows(r) {}
+};
+
+// Arranges windows in a tree of splits.
+//
+// Every node of the tree is a window or a split that divides its area
+// evenly among its children, side by side or stacked. While more than one
+// window is open, the last row of each window's area is its title row,
+// showing the file it holds; side by side areas are divided by a
+// separator column.
+class WindowLayout {
+public:
+    // Smallest area a split may leave a window, title row included
+    static const int MIN_ROWS = 3;
+    static const int MIN_COLS = 12;
+
+    explicit WindowLayout(shared_ptr<Window> window);
+
+    // Place window above (left of, if vertical) target, sharing its area;
+    // false if target is not in the layout or its area is too small
+    bool split(const shared_ptr<Window>& target, shared_ptr<Window> window, bool vertical);
+
+    // Take a window out, giving its area to its neighbours; the last
+    // window cannot be removed
+    bool remove(const shared_ptr<Window>& window);
+
+    // Remove every window but the given one
+    void keepOnly(shared_ptr<Window> window);
+
+    // Size and place every window within the given area
+    void arrange(const Position& pos, const TerminalSize& size);
+
+    // Windows in screen order, top left first
+    const std::vector<shared_ptr<Window> >& getWindows() const { return m_windows; }
+    const std::vector<WindowSeparator>& getSeparators() const { return m_separators; }
+    bool hasTitles() const { return m_windows.size() > 1; }
+
+    // The window beside from in the given direction, preferring the one
+    // level with the given screen row (or column, going up or down); NULL
+    // if there is none
+    shared_ptr<Window> findNeighbor(const shared_ptr<Window>& from, WindowDirection direction, const Position& near) const;
+
+private:
+    struct Node {
+        shared_ptr<Window> window;      // Set for windows, NULL for splits
+        bool vertical;                  // Children side by side
+        std::vector<shared_ptr<Node> > children;
+        Node* parent;
+        Position pos;                   // Area from the last arrange()
+        TerminalSize size;
+
+        Node() : vertical(false), parent(NULL) {}
+    };
+
+    shared_ptr<Node> m_root;
+    std::vector<shared_ptr<Window> > m_windows;
+    std::vector<shared_ptr<Node> > m_leaves;    // The nodes of m_windows
+    std::vector<WindowSeparator> m_separators;
+
+    shared_ptr<Node> findNode(const shared_ptr<Node>& node, const Window* window) const;
+    void arrangeNode(const shared_ptr<Node>& node, const Position& pos, const TerminalSize& size);
+    void collectWindows(const shared_ptr<Node>& node);
+};
+
+} // namespace subzero
@@ -0,0 +1,539 @@
+#include "ansi_terminal.h"
+
+#if defined(LINUX_PLATFORM) || defined(MINTOS_PLATFORM)
+#include "utf8_utils.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace subzero {
+
+namespace {
+
+// Set by SIGWINCH; the size is asked for again on the next getSize()
+volatile sig_atomic_t g_resized = 0;
+struct sigaction g_saved_winch;
+
+void onResize(int /*signal*/) {
+    g_resized = 1;
+}
+
+const char* const SYNC_BEGIN = "\x1b[?2026h";
+const char* const SYNC_END = "\x1b[?2026l";
+
+void appendNumber(std::string& out, int n) {
+    char digits[12];
+    int count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + n % 10);
+        n /= 10;
+    } while (n > 0 && count < 12);
+    while (count > 0) {
+        out += digits[--count];
+    }
+}
+
+// SGR parameter of a color: 30-37 and 40-47, or 90-97 and 100-107 for
+// the bright ones
+int sgrColor(int color, bool background) {
+    int base = color < 8 ? 30 : 90 - 8;
+    return base + color + (background ? 10 : 0);
+}
+
+} // anonymous namespace
+
+AnsiTerminal::AnsiTerminal()
+    : m_initialized(false)
+    , m_raw_mode(false)
+    , m_synchronized(false)
+    , m_size(24, 80)
+    , m_cursor(0, 0)
+    , m_output_cursor(-1, -1)
+    , m_cursor_visible(true)
+    , m_fg(-1)
+    , m_bg(-1)
+{
+    memset(&m_saved_termios, 0, sizeof(m_saved_termios));
+}
+
+AnsiTerminal::~AnsiTerminal() {
+    shutdown();
+}
+
+bool AnsiTerminal::isSupported() {
+    const char* term = getenv("TERM");
+    if (!term || !*term) {
+        return false;
+    }
+    std::string name(term);
+    const char* families[] = { "xterm", "screen", "tmux", "rxvt", "linux", "vt100", "vt102", "vt220",
+                               "vt320", "ansi", "alacritty", "kitty", "foot", "wezterm", "konsole",
+                               "gnome", "putty", "st-", "contour", NULL };
+    for (int i = 0; families[i] != NULL; ++i) {
+        if (name.compare(0, strlen(families[i]), families[i]) == 0) {
+            return true;
+        }
+    }
+    return name == "st" || name.find("256color") != std::string::npos;
+}
+
+bool AnsiTerminal::initialize() {
+    if (m_initialized) {
+        return true;
+    }
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO)) {
+        m_last_error = "Not running in a terminal";
+        return false;
+    }
+    if (tcgetattr(STDIN_FILENO, &m_saved_termios) != 0) {
+        m_last_error = std::string("Cannot read terminal settings: ") + strerror(errno);
+        return false;
+    }
+
+    // Keys arrive one at a time and unechoed; signals and flow control
+    // stay on unless raw mode is asked for, as with ncurses
+    struct termios settings = m_saved_termios;
+    settings.c_lflag &= ~(ECHO | ICANON | IEXTEN);
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &settings) != 0) {
+        m_last_error = std::string("Cannot set terminal mode: ") + strerror(errno);
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onResize;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, &g_saved_winch);   // No SA_RESTART: a resize interrupts getKey()
+    g_resized = 0;
+    querySize();
+
+    m_initialized = true;
+    m_synchronized = probeSynchronizedUpdate();
+
+    // Alternate screen, no line wrap at the right margin, blank screen
+    m_output.clear();
+    m_output += "\x1b[?1049h\x1b[?7l\x1b[0m\x1b[H\x1b[2J";
+    m_fg = m_bg = -1;
+    m_output_cursor = Position(0, 0);
+    writeAll(m_output);
+    m_output.clear();
+    return true;
+}
+
+void AnsiTerminal::shutdown() {
+    if (!m_initialized) {
+        return;
+    }
+
+    m_output += "\x1b[0m\x1b[r\x1b[?7h\x1b[?25h\x1b[?1049l";
+    writeAll(m_output);
+    m_output.clear();
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &m_saved_termios);
+    sigaction(SIGWINCH, &g_saved_winch, NULL);
+    m_raw_mode = false;
+    m_initialized = false;
+}
+
+bool AnsiTerminal::isInitialized() const {
+    return m_initialized;
+}
+
+void AnsiTerminal::querySize() const {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        m_size = TerminalSize(ws.ws_row, ws.ws_col);
+        return;
+    }
+    const char* lines = getenv("LINES");
+    const char* columns = getenv("COLUMNS");
+    if (lines && columns && atoi(lines) > 0 && atoi(columns) > 0) {
+        m_size = TerminalSize(atoi(lines), atoi(columns));
+    }
+}
+
+bool AnsiTerminal::probeSynchronizedUpdate() {
+    // Ask for the state of mode 2026 (DECRQM), then for the device
+    // attributes, which every terminal answers: the wait ends with that
+    // answer rather than at the timeout. Anything else read meanwhile is
+    // typed keys and is kept.
+    if (!writeAll("\x1b[?2026$p\x1b[c")) {
+        return false;
+    }
+    std::string params;
+    for (int waited = 0; waited < QUERY_TIMEOUT_MS; waited += ESCAPE_DELAY_MS) {
+        if (takeReply("\x1b[?", 'c', params)) {
+            break;
+        }
+        readInput(ESCAPE_DELAY_MS);
+    }
+
+    // The mode is known and set (1) or reset (2) if the terminal has it
+    if (takeReply("\x1b[?2026;", '$', params)) {
+        if (!m_input.empty() && m_input[0] == 'y') {
+            m_input.erase(0, 1);
+        }
+        return params == "1" || params == "2";
+    }
+    return false;
+}
+
+bool AnsiTerminal::takeReply(const std::string& prefix, char final, std::string& params) {
+    for (size_t start = m_input.find(prefix); start != std::string::npos; start = m_input.find(prefix, start + 1)) {
+        size_t end = start + prefix.size();
+        while (end < m_input.size() && ((m_input[end] >= '0' && m_input[end] <= '9') || m_input[end] == ';')) {
+            ++end;
+        }
+        if (end < m_input.size() && m_input[end] == final) {
+            params = m_input.substr(start + prefix.size(), end - start - prefix.size());
+            m_input.erase(start, end + 1 - start);
+            return true;
+        }
+    }
+    return false;
+}
+
+TerminalSize AnsiTerminal::getSize() const {
+    if (!m_initialized) {
+        return TerminalSize(0, 0);
+    }
+    if (g_resized) {
+        g_resized = 0;
+        querySize();
+    }
+    return m_size;
+}
+
+void AnsiTerminal::clear() {
+    if (!m_initialized) return;
+    setSgr(-1, -1);     // Blanks take the current background
+    m_output += "\x1b[2J";
+}
+
+void AnsiTerminal::refresh() {
+    if (!m_initialized) return;
+
+    moveTo(m_cursor);
+    if (m_output.empty()) {
+        return;
+    }
+
+    // A synchronized update shows the frame all at once; otherwise the
+    // cursor is at least hidden while it is drawn
+    if (m_synchronized) {
+        m_output.insert(0, SYNC_BEGIN);
+        m_output += SYNC_END;
+    } else if (m_cursor_visible) {
+        m_output.insert(0, "\x1b[?25l");
+        m_output += "\x1b[?25h";
+    }
+    writeAll(m_output);
+    m_output.clear();
+}
+
+bool AnsiTerminal::scrollRegion(int top, int bottom, int lines) {
+    TerminalSize size = getSize();
+    int height = bottom - top + 1;
+    if (!m_initialized || top < 0 || bottom >= size.rows || top > bottom ||
+        lines == 0 || lines >= height || -lines >= height) {
+        return false;
+    }
+
+    // Rows scrolled in are blanked with the current background, so the
+    // colors are reset first. Index at the bottom margin scrolls up and
+    // reverse index at the top scrolls down; unlike SU/SD, every VT100
+    // has them.
+    setSgr(-1, -1);
+    m_output += "\x1b[";
+    appendNumber(m_output, top + 1);
+    m_output += ';';
+    appendNumber(m_output, bottom + 1);
+    m_output += 'r';
+    m_output_cursor = Position(-1, -1);
+    if (lines > 0) {
+        moveTo(Position(bottom, 0));
+        for (int i = 0; i < lines; ++i) {
+            m_output += "\x1b" "D";
+        }
+    } else {
+        moveTo(Position(top, 0));
+        for (int i = 0; i < -lines; ++i) {
+            m_output += "\x1b" "M";
+        }
+    }
+    m_output += "\x1b[r";       // Also homes the cursor
+    m_output_cursor = Position(0, 0);
+    return true;
+}
+
+void AnsiTerminal::setCursor(const Position& pos) {
+    m_cursor = pos;
+}
+
+Position AnsiTerminal::getCursor() const {
+    return m_cursor;
+}
+
+void AnsiTerminal::showCursor(bool visible) {
+    if (!m_initialized || visible == m_cursor_visible) return;
+    m_cursor_visible = visible;
+    m_output += visible ? "\x1b[?25h" : "\x1b[?25l";
+}
+
+void AnsiTerminal::moveTo(const Position& pos) {
+    if (pos == m_output_cursor) {
+        return;
+    }
+    m_output += "\x1b[";
+    appendNumber(m_output, pos.row + 1);
+    m_output += ';';
+    appendNumber(m_output, pos.col + 1);
+    m_output += 'H';
+    m_output_cursor = pos;
+}
+
+void AnsiTerminal::setSgr(int fg, int bg) {
+    if (fg == m_fg && bg == m_bg) {
+        return;
+    }
+    m_output += "\x1b[0";
+    if (fg >= 0) {
+        m_output += ';';
+        appendNumber(m_output, sgrColor(fg, false));
+    }
+    if (bg >= 0) {
+        m_output += ';';
+        appendNumber(m_output, sgrColor(bg, true));
+    }
+    m_output += 'm';
+    m_fg = fg;
+    m_bg = bg;
+}
+
+void AnsiTerminal::putChar(const std::string& utf8_char, const Position& pos) {
+    putString(utf8_char, pos);
+}
+
+void AnsiTerminal::putString(const std::string& utf8_str, const Position& pos) {
+    putText(utf8_str, pos, -1, -1);
+}
+
+void AnsiTerminal::putStringWithColor(const std::string& utf8_str, const Position& pos,
+                                      Color::Value fg, Color::Value bg) {
+    putText(utf8_str, pos, fg, bg);
+}
+
+void AnsiTerminal::putText(const std::string& text, const Position& pos, int fg, int bg) {
+    if (!m_initialized || text.empty()) return;
+
+    moveTo(pos);
+    setSgr(fg, bg);
+    m_output += text;
+
+    // Where the text leaves the cursor, so the next run can follow on
+    // without moving it; the last column leaves it in doubt
+    int col = pos.col;
+    for (size_t i = 0; i < text.size(); ) {
+        size_t length = utf8::charByteLength(text, i);
+        col += utf8::charWidth(text, i);
+        i += length > 0 ? length : 1;
+    }
+    m_output_cursor = col < getSize().cols ? Position(pos.row, col) : Position(-1, -1);
+}
+
+bool AnsiTerminal::writeAll(const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(STDOUT_FILENO, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            m_last_error = std::string("Write to terminal failed: ") + strerror(errno);
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool AnsiTerminal::readInput(int timeout_ms) {
+    struct pollfd pfd;
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return false;   // Timed out, or interrupted by a resize
+    }
+
+    char bytes[256];
+    ssize_t n = read(STDIN_FILENO, bytes, sizeof(bytes));
+    if (n <= 0) {
+        return false;
+    }
+    m_input.append(bytes, static_cast<size_t>(n));
+    return true;
+}
+
+KeyPress AnsiTerminal::getKey() {
+    if (!m_initialized) return KeyPress(UNKNOWN);
+
+    // A resize interrupts the wait and comes back as an unknown key, so
+    // the editor draws the new size
+    if (m_input.empty() && !readInput(-1)) {
+        return KeyPress(UNKNOWN);
+    }
+
+    unsigned char ch = static_cast<unsigned char>(m_input[0]);
+    if (ch == 27) {
+        return readEscape();
+    }
+
+    // Handle control characters
+    if (ch < 32 || ch == 127) {
+        m_input.erase(0, 1);
+        if (ch == 8 || ch == 127) return KeyPress(BACKSPACE);
+        if (ch == 9) return KeyPress(TAB);
+        if (ch == 10 || ch == 13) return KeyPress(ENTER);
+
+        // Ctrl+A through Ctrl+Z
+        if (ch >= 1 && ch <= 26) {
+            return KeyPress(static_cast<Key>(static_cast<int>(CTRL_A) + ch - 1));
+        }
+        return KeyPress(UNKNOWN);
+    }
+
+    // A UTF-8 character may arrive a byte at a time
+    size_t length = utf8::charByteLength(m_input, 0);
+    if (length == 0) {
+        length = 1;
+    }
+    while (m_input.size() < length && readInput(ESCAPE_DELAY_MS)) {
+    }
+    length = std::min(length, m_input.size());
+    std::string utf8_char = m_input.substr(0, length);
+    m_input.erase(0, length);
+    return KeyPress(utf8_char);
+}
+
+KeyPress AnsiTerminal::readEscape() {
+    // ESC alone is the Escape key; ESC [ and ESC O start the sequences
+    // that cursor and function keys send
+    if (m_input.size() < 2) {
+        readInput(ESCAPE_DELAY_MS);
+    }
+    if (m_input.size() < 2 || (m_input[1] != '[' && m_input[1] != 'O')) {
+        m_input.erase(0, 1);
+        return KeyPress(ESCAPE);
+    }
+
+    // Parameters and intermediates, then the final byte
+    size_t end = 2;
+    for (;;) {
+        while (end < m_input.size() && static_cast<unsigned char>(m_input[end]) >= 0x20 &&
+               static_cast<unsigned char>(m_input[end]) < 0x40 && m_input[1] == '[') {
+            ++end;
+        }
+        if (end < m_input.size() || !readInput(ESCAPE_DELAY_MS)) {
+            break;
+        }
+    }
+    if (end >= m_input.size()) {
+        m_input.erase(0, 1);
+        return KeyPress(ESCAPE);
+    }
+
+    char final = m_input[end];
+    int number = atoi(m_input.substr(2, end - 2).c_str());
+    m_input.erase(0, end + 1);
+    switch (final) {
+        case 'A': return KeyPress(ARROW_UP);
+        case 'B': return KeyPress(ARROW_DOWN);
+        case 'C': return KeyPress(ARROW_RIGHT);
+        case 'D': return KeyPress(ARROW_LEFT);
+        case 'H': return KeyPress(HOME);
+        case 'F': return KeyPress(END);
+        case 'P': return KeyPress(F1);
+        case 'Q': return KeyPress(F2);
+        case 'R': return KeyPress(F3);
+        case 'S': return KeyPress(F4);
+        case '~':
+            switch (number) {
+                case 1: case 7: return KeyPress(HOME);
+                case 4: case 8: return KeyPress(END);
+                case 3: return KeyPress(DELETE);
+                case 5: return KeyPress(PAGE_UP);
+                case 6: return KeyPress(PAGE_DOWN);
+                case 11: return KeyPress(F1);
+                case 12: return KeyPress(F2);
+                case 13: return KeyPress(F3);
+                case 14: return KeyPress(F4);
+                case 15: return KeyPress(F5);
+                case 17: return KeyPress(F6);
+                case 18: return KeyPress(F7);
+                case 19: return KeyPress(F8);
+                case 20: return KeyPress(F9);
+                case 21: return KeyPress(F10);
+                case 23: return KeyPress(F11);
+                case 24: return KeyPress(F12);
+                default: return KeyPress(UNKNOWN);
+            }
+        default: return KeyPress(UNKNOWN);
+    }
+}
+
+bool AnsiTerminal::hasInput() {
+    if (!m_initialized) return false;
+    return !m_input.empty() || readInput(0);
+}
+
+void AnsiTerminal::setColors(Color::Value fg, Color::Value bg) {
+    if (!m_initialized) return;
+    setSgr(fg, bg);
+}
+
+void AnsiTerminal::resetAttributes() {
+    if (!m_initialized) return;
+    setSgr(-1, -1);
+}
+
+void AnsiTerminal::enableRawMode() {
+    if (!m_initialized) return;
+
+    // As ncurses raw(): Ctrl-C, Ctrl-Z, Ctrl-S and Ctrl-Q arrive as keys
+    struct termios settings;
+    if (tcgetattr(STDIN_FILENO, &settings) == 0) {
+        settings.c_lflag &= ~ISIG;
+        settings.c_iflag &= ~(IXON | ICRNL | BRKINT);
+        tcsetattr(STDIN_FILENO, TCSANOW, &settings);
+    }
+    m_raw_mode = true;
+}
+
+void AnsiTerminal::disableRawMode() {
+    if (!m_initialized) return;
+
+    struct termios settings;
+    if (tcgetattr(STDIN_FILENO, &settings) == 0) {
+        settings.c_lflag |= (m_saved_termios.c_lflag & ISIG);
+        settings.c_iflag |= (m_saved_termios.c_iflag & (IXON | ICRNL | BRKINT));
+        tcsetattr(STDIN_FILENO, TCSANOW, &settings);
+    }
+    m_raw_mode = false;
+}
+
+bool AnsiTerminal::isRawMode() const {
+    return m_raw_mode;
+}
+
+std::string AnsiTerminal::getLastError() const {
+    return m_last_error;
+}
+
+} // namespace subzero
+
+#endif // LINUX_PLATFORM
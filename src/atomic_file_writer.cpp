@@ -0,0 +1,338 @@
+#include "atomic_file_writer.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#if defined(LINUX_PLATFORM) || defined(MACOS_PLATFORM)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#define SUBZERO_POSIX_FILES
+#elif defined(WINDOWS_PLATFORM)
+#include <windows.h>
+#endif
+
+namespace subzero {
+
+namespace {
+
+std::string directoryOf(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+std::string baseNameOf(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+} // anonymous namespace
+
+#ifdef SUBZERO_POSIX_FILES
+
+// Buffers per writev() call; IOV_MAX is at least 16 and usually 1024
+#ifdef IOV_MAX
+static const size_t MAX_BATCH = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+static const size_t MAX_BATCH = 16;
+#endif
+
+AtomicFileWriter::AtomicFileWriter()
+    : m_open(false)
+    , m_in_place(false)
+    , m_fd(-1)
+    , m_mode(-1)
+    , m_written(0)
+{
+}
+
+bool AtomicFileWriter::replacesByRename() const {
+    return !m_in_place;
+}
+
+bool AtomicFileWriter::open(const std::string& filename) {
+    abort();
+    m_target = filename;
+
+    // Replace what a symlink points at rather than the link itself
+    struct stat info;
+    if (lstat(filename.c_str(), &info) == 0 && S_ISLNK(info.st_mode)) {
+        char resolved[PATH_MAX];
+        if (realpath(filename.c_str(), resolved)) {
+            m_target = resolved;
+        }
+    }
+
+    m_in_place = false;
+    m_written = 0;
+    m_mode = -1;
+    bool exists = stat(m_target.c_str(), &info) == 0;
+    if (exists) {
+        m_mode = info.st_mode & 07777;
+
+        // rename() needs only the directory to be writable; refuse a file
+        // that could not have been written directly
+        if (access(m_target.c_str(), W_OK) != 0) {
+            return fail("Cannot write " + m_target + ": " + strerror(errno));
+        }
+
+        // A new file would split the target from its other hard links
+        if (info.st_nlink > 1) {
+            return openInPlace();
+        }
+    }
+
+    // The temporary file must be on the same file system for rename()
+    std::string prefix = directoryOf(m_target) + "." + baseNameOf(m_target) + ".";
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        m_temp = prefix + compat::to_string(getpid()) + "-" + compat::to_string(attempt) + ".tmp";
+        m_fd = ::open(m_temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (m_fd >= 0 || errno != EEXIST) {
+            break;
+        }
+    }
+    if (m_fd < 0) {
+        // Without a temporary file, e.g. in a directory we cannot write,
+        // the target itself is overwritten
+        return openInPlace();
+    }
+
+    // Give the new file the old one's owner and group. Only root may give
+    // a file away, so others write the target itself rather than take
+    // over a file they do not own.
+    struct stat temp_info;
+    if (exists && fstat(m_fd, &temp_info) == 0 &&
+        (temp_info.st_uid != info.st_uid || temp_info.st_gid != info.st_gid) &&
+        fchown(m_fd, info.st_uid, info.st_gid) != 0) {
+        ::close(m_fd);
+        m_fd = -1;
+        unlink(m_temp.c_str());
+        return openInPlace();
+    }
+
+    m_open = true;
+    return true;
+}
+
+bool AtomicFileWriter::openInPlace() {
+    // Not truncated until commit(), so the old contents stay readable
+    // until the first write
+    m_temp.clear();
+    m_in_place = true;
+    m_fd = ::open(m_target.c_str(), O_WRONLY | O_CREAT, 0666);
+    if (m_fd < 0) {
+        return fail("Cannot write " + m_target + ": " + strerror(errno));
+    }
+
+    m_open = true;
+    return true;
+}
+
+bool AtomicFileWriter::write(const char* data, size_t length) {
+    if (!m_open) {
+        return false;
+    }
+    if (length == 0) {
+        return true;
+    }
+
+    m_batch_data.push_back(data);
+    m_batch_length.push_back(length);
+    return m_batch_data.size() < MAX_BATCH || flush();
+}
+
+bool AtomicFileWriter::flush() {
+    struct iovec vectors[MAX_BATCH];
+    size_t count = m_batch_data.size();
+    for (size_t i = 0; i < count; ++i) {
+        vectors[i].iov_base = const_cast<char*>(m_batch_data[i]);
+        vectors[i].iov_len = m_batch_length[i];
+    }
+    m_batch_data.clear();
+    m_batch_length.clear();
+
+    // writev may stop early; resume from the first unfinished buffer
+    struct iovec* next = vectors;
+    while (count > 0) {
+        ssize_t written = writev(m_fd, next, static_cast<int>(count));
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return fail(std::string("Write failed: ") + strerror(errno));
+        }
+
+        m_written += static_cast<uint64_t>(written);
+        size_t remaining = static_cast<size_t>(written);
+        while (count > 0 && remaining >= next->iov_len) {
+            remaining -= next->iov_len;
+            ++next;
+            --count;
+        }
+        if (count > 0) {
+            next->iov_base = static_cast<char*>(next->iov_base) + remaining;
+            next->iov_len -= remaining;
+        }
+    }
+    return true;
+}
+
+bool AtomicFileWriter::commit() {
+    if (!m_open || !flush()) {
+        return false;
+    }
+
+    if (m_in_place) {
+        // Drop what is left of a longer old file
+        if (ftruncate(m_fd, static_cast<off_t>(m_written)) != 0) {
+            return fail(std::string("Write failed: ") + strerror(errno));
+        }
+    } else if (m_mode >= 0) {
+        fchmod(m_fd, static_cast<mode_t>(m_mode));
+    }
+    if (fsync(m_fd) != 0) {
+        return fail(std::string("Sync failed: ") + strerror(errno));
+    }
+    if (::close(m_fd) != 0) {
+        m_fd = -1;
+        return fail(std::string("Close failed: ") + strerror(errno));
+    }
+    m_fd = -1;
+    if (m_in_place) {
+        m_open = false;
+        return true;
+    }
+
+    if (rename(m_temp.c_str(), m_target.c_str()) != 0) {
+        return fail(std::string("Cannot replace ") + m_target + ": " + strerror(errno));
+    }
+    m_open = false;
+
+    // Make the rename itself durable
+    std::string directory = directoryOf(m_target);
+    int dir_fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+    return true;
+}
+
+void AtomicFileWriter::abort() {
+    m_batch_data.clear();
+    m_batch_length.clear();
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if (m_open && !m_in_place) {
+        unlink(m_temp.c_str());
+    }
+    m_open = false;
+}
+
+#else
+
+// Portable version: stdio into the temporary file, then rename
+AtomicFileWriter::AtomicFileWriter()
+    : m_open(false)
+    , m_in_place(false)
+    , m_file(NULL)
+{
+}
+
+bool AtomicFileWriter::replacesByRename() const {
+    // Windows refuses to replace a file that is still mapped
+    return false;
+}
+
+bool AtomicFileWriter::open(const std::string& filename) {
+    abort();
+    m_target = filename;
+    m_temp = directoryOf(filename) + baseNameOf(filename) + ".tmp";
+    m_in_place = false;
+
+    // Without a temporary file the target itself is overwritten. It is
+    // only opened, and so truncated, on the first write.
+    m_file = fopen(m_temp.c_str(), "wb");
+    if (!m_file) {
+        m_temp.clear();
+        m_in_place = true;
+    }
+
+    m_open = true;
+    return true;
+}
+
+bool AtomicFileWriter::openTarget() {
+    m_file = fopen(m_target.c_str(), "wb");
+    if (!m_file) {
+        return fail("Cannot write " + m_target);
+    }
+    return true;
+}
+
+bool AtomicFileWriter::write(const char* data, size_t length) {
+    if (!m_open || (!m_file && !openTarget())) {
+        return false;
+    }
+    if (fwrite(data, 1, length, static_cast<FILE*>(m_file)) != length) {
+        return fail("Write failed");
+    }
+    return true;
+}
+
+bool AtomicFileWriter::commit() {
+    if (!m_open || (!m_file && !openTarget())) {
+        return false;
+    }
+
+    FILE* file = static_cast<FILE*>(m_file);
+    m_file = NULL;
+    if (fflush(file) != 0 || fclose(file) != 0) {
+        return fail("Write failed");
+    }
+    if (m_in_place) {
+        m_open = false;
+        return true;
+    }
+
+#ifdef WINDOWS_PLATFORM
+    if (!MoveFileExA(m_temp.c_str(), m_target.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        return fail("Cannot replace " + m_target);
+    }
+#else
+    if (rename(m_temp.c_str(), m_target.c_str()) != 0) {
+        return fail("Cannot replace " + m_target);
+    }
+#endif
+    m_open = false;
+    return true;
+}
+
+void AtomicFileWriter::abort() {
+    if (m_file) {
+        fclose(static_cast<FILE*>(m_file));
+        m_file = NULL;
+    }
+    if (m_open && !m_in_place) {
+        remove(m_temp.c_str());
+    }
+    m_open = false;
+}
+
+#endif
+
+AtomicFileWriter::~AtomicFileWriter() {
+    abort();
+}
+
+bool AtomicFileWriter::fail(const std::string& message) {
+    m_last_error = message;
+    abort();
+    return false;
+}
+
+} // namespace subzero
@@ -1,102 +1,280 @@
 #include "buffer.h"
 #include <fstream>
 #include <algorithm>
+#include <iterator>
 
 namespace subzero {
 
 Buffer::Buffer() 
-    : m_modified(false)
+    : m_scan_offset(0)
+    , m_scan_end(0)
+    , m_fully_indexed(true)
+    , m_eol("\n")
+    , m_modified(false)
     , m_readonly(false)
+    , m_saved_in_place(false)
     , m_cursor(0, 0)
     , m_undo_index(0)
+    , m_undo_bytes(0)
+    , m_undo_budget(DEFAULT_UNDO_BUDGET)
+    , m_saved_index(0)
+    , m_group_depth(0)
+    , m_group_open(false)
+    , m_replaying(false)
+    , m_undo_base(0)
+    , m_undo_disk_count(0)
+    , m_undo_disk_length(std::string::npos)
+    , m_undo_loaded_hash(0)
+    , m_undo_verified(true)
+    , m_undo_unload_hint(0)
+    , m_undo_file_enabled(true)
+    , m_version(0)
 {
-    m_lines.push_back(""); // Always have at least one line
+    m_line_index.append(LineInfo()); // Always have at least one line
 }
 
 Buffer::Buffer(const std::string& filename) 
-    : m_modified(false)
+    : m_scan_offset(0)
+    , m_scan_end(0)
+    , m_fully_indexed(true)
+    , m_eol("\n")
+    , m_modified(false)
     , m_readonly(false)
+    , m_saved_in_place(false)
     , m_cursor(0, 0)
     , m_undo_index(0)
+    , m_undo_bytes(0)
+    , m_undo_budget(DEFAULT_UNDO_BUDGET)
+    , m_saved_index(0)
+    , m_group_depth(0)
+    , m_group_open(false)
+    , m_replaying(false)
+    , m_undo_base(0)
+    , m_undo_disk_count(0)
+    , m_undo_disk_length(std::string::npos)
+    , m_undo_loaded_hash(0)
+    , m_undo_verified(true)
+    , m_undo_unload_hint(0)
+    , m_undo_file_enabled(true)
+    , m_version(0)
 {
-    m_lines.push_back(""); // Always have at least one line
+    m_line_index.append(LineInfo()); // Always have at least one line
     loadFromFile(filename);
 }
 
-bool Buffer::loadFromFile(const std::string& filename) {
-    std::ifstream file(filename.c_str(), std::ios::binary);
-    if (!file.is_open()) {
+bool Buffer::loadFromFile(const std::string& filename, bool read_only) {
+    // Map the file instead of reading it; pages are only touched as lines
+    // are scanned or displayed
+    shared_ptr<MappedFile> file(new MappedFile());
+    if (!file->open(filename)) {
+        return false;
+    }
+    if (file->size() > LineInfo::MAX_LENGTH) {
+        m_last_error = "File too large";
         return false;
     }
     
     m_filename = filename;
-    return loadFromStream(file);
+    m_cursor = BufferPosition(0, 0);
+    m_modified = false;
+    m_readonly = read_only;
+    resetUndoHistory();
+    
+    m_text.reset(file);
+    beginIndexing();
+    if (!m_readonly && m_undo_file_enabled) {
+        loadUndoFile();
+    }
+    
+    return true;
 }
 
 bool Buffer::loadFromStream(std::istream& stream) {
-    m_lines.clear();
     m_cursor = BufferPosition(0, 0);
     m_modified = false;
-    m_undo_stack.clear();
-    m_undo_index = 0;
+    m_readonly = false;
+    resetUndoHistory();
+    
+    // Read the whole stream in one block; the piece table adopts this string
+    // as its original text, so lines are never split into separate copies
+    std::string content;
+    std::streampos start = stream.tellg();
+    stream.seekg(0, std::ios::end);
+    std::streampos end = stream.tellg();
     
-    std::string line;
-    while (std::getline(stream, line)) {
-        // Remove Windows line endings if present
-        if (!line.empty() && line[line.length() - 1] == '\r') {
-            line.erase(line.length() - 1);
+    if (start != std::streampos(-1) && end != std::streampos(-1) && end >= start) {
+        stream.seekg(start);
+        content.resize(static_cast<size_t>(end - start));
+        if (!content.empty()) {
+            stream.read(&content[0], content.size());
+            content.resize(static_cast<size_t>(stream.gcount()));
         }
-        m_lines.push_back(line);
+    } else {
+        // Stream is not seekable - fall back to reading until EOF
+        stream.clear();
+        content.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
     }
     
-    // Ensure we have at least one line
-    if (m_lines.empty()) {
-        m_lines.push_back("");
-    }
+    m_text.reset(content);
+    beginIndexing();
     
     return true;
 }
 
 bool Buffer::saveToFile(const std::string& filename) {
     std::string target_file = filename.empty() ? m_filename : filename;
+    if (m_readonly) {
+        m_last_error = "File is read-only";
+        return false;
+    }
     if (target_file.empty()) {
+        m_last_error = "No file name";
         return false;
     }
     
-    std::ofstream file(target_file.c_str(), std::ios::binary);
-    if (!file.is_open()) {
+    // If another program truncated or rewrote the mapped file, the text
+    // that was loaded is gone; saving would write a mix of old and new, or
+    // fault on the missing pages
+    if (m_text.mappingChanged()) {
+        m_last_error = "File was changed on disk since it was opened";
         return false;
     }
     
-    for (size_t i = 0; i < m_lines.size(); ++i) {
-        file << m_lines[i];
-        if (i < m_lines.size() - 1) {
-            file << '\n';
+    AtomicFileWriter writer;
+    if (!writer.open(target_file)) {
+        m_last_error = writer.getLastError();
+        return false;
+    }
+    
+    // Where the file is overwritten in place, or cannot be replaced while
+    // it is mapped, copy the text out of the mapping first; the scanner has
+    // to let go of it too
+    if (m_text.isMapped() && !writer.replacesByRename()) {
+        bool scanning = m_scanner.isActive();
+        m_scanner.stop();
+        m_text.detach();
+        if (scanning) {
+            m_scanner.start(m_text.getOriginalData(), m_scan_offset, m_scan_end);
         }
     }
     
+    BufferSnapshot snapshot = getSnapshot();
+    uint64_t hash = 0;
+    if (!writeSnapshot(snapshot, writer, hash, m_last_error)) {
+        return false;
+    }
+    m_saved_in_place = writer.isInPlace();
+    
     if (!filename.empty()) {
         m_filename = filename;
     }
     m_modified = false;
+    m_saved_index = m_undo_index;
+    m_group_open = false;   // Later edits must not join the saved group
+    if (m_undo_file_enabled) {
+        saveUndoFile(snapshot.size(), hash);
+    }
+    return true;
+}
+
+BufferSnapshot Buffer::getSnapshot() const {
+    BufferSnapshot snapshot;
+    snapshot.text = m_text.snapshot();
+    snapshot.final_eol = m_final_eol;
+    snapshot.filename = m_filename;
+    return snapshot;
+}
+
+bool Buffer::writeSnapshot(const BufferSnapshot& snapshot, AtomicFileWriter& writer, uint64_t& hash,
+                           std::string& error) {
+    // Line endings are part of the stored text, so the pieces are written
+    // back directly, without copying, followed by the final line ending
+    ContentHash content_hash;
+    bool written = true;
+    for (size_t i = 0; written && i < snapshot.text.getPieceCount(); ++i) {
+        const char* data;
+        size_t length;
+        snapshot.text.getPieceData(i, data, length);
+        content_hash.update(data, length);
+        written = writer.write(data, length);
+    }
+    content_hash.update(snapshot.final_eol.data(), snapshot.final_eol.size());
+    written = written && writer.write(snapshot.final_eol.data(), snapshot.final_eol.size()) && writer.commit();
+    
+    if (!written) {
+        error = writer.getLastError();
+        return false;
+    }
+    hash = content_hash.value();
     return true;
 }
 
-const std::string& Buffer::getLine(size_t line_num) const {
-    static const std::string empty_line;
-    if (line_num >= m_lines.size()) {
-        return empty_line;
+std::string Buffer::getLine(size_t line_num) const {
+    if (line_num >= getLineCount()) {
+        return "";
+    }
+    
+    const char* data;
+    size_t length;
+    if (getLineView(line_num, data, length)) {
+        return std::string(data, length);
+    }
+    
+    size_t offset, eol_length;
+    getLineExtent(line_num, offset, length, eol_length);
+    return m_text.read(offset, length);
+}
+
+bool Buffer::getLineView(size_t line_num, const char*& data, size_t& length) const {
+    // Unmodified lines point straight into the original (mapped) text
+    if (line_num >= getLineCount()) {
+        return false;
+    }
+    
+    size_t offset, eol_length;
+    getLineExtent(line_num, offset, length, eol_length);
+    return m_text.getSpan(offset, length, data);
+}
+
+int Buffer::getIndexingProgress() const {
+    if (m_fully_indexed || m_scan_end == 0) {
+        return 100;
+    }
+    return static_cast<int>((static_cast<double>(m_scan_offset) * 100.0) / m_scan_end);
+}
+
+bool Buffer::pollIndexing(int wait_ms) {
+    return indexMore(wait_ms);
+}
+
+void Buffer::ensureLineIndexed(size_t line_num) {
+    while (!m_fully_indexed && m_line_index.getLineCount() <= line_num) {
+        indexMore(-1);
+    }
+}
+
+void Buffer::ensureOffsetIndexed(size_t byte_offset) {
+    while (!m_fully_indexed && m_line_index.getTotalBytes() <= byte_offset) {
+        indexMore(-1);
+    }
+}
+
+void Buffer::ensureFullyIndexed() {
+    while (!m_fully_indexed) {
+        indexMore(-1);
     }
-    return m_lines[line_num];
 }
 
 std::string Buffer::getLineSubstring(size_t line_num, size_t start_col, size_t length) const {
-    if (line_num >= m_lines.size()) {
+    if (line_num >= getLineCount()) {
         return "";
     }
     
-    const std::string& line = m_lines[line_num];
-    return utf8::substr(line, start_col, length);
+    size_t offset = getLineOffset(line_num);
+    size_t start = columnToByte(line_num, start_col);
+    size_t end = (length == std::string::npos) ? m_line_index.getLine(line_num).bytes()
+                                               : columnToByte(line_num, start_col + length);
+    return m_text.read(offset + start, end - start);
 }
 
 void Buffer::setCursor(const BufferPosition& pos) {
@@ -108,7 +286,11 @@ void Buffer::moveCursor(int delta_line, int delta_col) {
     int new_line = static_cast<int>(m_cursor.line) + delta_line;
     int new_col = static_cast<int>(m_cursor.column) + delta_col;
     
-    new_line = std::max(0, std::min(new_line, static_cast<int>(m_lines.size()) - 1));
+    if (new_line > 0) {
+        ensureLineIndexed(static_cast<size_t>(new_line) + 1);
+    }
+    
+    new_line = std::max(0, std::min(new_line, static_cast<int>(getLineCount()) - 1));
     new_col = std::max(0, new_col);
     
     m_cursor.line = static_cast<size_t>(new_line);
@@ -117,12 +299,44 @@ void Buffer::moveCursor(int delta_line, int delta_col) {
 }
 
 bool Buffer::isValidPosition(const BufferPosition& pos) const {
-    if (pos.line >= m_lines.size()) {
+    if (pos.line >= getLineCount()) {
         return false;
     }
     
-    size_t line_length = utf8::length(m_lines[pos.line]);
-    return pos.column <= line_length;
+    return pos.column <= getLineLength(pos.line);
+}
+
+size_t Buffer::getByteOffset(const BufferPosition& pos) const {
+    if (pos.line >= getLineCount()) {
+        return m_line_index.getTotalBytes();
+    }
+    
+    return getLineOffset(pos.line) + columnToByte(pos.line, pos.column);
+}
+
+size_t Buffer::getCharOffset(const BufferPosition& pos) const {
+    if (pos.line >= getLineCount()) {
+        return getCharCount();
+    }
+    
+    return m_line_index.getLineCharOffset(pos.line) + std::min(pos.column, getLineLength(pos.line));
+}
+
+BufferPosition Buffer::getPositionAtByte(size_t byte_offset) const {
+    size_t line = m_line_index.findLineByOffset(byte_offset);
+    size_t offset, length, eol_length;
+    getLineExtent(line, offset, length, eol_length);
+    
+    // Offsets inside a line ending map to the end of the line
+    size_t byte_in_line = std::min(byte_offset - std::min(byte_offset, offset), length);
+    return BufferPosition(line, byteToColumn(line, byte_in_line));
+}
+
+BufferPosition Buffer::getPositionAtChar(size_t char_offset) const {
+    size_t line = m_line_index.findLineByCharOffset(char_offset);
+    size_t line_start = m_line_index.getLineCharOffset(line);
+    size_t column = char_offset > line_start ? char_offset - line_start : 0;
+    return BufferPosition(line, std::min(column, getLineLength(line)));
 }
 
 void Buffer::insertChar(char32_t unicode_char) {
@@ -156,32 +370,34 @@ void Buffer::insertChar(char32_t unicode_char) {
 void Buffer::insertString(const std::string& utf8_str) {
     if (m_readonly || utf8_str.empty()) return;
     
-    std::string& current_line = m_lines[m_cursor.line];
-    size_t byte_pos = utf8::charToByte(current_line, m_cursor.column);
-    
-    current_line.insert(byte_pos, utf8_str);
-    m_cursor.column += utf8::length(utf8_str);
+    size_t byte_pos = columnToByte(m_cursor.line, m_cursor.column);
+    replaceText(getLineOffset(m_cursor.line) + byte_pos, 0, utf8_str);
     
-    setModified();
+    // Inserted text may contain line breaks of its own
+    size_t last_break = utf8_str.rfind('\n');
+    if (last_break == std::string::npos) {
+        m_cursor.column += utf8::length(utf8_str);
+    } else {
+        m_cursor.line += std::count(utf8_str.begin(), utf8_str.end(), '\n');
+        m_cursor.column = utf8::length(utf8_str.substr(last_break + 1));
+    }
 }
 
 void Buffer::deleteChar() {
     if (m_readonly) return;
     
-    std::string& current_line = m_lines[m_cursor.line];
-    size_t line_length = utf8::length(current_line);
+    ensureLineIndexed(m_cursor.line + 1);
+    size_t offset, length, eol_length;
+    getLineExtent(m_cursor.line, offset, length, eol_length);
     
-    if (m_cursor.column < line_length) {
+    if (m_cursor.column < getLineLength(m_cursor.line)) {
         // Delete character at cursor
-        size_t byte_pos = utf8::charToByte(current_line, m_cursor.column);
-        size_t char_bytes = utf8::charByteLength(current_line, byte_pos);
-        current_line.erase(byte_pos, char_bytes);
-        setModified();
-    } else if (m_cursor.line < m_lines.size() - 1) {
-        // Join with next line
-        current_line += m_lines[m_cursor.line + 1];
-        m_lines.erase(m_lines.begin() + m_cursor.line + 1);
-        setModified();
+        size_t byte_pos = columnToByte(m_cursor.line, m_cursor.column);
+        size_t char_end = columnToByte(m_cursor.line, m_cursor.column + 1);
+        replaceText(offset + byte_pos, char_end - byte_pos, "");
+    } else if (m_cursor.line < getLineCount() - 1) {
+        // Join with next line by removing the line break
+        replaceText(offset + length, eol_length, "");
     }
 }
 
@@ -194,87 +410,91 @@ void Buffer::deleteCharBefore() {
         deleteChar();
     } else if (m_cursor.line > 0) {
         // Join with previous line
-        size_t prev_line_length = utf8::length(m_lines[m_cursor.line - 1]);
-        m_lines[m_cursor.line - 1] += m_lines[m_cursor.line];
-        m_lines.erase(m_lines.begin() + m_cursor.line);
+        size_t offset, length, eol_length;
+        getLineExtent(m_cursor.line - 1, offset, length, eol_length);
+        size_t prev_line_length = getLineLength(m_cursor.line - 1);
+        replaceText(offset + length, eol_length, "");
         m_cursor.line--;
         m_cursor.column = prev_line_length;
-        setModified();
     }
 }
 
 void Buffer::deleteLine() {
     if (m_readonly) return;
     
-    if (m_lines.size() > 1) {
-        m_lines.erase(m_lines.begin() + m_cursor.line);
-        if (m_cursor.line >= m_lines.size()) {
-            m_cursor.line = m_lines.size() - 1;
+    ensureLineIndexed(m_cursor.line + 1);
+    size_t line_count = getLineCount();
+    size_t offset, length, eol_length;
+    getLineExtent(m_cursor.line, offset, length, eol_length);
+    
+    if (line_count > 1) {
+        if (m_cursor.line < line_count - 1) {
+            replaceText(offset, length + eol_length, "");
+        } else {
+            // Last line: remove the preceding line break instead, so a
+            // trailing newline at the end of the file is kept
+            size_t prev_offset, prev_length, prev_eol_length;
+            getLineExtent(m_cursor.line - 1, prev_offset, prev_length, prev_eol_length);
+            replaceText(prev_offset + prev_length, prev_eol_length + length, "");
+        }
+        if (m_cursor.line >= getLineCount()) {
+            m_cursor.line = getLineCount() - 1;
         }
     } else {
-        m_lines[0].clear();
+        replaceText(offset, length, "");
     }
     
     m_cursor.column = 0;
-    setModified();
 }
 
 void Buffer::insertLine() {
     if (m_readonly) return;
     
-    m_lines.insert(m_lines.begin() + m_cursor.line, "");
+    replaceText(getLineOffset(m_cursor.line), 0, m_eol);
     m_cursor.column = 0;
-    setModified();
 }
 
 void Buffer::insertLineAfter() {
     if (m_readonly) return;
     
-    m_lines.insert(m_lines.begin() + m_cursor.line + 1, "");
+    size_t offset, length, eol_length;
+    getLineExtent(m_cursor.line, offset, length, eol_length);
+    replaceText(offset + length, 0, m_eol);
     m_cursor.line++;
     m_cursor.column = 0;
-    setModified();
 }
 
 void Buffer::joinLines() {
-    if (m_readonly || m_cursor.line >= m_lines.size() - 1) return;
+    ensureLineIndexed(m_cursor.line + 1);
+    if (m_readonly || m_cursor.line >= getLineCount() - 1) return;
     
-    std::string& current_line = m_lines[m_cursor.line];
-    const std::string& next_line = m_lines[m_cursor.line + 1];
+    size_t offset, length, eol_length;
+    getLineExtent(m_cursor.line, offset, length, eol_length);
+    size_t next_offset, next_length, next_eol_length;
+    getLineExtent(m_cursor.line + 1, next_offset, next_length, next_eol_length);
     
     // Add space if both lines have content
-    if (!current_line.empty() && !next_line.empty()) {
-        current_line += " ";
-    }
-    current_line += next_line;
-    
-    m_lines.erase(m_lines.begin() + m_cursor.line + 1);
-    setModified();
+    std::string separator = (length > 0 && next_length > 0) ? " " : "";
+    replaceText(offset + length, eol_length, separator);
 }
 
 void Buffer::splitLine() {
     if (m_readonly) return;
     
-    std::string& current_line = m_lines[m_cursor.line];
-    size_t byte_pos = utf8::charToByte(current_line, m_cursor.column);
-    
-    std::string new_line = current_line.substr(byte_pos);
-    current_line = current_line.substr(0, byte_pos);
-    
-    m_lines.insert(m_lines.begin() + m_cursor.line + 1, new_line);
+    size_t byte_pos = columnToByte(m_cursor.line, m_cursor.column);
+    replaceText(getLineOffset(m_cursor.line) + byte_pos, 0, m_eol);
     m_cursor.line++;
     m_cursor.column = 0;
-    setModified();
 }
 
 BufferPosition Buffer::getNextWord() const {
     BufferPosition pos = m_cursor;
     
-    if (pos.line >= m_lines.size()) {
+    if (pos.line >= getLineCount()) {
         return pos;
     }
     
-    const std::string& line = m_lines[pos.line];
+    std::string line = getLine(pos.line);
     size_t line_length = utf8::length(line);
     
     // Skip current word
@@ -308,7 +528,7 @@ BufferPosition Buffer::getPreviousWord() const {
         pos.column--;
     } else if (pos.line > 0) {
         pos.line--;
-        pos.column = utf8::length(m_lines[pos.line]);
+        pos.column = getLineLength(pos.line);
     }
     
     return pos;
@@ -319,8 +539,7 @@ BufferPosition Buffer::getLineBegin() const {
 }
 
 BufferPosition Buffer::getLineEnd() const {
-    size_t line_length = utf8::length(m_lines[m_cursor.line]);
-    return BufferPosition(m_cursor.line, line_length);
+    return BufferPosition(m_cursor.line, getLineLength(m_cursor.line));
 }
 
 BufferPosition Buffer::getBufferBegin() const {
@@ -328,48 +547,364 @@ BufferPosition Buffer::getBufferBegin() const {
 }
 
 BufferPosition Buffer::getBufferEnd() const {
-    if (m_lines.empty()) {
-        return BufferPosition(0, 0);
-    }
-    
-    size_t last_line = m_lines.size() - 1;
-    size_t last_col = utf8::length(m_lines[last_line]);
+    size_t last_line = getLineCount() - 1;
+    size_t last_col = getLineLength(last_line);
     return BufferPosition(last_line, last_col);
 }
 
 void Buffer::clear() {
-    m_lines.clear();
-    m_lines.push_back("");
+    m_scanner.stop();
+    m_text.reset();
+    m_line_index.clear();
+    m_line_index.append(LineInfo());
+    m_checkpoints.clear();
+    m_file_stats = LineScanStats();
+    m_scan_offset = 0;
+    m_scan_end = 0;
+    m_fully_indexed = true;
+    m_eol = "\n";
+    m_final_eol.clear();
     m_cursor = BufferPosition(0, 0);
     m_filename.clear();
     m_modified = false;
-    m_undo_stack.clear();
-    m_undo_index = 0;
+    m_readonly = false;
+    resetUndoHistory();
+    m_undo_path.clear();
+    notifyReset();
 }
 
 void Buffer::ensureValidCursor() {
-    if (m_lines.empty()) {
-        m_cursor = BufferPosition(0, 0);
-        return;
-    }
+    ensureLineIndexed(m_cursor.line + 1);
     
     // Ensure line is valid
-    if (m_cursor.line >= m_lines.size()) {
-        m_cursor.line = m_lines.size() - 1;
+    if (m_cursor.line >= getLineCount()) {
+        m_cursor.line = getLineCount() - 1;
     }
     
     // Ensure column is valid
-    size_t line_length = utf8::length(m_lines[m_cursor.line]);
+    size_t line_length = getLineLength(m_cursor.line);
     if (m_cursor.column > line_length) {
         m_cursor.column = line_length;
     }
 }
 
 size_t Buffer::getLineLength(size_t line_num) const {
-    if (line_num >= m_lines.size()) {
+    if (line_num >= getLineCount()) {
         return 0;
     }
-    return utf8::length(m_lines[line_num]);
+    return m_line_index.getLine(line_num).chars();
+}
+
+void Buffer::getLineExtent(size_t line_num, size_t& offset, size_t& length, size_t& eol_length) const {
+    const LineInfo& info = m_line_index.getLine(line_num);
+    offset = m_line_index.getLineOffset(line_num);
+    length = info.bytes();
+    eol_length = info.eol;
+}
+
+void Buffer::beginIndexing() {
+    m_scanner.stop();
+    
+    // A line break at the very end terminates the last line rather than
+    // starting a new one; keep it out of the text and restore it on save
+    const char* data = m_text.getOriginalData();
+    size_t size = m_text.getOriginalSize();
+    m_final_eol.clear();
+    if (size > 0 && data[size - 1] == '\n') {
+        m_final_eol = (size > 1 && data[size - 2] == '\r') ? "\r\n" : "\n";
+        m_text.erase(size - m_final_eol.size(), m_final_eol.size());
+    }
+    
+    // A read-only file never changes, so its index can be sparse
+    if (m_readonly) {
+        m_line_index.clearSparse(data);
+    } else {
+        m_line_index.clear();
+    }
+    m_checkpoints.clear();
+    m_file_stats = LineScanStats();
+    m_scan_offset = 0;
+    m_scan_end = size - m_final_eol.size();
+    m_fully_indexed = false;
+    
+    // The first chunk covers the first screenful; the rest of the file is
+    // scanned by the background scanner
+    LineScanner::Chunk chunk;
+    LineScanner::scanChunk(data, 0, m_scan_end, LineScanner::CHUNK_SIZE, chunk);
+    m_line_index.append(chunk.lines);
+    m_file_stats.add(chunk.stats);
+    m_scan_offset = chunk.end;
+    m_fully_indexed = chunk.last;
+    if (!m_fully_indexed) {
+        m_scanner.start(data, m_scan_offset, m_scan_end);
+    }
+    
+    detectLineEnding();
+    notifyReset();
+}
+
+bool Buffer::indexMore(int wait_ms) {
+    // Chunks cover the untouched original text. Edits only ever happen
+    // inside indexed lines, so the unindexed tail of the document is still
+    // exactly the tail of the original.
+    LineScanner::Chunk chunk;
+    if (m_fully_indexed || !m_scanner.takeChunk(chunk, wait_ms)) {
+        return false;
+    }
+    
+    m_line_index.append(chunk.lines);
+    m_file_stats.add(chunk.stats);
+    m_scan_offset = chunk.end;
+    m_fully_indexed = chunk.last;
+    return true;
+}
+
+bool Buffer::compactMemory() {
+    if (!m_line_index.needsCompaction()) {
+        return false;
+    }
+    m_line_index.compact();
+    return true;
+}
+
+void Buffer::detectLineEnding() {
+    // New lines follow the convention used by most lines scanned so far
+    m_eol = (m_file_stats.crlf_lines > m_file_stats.lf_lines) ? "\r\n" : "\n";
+}
+
+void Buffer::replaceText(size_t offset, size_t erase_length, const std::string& text) {
+    if (m_readonly || (erase_length == 0 && text.empty())) {
+        return;
+    }
+    ensureOffsetIndexed(offset + erase_length);
+    erase_length = offset < m_text.size() ? std::min(erase_length, m_text.size() - offset) : 0;
+    
+    // An edit larger than the whole undo budget could not be kept anyway;
+    // the history is dropped before the erased bytes are ever read
+    bool record = !m_replaying;
+    if (record && erase_length + text.size() > m_undo_budget) {
+        forgetUndoHistory();
+        record = false;
+    }
+    
+    // Lines touched by the edit, including their line endings
+    size_t first_line = m_line_index.findLineByOffset(offset);
+    size_t last_line = m_line_index.findLineByOffset(offset + erase_length);
+    size_t region_start = m_line_index.getLineOffset(first_line);
+    
+    std::string erased;
+    if (record || first_line == last_line) {
+        erased = m_text.read(offset, erase_length);
+    }
+    if (record) {
+        recordEdit(offset, erased, text);
+    }
+    
+    if (first_line == last_line && replaceWithinLine(first_line, offset, erased, text)) {
+        updateCheckpoints(first_line, last_line, 1, offset - region_start);
+        setModified();
+        notifyChange(first_line, 1, 1, offset, erase_length, text.size());
+        return;
+    }
+    
+    size_t region_end = m_line_index.getLineOffset(last_line) + m_line_index.getLine(last_line).totalBytes();
+    bool reaches_end = m_fully_indexed && (last_line + 1 == m_line_index.getLineCount());
+    
+    m_text.erase(offset, erase_length);
+    m_text.insert(offset, text);
+    
+    // Re-scan only the touched lines and splice them into the index
+    std::string region = m_text.read(region_start, region_end - erase_length + text.size() - region_start);
+    std::vector<LineInfo> lines;
+    LineIndex::scanLines(region.data(), region.size(), reaches_end, lines);
+    m_line_index.replace(first_line, last_line - first_line + 1, lines);
+    updateCheckpoints(first_line, last_line, lines.size(), offset - region_start);
+    
+    setModified();
+    notifyChange(first_line, last_line - first_line + 1, lines.size(), offset, erase_length, text.size());
+}
+
+void Buffer::notifyChange(size_t first_line, size_t old_line_count, size_t new_line_count, size_t offset,
+                          size_t erased_bytes, size_t inserted_bytes) {
+    BufferChange change;
+    change.first_line = first_line;
+    change.old_line_count = old_line_count;
+    change.new_line_count = new_line_count;
+    change.byte_offset = offset;
+    change.erased_bytes = erased_bytes;
+    change.inserted_bytes = inserted_bytes;
+    change.version = ++m_version;
+    
+    for (size_t i = 0; i < m_observers.size(); ++i) {
+        m_observers[i]->bufferChanged(*this, change);
+    }
+}
+
+void Buffer::notifyReset() {
+    ++m_version;
+    for (size_t i = 0; i < m_observers.size(); ++i) {
+        m_observers[i]->bufferReset(*this);
+    }
+}
+
+void Buffer::addObserver(IBufferObserver* observer) {
+    if (std::find(m_observers.begin(), m_observers.end(), observer) == m_observers.end()) {
+        m_observers.push_back(observer);
+    }
+}
+
+void Buffer::removeObserver(IBufferObserver* observer) {
+    m_observers.erase(std::remove(m_observers.begin(), m_observers.end(), observer), m_observers.end());
+}
+
+bool Buffer::replaceWithinLine(size_t line_num, size_t offset, const std::string& erased, const std::string& text) {
+    // Edits that leave the line structure alone update the line's counts
+    // directly instead of re-scanning the whole line
+    LineInfo info = m_line_index.getLine(line_num);
+    size_t line_start = m_line_index.getLineOffset(line_num);
+    size_t content_end = line_start + info.bytes();
+    size_t erase_length = erased.size();
+    if (offset + erase_length > content_end || text.find_first_of("\r\n") != std::string::npos ||
+        erased.find_first_of("\r\n") != std::string::npos) {
+        return false;
+    }
+    
+    // A '\r' left just before a '\n' would turn the line ending into CRLF
+    if (info.eol == 1 && offset + erase_length == content_end && offset > line_start &&
+        m_text.byteAt(offset - 1) == '\r') {
+        return false;
+    }
+    
+    m_text.erase(offset, erase_length);
+    m_text.insert(offset, text);
+    
+    info.setBytes(info.bytes() - erase_length + text.size());
+    info.setChars(info.chars() - LineIndex::countChars(erased.data(), erased.size()) +
+                  LineIndex::countChars(text.data(), text.size()));
+    m_line_index.replace(line_num, 1, std::vector<LineInfo>(1, info));
+    return true;
+}
+
+size_t Buffer::columnToByte(size_t line_num, size_t column) const {
+    const LineInfo& info = m_line_index.getLine(line_num);
+    if (column >= info.chars()) {
+        return info.bytes();
+    }
+    if (info.isAscii()) {
+        return column;
+    }
+    
+    CharCheckpoints& checkpoints = getCheckpoints(line_num);
+    extendCheckpoints(checkpoints, column, 0);
+    size_t index = std::min(column / CHECKPOINT_INTERVAL, checkpoints.bytes.size() - 1);
+    return skipColumns(line_num, checkpoints.bytes[index], column - index * CHECKPOINT_INTERVAL);
+}
+
+size_t Buffer::byteToColumn(size_t line_num, size_t byte_in_line) const {
+    const LineInfo& info = m_line_index.getLine(line_num);
+    if (info.isAscii()) {
+        return std::min(byte_in_line, info.bytes());
+    }
+    
+    CharCheckpoints& checkpoints = getCheckpoints(line_num);
+    extendCheckpoints(checkpoints, 0, byte_in_line);
+    size_t index = std::upper_bound(checkpoints.bytes.begin(), checkpoints.bytes.end(), byte_in_line) -
+                   checkpoints.bytes.begin() - 1;
+    
+    // Count the characters that start between the checkpoint and the offset
+    size_t start = checkpoints.bytes[index];
+    std::string text = m_text.read(getLineOffset(line_num) + start, byte_in_line - start);
+    return index * CHECKPOINT_INTERVAL + LineIndex::countChars(text.data(), text.size());
+}
+
+Buffer::CharCheckpoints& Buffer::getCheckpoints(size_t line_num) const {
+    for (size_t i = 0; i < m_checkpoints.size(); ++i) {
+        if (m_checkpoints[i].line == line_num) {
+            // Keep the most recently used entry last
+            std::swap(m_checkpoints[i], m_checkpoints.back());
+            return m_checkpoints.back();
+        }
+    }
+    
+    if (m_checkpoints.size() >= MAX_CHECKPOINT_LINES) {
+        m_checkpoints.erase(m_checkpoints.begin());
+    }
+    
+    CharCheckpoints checkpoints;
+    checkpoints.line = line_num;
+    checkpoints.bytes.push_back(0);
+    checkpoints.complete = false;
+    m_checkpoints.push_back(checkpoints);
+    return m_checkpoints.back();
+}
+
+void Buffer::extendCheckpoints(CharCheckpoints& checkpoints, size_t column, size_t byte_in_line) const {
+    // Add checkpoints until one lies beyond the column and the byte offset
+    size_t line_bytes = m_line_index.getLine(checkpoints.line).bytes();
+    while (!checkpoints.complete &&
+           ((checkpoints.bytes.size() - 1) * CHECKPOINT_INTERVAL <= column || checkpoints.bytes.back() <= byte_in_line)) {
+        size_t next = skipColumns(checkpoints.line, checkpoints.bytes.back(), CHECKPOINT_INTERVAL);
+        if (next >= line_bytes) {
+            checkpoints.complete = true;
+        } else {
+            checkpoints.bytes.push_back(next);
+        }
+    }
+}
+
+size_t Buffer::skipColumns(size_t line_num, size_t byte_in_line, size_t columns) const {
+    // Byte offset of the character `columns` characters after the one
+    // starting at byte_in_line, or the line length if there is none
+    const size_t READ_SIZE = 256;
+    size_t line_offset = getLineOffset(line_num);
+    size_t line_bytes = m_line_index.getLine(line_num).bytes();
+    std::string chunk;
+    
+    while (byte_in_line < line_bytes) {
+        m_text.read(line_offset + byte_in_line, std::min(READ_SIZE, line_bytes - byte_in_line), chunk);
+        for (size_t i = 0; i < chunk.size(); ++i) {
+            if ((static_cast<uint8_t>(chunk[i]) & 0xC0) != 0x80) {
+                if (columns == 0) {
+                    return byte_in_line + i;
+                }
+                --columns;
+            }
+        }
+        byte_in_line += chunk.size();
+    }
+    return line_bytes;
+}
+
+void Buffer::updateCheckpoints(size_t first_line, size_t last_line, size_t new_line_count, size_t byte_in_line) {
+    // Checkpoints before an edit inside a single line stay valid; lines
+    // after the edit only move
+    size_t old_line_count = last_line - first_line + 1;
+    for (size_t i = m_checkpoints.size(); i-- > 0; ) {
+        CharCheckpoints& checkpoints = m_checkpoints[i];
+        if (checkpoints.line < first_line) {
+            continue;
+        }
+        if (checkpoints.line > last_line) {
+            checkpoints.line = checkpoints.line - old_line_count + new_line_count;
+            continue;
+        }
+        if (old_line_count == 1 && new_line_count == 1) {
+            std::vector<size_t>::iterator end = std::upper_bound(checkpoints.bytes.begin(), checkpoints.bytes.end(),
+                                                                 byte_in_line);
+            checkpoints.bytes.erase(end, checkpoints.bytes.end());
+            checkpoints.complete = false;
+        } else {
+            m_checkpoints.erase(m_checkpoints.begin() + i);
+        }
+    }
+}
+
+bool Buffer::findNext(const std::string& pattern, size_t from, size_t to, size_t& match) const {
+    return m_text.find(pattern, from, to, match);
+}
+
+bool Buffer::findPrevious(const std::string& pattern, size_t from, size_t to, size_t& match) const {
+    return m_text.findLast(pattern, from, to, match);
 }
 
 bool Buffer::isWordChar(char32_t ch) const {
@@ -379,64 +914,366 @@ bool Buffer::isWordChar(char32_t ch) const {
            ch == '_';
 }
 
-void Buffer::undo() {
-    // Simplified undo - full implementation would be more complex
-    if (canUndo()) {
-        m_undo_index--;
-        // Apply undo operation
-        setModified();
+bool Buffer::undo() {
+    if (!canUndo() || !loadUndoGroup(m_undo_index - 1)) {
+        return false;
+    }
+    
+    // Reverse the group's edits, last one first
+    const UndoGroup& group = m_undo_groups[--m_undo_index];
+    m_replaying = true;
+    for (size_t i = group.entries.size(); i-- > 0; ) {
+        const UndoEntry& entry = group.entries[i];
+        replaceText(entry.offset, entry.inserted.size(), entry.erased);
     }
+    m_replaying = false;
+    m_group_open = false;
+    
+    m_cursor = group.cursor;
+    ensureValidCursor();
+    m_modified = (m_undo_index != m_saved_index);
+    trimUndoHistory();
+    return true;
 }
 
-void Buffer::redo() {
-    // Simplified redo - full implementation would be more complex
-    if (canRedo()) {
-        m_undo_index++;
-        // Apply redo operation
-        setModified();
+bool Buffer::redo() {
+    if (!canRedo() || !loadUndoGroup(m_undo_index)) {
+        return false;
+    }
+    
+    const UndoGroup& group = m_undo_groups[m_undo_index++];
+    m_replaying = true;
+    for (size_t i = 0; i < group.entries.size(); ++i) {
+        const UndoEntry& entry = group.entries[i];
+        replaceText(entry.offset, entry.erased.size(), entry.inserted);
     }
+    m_replaying = false;
+    m_group_open = false;
+    
+    // Like vi, leave the cursor at the start of the redone change
+    m_cursor = getPositionAtByte(group.entries.front().offset);
+    ensureValidCursor();
+    m_modified = (m_undo_index != m_saved_index);
+    trimUndoHistory();
+    return true;
 }
 
-std::string Buffer::yankLine() {
-    if (m_cursor.line < m_lines.size()) {
-        return m_lines[m_cursor.line];
+void Buffer::beginUndoGroup() {
+    if (m_group_depth++ == 0) {
+        m_group_open = false;
+    }
+}
+
+void Buffer::endUndoGroup() {
+    if (m_group_depth > 0 && --m_group_depth == 0) {
+        m_group_open = false;
     }
-    return "";
+}
+
+void Buffer::setUndoBudget(size_t bytes) {
+    m_undo_budget = bytes;
+    trimUndoHistory();
+}
+
+std::string Buffer::yankLine() {
+    return getLine(m_cursor.line);
 }
 
 void Buffer::pasteAfter(const std::string& text) {
     if (m_readonly || text.empty()) return;
     
     // For now, treat all paste as line paste
-    m_lines.insert(m_lines.begin() + m_cursor.line + 1, text);
+    size_t offset, length, eol_length;
+    getLineExtent(m_cursor.line, offset, length, eol_length);
+    replaceText(offset + length, 0, m_eol + text);
     m_cursor.line++;
     m_cursor.column = 0;
-    setModified();
 }
 
 void Buffer::pasteBefore(const std::string& text) {
     if (m_readonly || text.empty()) return;
     
     // For now, treat all paste as line paste
-    m_lines.insert(m_lines.begin() + m_cursor.line, text);
+    replaceText(getLineOffset(m_cursor.line), 0, text + m_eol);
     m_cursor.column = 0;
-    setModified();
 }
 
-void Buffer::addUndoEntry(const UndoEntry& entry) {
-    // Remove any redo entries
-    m_undo_stack.erase(m_undo_stack.begin() + m_undo_index, m_undo_stack.end());
+void Buffer::recordEdit(size_t offset, const std::string& erased, const std::string& inserted) {
+    // A new edit discards whatever could have been redone
+    dropNewestUndoGroups(m_undo_index);
+    
+    if (m_group_depth == 0 || !m_group_open) {
+        UndoGroup group;
+        group.cursor = m_cursor;
+        group.bytes = sizeof(UndoGroup);
+        group.file_offset = NO_FILE_OFFSET;
+        group.loaded = true;
+        m_undo_groups.push_back(group);
+        m_undo_index = m_undo_groups.size();
+        m_undo_bytes += group.bytes;
+        m_group_open = (m_group_depth > 0);
+    }
+    
+    UndoGroup& group = m_undo_groups.back();
+    size_t added = erased.size() + inserted.size();
+    
+    // Merge runs of typing, backspacing and repeated deletes into one entry
+    bool merged = false;
+    if (!group.entries.empty()) {
+        UndoEntry& last = group.entries.back();
+        if (erased.empty() && offset == last.offset + last.inserted.size()) {
+            last.inserted += inserted;                         // Typing on
+            merged = true;
+        } else if (inserted.empty() && last.inserted.empty() && offset == last.offset) {
+            last.erased += erased;                             // dd, x, Delete
+            merged = true;
+        } else if (inserted.empty() && last.inserted.empty() && offset + erased.size() == last.offset) {
+            last.erased.insert(0, erased);                     // Backspace
+            last.offset = offset;
+            merged = true;
+        } else if (inserted.empty() && offset >= last.offset &&
+                   offset + erased.size() == last.offset + last.inserted.size()) {
+            last.inserted.erase(offset - last.offset);         // Backspace over typing
+            group.bytes -= erased.size();
+            m_undo_bytes -= erased.size();
+            added = 0;
+            merged = true;
+        }
+    }
+    
+    if (!merged) {
+        UndoEntry entry;
+        entry.offset = offset;
+        entry.erased = erased;
+        entry.inserted = inserted;
+        group.entries.push_back(entry);
+        added += sizeof(UndoEntry);
+    }
+    
+    group.bytes += added;
+    m_undo_bytes += added;
+    trimUndoHistory();
+}
+
+void Buffer::trimUndoHistory() {
+    if (m_undo_bytes <= m_undo_budget) {
+        return;
+    }
+    
+    // Groups that are also in the undo file can simply be unloaded, oldest
+    // first; they are read back if they are undone again
+    for (size_t i = m_undo_unload_hint; i < m_undo_groups.size() && m_undo_bytes > m_undo_budget; ++i) {
+        UndoGroup& group = m_undo_groups[i];
+        if (group.loaded && group.file_offset != NO_FILE_OFFSET) {
+            std::vector<UndoEntry>().swap(group.entries);
+            group.loaded = false;
+            m_undo_bytes -= group.bytes - sizeof(UndoGroup);
+            group.bytes = sizeof(UndoGroup);
+        }
+        m_undo_unload_hint = i + 1;
+    }
     
-    // Add new entry
-    m_undo_stack.push_back(entry);
-    m_undo_index = m_undo_stack.size();
+    // Otherwise the oldest groups are forgotten, always keeping the most
+    // recent one
+    while (m_undo_bytes > m_undo_budget && m_undo_groups.size() > 1 && m_undo_index > 0) {
+        dropOldestUndoGroups(1);
+    }
+}
+
+void Buffer::dropOldestUndoGroups(size_t count) {
+    count = std::min(count, m_undo_groups.size());
+    for (size_t i = 0; i < count; ++i) {
+        m_undo_bytes -= m_undo_groups.front().bytes;
+        m_undo_groups.pop_front();
+    }
     
-    // Limit undo stack size
-    const size_t MAX_UNDO_ENTRIES = 1000;
-    if (m_undo_stack.size() > MAX_UNDO_ENTRIES) {
-        m_undo_stack.erase(m_undo_stack.begin());
-        m_undo_index--;
+    m_undo_base += count;
+    m_undo_index -= std::min(count, m_undo_index);
+    m_undo_unload_hint -= std::min(count, m_undo_unload_hint);
+    if (m_saved_index != std::string::npos) {
+        m_saved_index = (m_saved_index >= count) ? m_saved_index - count : std::string::npos;
     }
 }
 
+void Buffer::dropNewestUndoGroups(size_t from) {
+    if (from >= m_undo_groups.size()) {
+        return;
+    }
+    
+    for (size_t i = from; i < m_undo_groups.size(); ++i) {
+        m_undo_bytes -= m_undo_groups[i].bytes;
+    }
+    m_undo_groups.erase(m_undo_groups.begin() + from, m_undo_groups.end());
+    
+    m_undo_index = std::min(m_undo_index, from);
+    m_undo_unload_hint = std::min(m_undo_unload_hint, from);
+    if (m_saved_index != std::string::npos && m_saved_index > from) {
+        m_saved_index = std::string::npos;
+    }
+    m_undo_disk_count = std::min(m_undo_disk_count, m_undo_base + from);
+}
+
+void Buffer::forgetUndoHistory() {
+    // Nothing before an edit that was not recorded can be undone, and the
+    // saved text cannot be reached again
+    dropNewestUndoGroups(0);
+    m_saved_index = std::string::npos;
+    m_group_open = false;
+    m_undo_disk_length = std::string::npos;
+}
+
+void Buffer::resetUndoHistory() {
+    m_undo_groups.clear();
+    m_undo_index = 0;
+    m_undo_bytes = 0;
+    m_saved_index = 0;
+    m_group_open = false;
+    m_undo_base = 0;
+    m_undo_disk_count = 0;
+    m_undo_disk_length = std::string::npos;
+    m_undo_loaded_hash = 0;
+    m_undo_verified = true;
+    m_undo_unload_hint = 0;
+}
+
+void Buffer::loadUndoFile() {
+    // Only the list of groups is read here; each group is read when it is
+    // first undone
+    m_undo_path = UndoFile::pathFor(m_filename);
+    UndoFile::Index index;
+    if (!UndoFile::readIndex(m_undo_path, index) || index.saved_size != m_text.getOriginalSize()) {
+        return;
+    }
+    
+    for (size_t i = 0; i < index.groups.size(); ++i) {
+        UndoGroup group;
+        group.bytes = sizeof(UndoGroup);
+        group.file_offset = index.groups[i];
+        group.loaded = false;
+        m_undo_groups.push_back(group);
+        m_undo_bytes += group.bytes;
+    }
+    
+    m_undo_index = static_cast<size_t>(index.saved_count);
+    m_saved_index = m_undo_index;
+    m_undo_disk_count = m_undo_groups.size();
+    m_undo_disk_length = index.clean ? m_undo_disk_count : std::string::npos;
+    m_undo_loaded_hash = index.saved_hash;
+    m_undo_verified = m_undo_groups.empty();
+    trimUndoHistory();
+}
+
+bool Buffer::verifyUndoFile() {
+    // The text as loaded is still the original text of the piece table
+    ContentHash hash;
+    hash.update(m_text.getOriginalData(), m_text.getOriginalSize());
+    m_undo_verified = true;
+    if (hash.value() == m_undo_loaded_hash) {
+        return true;
+    }
+    
+    // The file was changed by something else: the history read from the
+    // undo file does not apply to it
+    size_t stale = 0;
+    while (stale < m_undo_index && !m_undo_groups[stale].loaded) {
+        ++stale;
+    }
+    dropOldestUndoGroups(stale);
+    size_t first_redo = m_undo_index;
+    while (first_redo < m_undo_groups.size() && m_undo_groups[first_redo].loaded) {
+        ++first_redo;
+    }
+    dropNewestUndoGroups(first_redo);
+    m_undo_disk_length = std::string::npos;
+    return false;
+}
+
+bool Buffer::loadUndoGroup(size_t index) {
+    if (m_undo_groups[index].loaded) {
+        return true;
+    }
+    if (!m_undo_verified && !verifyUndoFile()) {
+        return false;
+    }
+    
+    UndoGroup& group = m_undo_groups[index];
+    size_t cursor_line, cursor_column;
+    if (!UndoFile::readGroup(m_undo_path, group.file_offset, group.entries, cursor_line, cursor_column)) {
+        // History beyond a group that cannot be read is unreachable
+        m_undo_disk_length = std::string::npos;
+        if (index < m_undo_index) {
+            dropOldestUndoGroups(index + 1);
+        } else {
+            dropNewestUndoGroups(index);
+        }
+        return false;
+    }
+    
+    group.cursor = BufferPosition(cursor_line, cursor_column);
+    group.loaded = true;
+    size_t added = 0;
+    for (size_t i = 0; i < group.entries.size(); ++i) {
+        added += sizeof(UndoEntry) + group.entries[i].erased.size() + group.entries[i].inserted.size();
+    }
+    group.bytes += added;
+    m_undo_bytes += added;
+    m_undo_unload_hint = std::min(m_undo_unload_hint, index);
+    return true;
+}
+
+void Buffer::saveUndoFile(uint64_t size, uint64_t hash) {
+    // Saving under a new name starts a new undo file there; the groups that
+    // are only in the old one have to be read first
+    std::string path = UndoFile::pathFor(m_filename);
+    if (!m_undo_verified) {
+        verifyUndoFile();
+    }
+    if (m_undo_groups.empty() && m_undo_disk_length == std::string::npos) {
+        m_undo_path = path;
+        return;                     // Nothing worth keeping
+    }
+    
+    bool rewrite = (path != m_undo_path || m_undo_disk_length == std::string::npos ||
+                    m_undo_base > m_undo_disk_count);
+    if (rewrite) {
+        for (size_t i = 0; i < m_undo_groups.size(); ) {
+            i = loadUndoGroup(i) ? i + 1 : 0;
+        }
+        m_undo_path = path;
+    }
+    
+    UndoFile file;
+    bool ok = file.open(m_undo_path, rewrite, m_filename);
+    if (ok && rewrite) {
+        m_undo_base = 0;
+        m_undo_disk_count = 0;
+    } else if (ok && m_undo_disk_length != m_undo_disk_count) {
+        ok = file.writeTruncate(m_undo_disk_count);
+    }
+    
+    size_t first_new = m_undo_disk_count - m_undo_base;
+    for (size_t i = first_new; ok && i < m_undo_groups.size(); ++i) {
+        UndoGroup& group = m_undo_groups[i];
+        uint64_t offset;
+        ok = file.writeGroup(group.entries, group.cursor.line, group.cursor.column, offset);
+        group.file_offset = offset;
+    }
+    ok = ok && file.writeSave(m_undo_base + m_undo_index, size, hash);
+    ok = file.close() && ok;
+    
+    if (!ok) {
+        // Keep everything in memory and start the file afresh next time
+        for (size_t i = rewrite ? 0 : first_new; i < m_undo_groups.size(); ++i) {
+            m_undo_groups[i].file_offset = NO_FILE_OFFSET;
+        }
+        m_undo_disk_length = std::string::npos;
+        return;
+    }
+    
+    m_undo_disk_count = m_undo_base + m_undo_groups.size();
+    m_undo_disk_length = m_undo_disk_count;
+    m_undo_unload_hint = std::min(m_undo_unload_hint, first_new);
+    trimUndoHistory();
+}
+
 } // namespace subzero
\ No newline at end of file
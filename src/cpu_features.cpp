@@ -0,0 +1,33 @@
+#include "cpu_features.h"
+
+namespace subzero {
+namespace cpu {
+
+#ifdef SUBZERO_X86_SIMD
+static bool detectAVX2() {
+    // May run during static initialisation, before the runtime has
+    // filled in the CPU model
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+bool hasSSE2() {
+#ifdef SUBZERO_X86_SIMD
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool hasAVX2() {
+#ifdef SUBZERO_X86_SIMD
+    static const bool supported = detectAVX2();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+} // namespace cpu
+} // namespace subzero
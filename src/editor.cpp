@@ -1,21 +1,63 @@
 #include "editor.h"
+#include "grid_terminal.h"
 #include <iostream>
 #include <sstream>
+#include <iomanip>
 #include <cctype>  // For tolower, isalnum
 
+#ifdef WINDOWS_PLATFORM
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
 namespace subzero {
 
+// Parse an unsigned decimal number that may exceed the range of int
+static bool parseNumber(const std::string& text, size_t& value) {
+    if (text.empty()) {
+        return false;
+    }
+    
+    value = 0;
+    for (size_t i = 0; i < text.length(); ++i) {
+        if (text[i] < '0' || text[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+// Wall clock milliseconds from an arbitrary start, for frame pacing
+static unsigned long currentMillis() {
+#ifdef WINDOWS_PLATFORM
+    return GetTickCount();
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return static_cast<unsigned long>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+#endif
+}
+
 Editor::Editor(shared_ptr<ITerminal> terminal)
-    : m_terminal(terminal)
+    // Frames are composed in a grid and only changed cells reach the terminal
+    : m_terminal(terminal ? shared_ptr<ITerminal>(new GridTerminal(terminal)) : terminal)
     , m_buffer(shared_ptr<Buffer>(new Buffer()))
     , m_current_buffer_index(0)
     , m_mode(NORMAL)
     , m_previous_mode(NORMAL)
     , m_search_forward(true)
+    , m_highlight_search(false)
+    , m_undo_file(true)
     , m_running(false)
-    , m_dirty_display(true)
-    , m_fast_mode(false)
-    , m_render_delay_counter(0)
+    , m_invalid(INVALIDATE_VIEWPORT | INVALIDATE_STATUS)
+    , m_rendered_buffer(NULL)
+    , m_rendered_version(0)
+    , m_last_frame_ms(0)
+    , m_frame_cost_ms(0)
+    , m_pending_jump(JUMP_NONE)
+    , m_pending_target(0)
     , m_yank_line_mode(false)
     , m_repeat_count(0)
     , m_syntax_manager(new SyntaxHighlighterManager())
@@ -24,6 +66,7 @@ Editor::Editor(shared_ptr<ITerminal> terminal)
         // Initialize with one empty buffer
         m_buffers.push_back(m_buffer);
         m_window = shared_ptr<Window>(new Window(m_terminal, m_buffer));
+        m_layout = shared_ptr<WindowLayout>(new WindowLayout(m_window));
         initializeKeyBindings();
         
         // Syntax highlighting is now built-in, no plugin loading needed
@@ -41,41 +84,128 @@ void Editor::run() {
     
     m_running = true;
     m_terminal->clear();
+    layoutWindows();
     
-    // Setup window to use full terminal except status bar
-    TerminalSize terminal_size = m_terminal->getSize();
-    
-    // Ensure minimum terminal size and leave space for status bar
-    int window_rows = (terminal_size.rows > 1) ? terminal_size.rows - 1 : 24;
-    int window_cols = (terminal_size.cols > 0) ? terminal_size.cols : 80;
-    
-    m_window->setPosition(Position(0, 0));
-    m_window->setSize(TerminalSize(window_rows, window_cols));
-    
-    while (m_running) {
-        // Check if we should defer rendering during rapid typing
-        if (m_dirty_display) {
-            if (m_render_delay_counter > 0) {
-                m_render_delay_counter--;
-                // Skip rendering this frame to improve typing performance
-            } else {
-                render();
-                m_dirty_display = false;
-                m_fast_mode = false;  // Exit fast mode after rendering
-            }
+    // The terminal may end the session too, as the headless one does when
+    // its keys run out
+    while (m_running && m_terminal->isInitialized()) {
+        if (m_invalid != INVALIDATE_NONE) {
+            renderFrame();
         }
         
+        waitForInput();
         handleInput();
+        
+        // Keys already waiting (a paste, key repeat) are handled before the
+        // next frame until it is due, so a burst costs a frame per interval
+        // rather than one per key
+        while (m_running && m_terminal->hasInput() && currentMillis() - m_last_frame_ms < getFrameInterval()) {
+            handleInput();
+        }
     }
     
     m_terminal->shutdown();
 }
 
-bool Editor::openFile(const std::string& filename) {
+TerminalSize Editor::getEditorArea() const {
+    // The whole terminal except the status bar, with a fallback for
+    // terminals that don't report a size
+    TerminalSize terminal_size = m_terminal->getSize();
+    int rows = (terminal_size.rows > 1) ? terminal_size.rows - 1 : 24;
+    int cols = (terminal_size.cols > 0) ? terminal_size.cols : 80;
+    return TerminalSize(rows, cols);
+}
+
+void Editor::layoutWindows() {
+    m_layout_size = m_terminal->getSize();
+    m_layout->arrange(Position(0, 0), getEditorArea());
+    invalidate(INVALIDATE_STATUS);
+}
+
+void Editor::renderFrame() {
+    unsigned long start = currentMillis();
+    render();
+    m_last_frame_ms = currentMillis();
+    
+    // Smoothed, so one slow frame doesn't stall the next burst
+    unsigned long cost = m_last_frame_ms - start;
+    m_frame_cost_ms = (3 * m_frame_cost_ms + cost) / 4;
+}
+
+unsigned long Editor::getFrameInterval() const {
+    // Twice the cost of a frame leaves at least half the time for input
+    unsigned long interval = 2 * m_frame_cost_ms;
+    if (interval < MIN_FRAME_INTERVAL_MS) return MIN_FRAME_INTERVAL_MS;
+    if (interval > MAX_FRAME_INTERVAL_MS) return MAX_FRAME_INTERVAL_MS;
+    return interval;
+}
+
+void Editor::waitForInput() {
+    // Take the background indexer's work while no key is waiting, so the
+    // status bar shows progress and pending jumps land as soon as they can
+    while (m_buffer && !m_buffer->isFullyIndexed() && !m_terminal->hasInput()) {
+        int progress = m_buffer->getIndexingProgress();
+        if (!m_buffer->pollIndexing(INDEX_POLL_MS)) {
+            continue;
+        }
+        
+        if (completePendingJump() || m_buffer->getIndexingProgress() != progress) {
+            invalidate(INVALIDATE_LINES | INVALIDATE_STATUS);
+            render();
+        }
+    }
+    completePendingJump();
+    
+    // Repack the line index while the user is idle if edits left it sparse
+    if (m_buffer && !m_terminal->hasInput()) {
+        m_buffer->compactMemory();
+    }
+}
+
+bool Editor::completePendingJump() {
+    switch (m_pending_jump) {
+        case JUMP_LAST_LINE:
+            if (!m_buffer->isFullyIndexed()) return false;
+            m_pending_jump = JUMP_NONE;
+            moveLastLine();
+            break;
+        case JUMP_LINE:
+            if (!m_buffer->isLineIndexed(m_pending_target)) return false;
+            m_pending_jump = JUMP_NONE;
+            moveToLine(m_pending_target);
+            break;
+        case JUMP_BYTE:
+            if (!m_buffer->isOffsetIndexed(m_pending_target)) return false;
+            m_pending_jump = JUMP_NONE;
+            moveToByte(m_pending_target);
+            break;
+        default:
+            return false;
+    }
+    
+    clearMessages();
+    invalidate(INVALIDATE_STATUS);
+    return true;
+}
+
+void Editor::deferJump(PendingJump jump, size_t target) {
+    m_pending_jump = jump;
+    m_pending_target = target;
+    setStatusMessage("Waiting for the index to reach the target...");
+}
+
+bool Editor::openFile(const std::string& filename, bool read_only) {
     shared_ptr<Buffer> new_buffer(new Buffer());
+    new_buffer->setUndoFileEnabled(m_undo_file);
     
     // Try to load the file
-    bool file_loaded = new_buffer->loadFromFile(filename);
+    bool file_loaded = new_buffer->loadFromFile(filename, read_only);
+    
+    // A file can only be viewed if it exists
+    if (!file_loaded && read_only) {
+        setErrorMessage("Could not open file: " + filename);
+        return false;
+    }
     
     // If file doesn't exist, create a new buffer with the filename
     if (!file_loaded) {
@@ -115,35 +245,52 @@ bool Editor::openFile(const std::string& filename) {
         }
     }
     
-    m_dirty_display = true;
     return true;
 }
 
 bool Editor::saveFile(const std::string& filename) {
     if (m_buffer->saveToFile(filename)) {
-        setStatusMessage("Saved: " + (filename.empty() ? m_buffer->getFilename() : filename));
-        m_dirty_display = true;
+        // Say so when the file could not be replaced as a whole, as a crash
+        // during such a save leaves it half written
+        setStatusMessage("Saved: " + (filename.empty() ? m_buffer->getFilename() : filename) +
+                         (m_buffer->wasSavedInPlace() ? " (written in place)" : ""));
+        if (!filename.empty()) {
+            invalidate(INVALIDATE_VIEWPORT);  // The new name may select another highlighter
+        }
         return true;
     }
     
-    setErrorMessage("Could not save file");
+    std::string reason = m_buffer->getLastError();
+    setErrorMessage(reason.empty() ? "Could not save file" : "Could not save file: " + reason);
     return false;
 }
 
 bool Editor::newFile() {
     m_buffer = shared_ptr<Buffer>(new Buffer());
+    m_buffer->setUndoFileEnabled(m_undo_file);
     m_buffer->setCursor(BufferPosition(0, 0));
     
     m_window->setBuffer(m_buffer);
     setStatusMessage("New file");
-    m_dirty_display = true;
     return true;
 }
 
 void Editor::setMode(EditorMode mode) {
+    if (mode == INSERT && m_buffer->isReadonly()) {
+        setErrorMessage("File is read-only");
+        return;
+    }
+    
+    // An insert session is undone as a whole
+    if (mode == INSERT && m_mode != INSERT) {
+        m_buffer->beginUndoGroup();
+    } else if (mode != INSERT && m_mode == INSERT) {
+        m_buffer->endUndoGroup();
+    }
+    
     m_previous_mode = m_mode;
     m_mode = mode;
-    m_dirty_display = true;
+    invalidate(INVALIDATE_STATUS);
     
     if (mode == INSERT) {
         m_terminal->showCursor(true);
@@ -167,25 +314,115 @@ std::string Editor::getModeString() const {
 void Editor::render() {
     if (!m_terminal) return;
     
-    // Ensure syntax highlighter is set correctly (skip in fast mode for performance)
-    if (!m_fast_mode && m_syntax_manager && m_buffer && !m_buffer->getFilename().empty()) {
-        ISyntaxHighlighter* highlighter = m_syntax_manager->getHighlighterForFile(m_buffer->getFilename());
-        m_window->setSyntaxHighlighter(highlighter);
-    } else if (m_fast_mode) {
-        // Disable syntax highlighting in fast mode
-        m_window->setSyntaxHighlighter(NULL);
+    TerminalSize terminal_size = m_terminal->getSize();
+    if (terminal_size.rows != m_layout_size.rows || terminal_size.cols != m_layout_size.cols) {
+        layoutWindows();
+    }
+    
+    // Edits, scrolling and cursor motion are found by comparing with the
+    // last frame, so commands don't have to report them
+    if (m_buffer.get() != m_rendered_buffer || m_buffer->getVersion() != m_rendered_version) {
+        invalidate(INVALIDATE_LINES | INVALIDATE_STATUS);
+    }
+    if (m_mode == VISUAL || m_mode == VISUAL_LINE) {
+        m_window->setSelection(m_visual_anchor, m_buffer->getCursor(), m_mode == VISUAL_LINE);
+    } else {
+        m_window->clearSelection();
+    }
+    std::string search_highlight = m_highlight_search ? m_last_search : std::string();
+    m_window->setSearchHighlight(search_highlight);
+    if (m_window->hasDirtyLines() || m_window->gutterChanged()) {
+        invalidate(INVALIDATE_LINES);
+    }
+    if (m_window->layoutChanged()) {
+        invalidate(INVALIDATE_VIEWPORT);
+    } else if (m_invalid & INVALIDATE_VIEWPORT) {
+        m_window->forceFullRefresh();
+    }
+    if (m_buffer->getCursor() != m_rendered_cursor) {
+        invalidate(INVALIDATE_CURSOR | INVALIDATE_STATUS);  // The status bar shows the position
+    }
+    
+    // The window is only drawn when text on it changed; motion within the
+    // view just moves the cursor
+    bool lines_changed = (m_invalid & (INVALIDATE_LINES | INVALIDATE_VIEWPORT)) != 0;
+    if (lines_changed) {
+        // Ensure syntax highlighter is set correctly
+        if (m_syntax_manager && !m_buffer->getFilename().empty()) {
+            ISyntaxHighlighter* highlighter = m_syntax_manager->getHighlighterForFile(m_buffer->getFilename());
+            m_window->setSyntaxHighlighter(highlighter);
+        }
+        
+        m_window->render();
     }
     
-    // Render main window
-    m_window->render();
+    // Other windows are drawn only where their own view changed or edits
+    // reached the lines they show
+    const std::vector<shared_ptr<Window> >& windows = m_layout->getWindows();
+    for (size_t i = 0; i < windows.size(); ++i) {
+        const shared_ptr<Window>& window = windows[i];
+        if (window == m_window) {
+            continue;
+        }
+        window->clearSelection();
+        window->setSearchHighlight(search_highlight);
+        if (window->layoutChanged() || window->hasDirtyLines() || window->gutterChanged() ||
+            (lines_changed && window->getBuffer() == m_buffer)) {
+            window->render();
+        }
+    }
     
-    // Render status bar
-    renderStatusBar();
+    if (m_invalid & (INVALIDATE_STATUS | INVALIDATE_VIEWPORT)) {
+        renderWindowFrames();
+        renderStatusBar();
+    }
     
+    m_window->updateCursor();
     m_terminal->refresh();
     
-    // Update cursor position after everything is rendered
-    m_window->updateCursor();
+    m_invalid = INVALIDATE_NONE;
+    m_rendered_buffer = m_buffer.get();
+    m_rendered_version = m_buffer->getVersion();
+    m_rendered_cursor = m_buffer->getCursor();
+}
+
+void Editor::renderWindowFrames() {
+    if (!m_layout->hasTitles()) return;
+    
+    // Title rows below each window, the active one in the status bar's
+    // colors, and separators between side by side windows
+    const std::vector<shared_ptr<Window> >& windows = m_layout->getWindows();
+    for (size_t i = 0; i < windows.size(); ++i) {
+        const shared_ptr<Window>& window = windows[i];
+        shared_ptr<Buffer> buffer = window->getBuffer();
+        std::string title = " " + (buffer->getFilename().empty() ? std::string("[No Name]") : buffer->getFilename());
+        if (buffer->isModified()) {
+            title += " [+]";
+        }
+        
+        size_t width = static_cast<size_t>(window->getSize().cols);
+        size_t length = utf8::length(title);
+        if (length > width) {
+            title = utf8::substr(title, 0, width);
+        } else {
+            title += std::string(width - length, ' ');
+        }
+        
+        Position pos(window->getPosition().row + window->getSize().rows, window->getPosition().col);
+        if (window == m_window) {
+            m_terminal->putStringWithColor(title, pos, Color::WHITE, Color::BLUE);
+        } else {
+            m_terminal->putStringWithColor(title, pos, Color::BLACK, Color::WHITE);
+        }
+    }
+    
+    const std::vector<WindowSeparator>& separators = m_layout->getSeparators();
+    for (size_t i = 0; i < separators.size(); ++i) {
+        for (int row = 0; row < separators[i].rows; ++row) {
+            Position pos(separators[i].pos.row + row, separators[i].pos.col);
+            m_terminal->putStringWithColor("|", pos, Color::BLACK, Color::WHITE);
+        }
+    }
 }
 
 void Editor::renderStatusBar() {
@@ -218,13 +455,26 @@ void Editor::renderStatusBar() {
     if (m_buffer->isModified()) {
         status << " [+]";
     }
+    if (m_buffer->isReadonly()) {
+        status << " [RO]";
+    }
     
     // Cursor position
     const BufferPosition& cursor = m_buffer->getCursor();
     status << " | " << (cursor.line + 1) << ":" << (cursor.column + 1);
     
-    // Total lines
-    status << " | " << m_buffer->getLineCount() << " lines";
+    // Total lines ("+" while the rest of the file is still being indexed)
+    status << " | " << m_buffer->getLineCount() << (m_buffer->isFullyIndexed() ? "" : "+") << " lines";
+    if (!m_buffer->isFullyIndexed()) {
+        status << " | indexing\xE2\x80\xA6 " << m_buffer->getIndexingProgress() << "%";
+    }
+    
+    // Position through the file by bytes
+    size_t byte_count = m_buffer->getByteCount();
+    if (byte_count > 0) {
+        size_t byte_offset = m_buffer->getByteOffset(cursor);
+        status << " | " << static_cast<int>((static_cast<double>(byte_offset) * 100.0) / byte_count) << "%";
+    }
     
     // Show messages
     if (!m_error_message.empty()) {
@@ -268,13 +518,13 @@ void Editor::renderStatusBar() {
 void Editor::setStatusMessage(const std::string& message) {
     m_status_message = message;
     m_error_message.clear();
-    m_dirty_display = true;
+    invalidate(INVALIDATE_STATUS);
 }
 
 void Editor::setErrorMessage(const std::string& message) {
     m_error_message = message;
     m_status_message.clear();
-    m_dirty_display = true;
+    invalidate(INVALIDATE_STATUS);
 }
 
 void Editor::handleInput() {
@@ -282,6 +532,9 @@ void Editor::handleInput() {
     
     KeyPress key = m_terminal->getKey();
     
+    // Any key cancels a jump still waiting for the index
+    m_pending_jump = JUMP_NONE;
+    
     // Clear messages after input
     clearMessages();
     
@@ -307,7 +560,10 @@ void Editor::handleInput() {
     // Ensure cursor is visible
     m_window->ensureCursorVisible();
     m_window->updateCursor();
-    m_dirty_display = true;
+    
+    // Counts, command sequences and the command line show in the status
+    // bar; render() works out what else the key changed
+    invalidate(INVALIDATE_STATUS);
 }
 
 void Editor::handleNormalMode(const KeyPress& key) {
@@ -317,10 +573,20 @@ void Editor::handleNormalMode(const KeyPress& key) {
                 clearCommandSequence();
                 setMode(NORMAL);
                 break;
-            case ARROW_LEFT: moveLeft(); m_dirty_display = true; break;
-            case ARROW_RIGHT: moveRight(); m_dirty_display = true; break;
-            case ARROW_UP: moveUp(); m_dirty_display = true; break;
-            case ARROW_DOWN: moveDown(); m_dirty_display = true; break;
+            case ARROW_LEFT: moveLeft(); break;
+            case ARROW_RIGHT: moveRight(); break;
+            case ARROW_UP: moveUp(); break;
+            case ARROW_DOWN: moveDown(); break;
+            case CTRL_R: redoChange(); break;
+            case CTRL_W:
+                // Ctrl-W starts a window command; Ctrl-W Ctrl-W is Ctrl-W w
+                if (m_command_sequence == "^W") {
+                    clearCommandSequence();
+                    windowCommand("w");
+                } else {
+                    m_command_sequence = "^W";
+                }
+                break;
             default: break;
         }
     } else if (key.isCharacter()) {
@@ -339,15 +605,15 @@ void Editor::handleNormalMode(const KeyPress& key) {
         }
         
         // Simple single-character commands
-        if (ch == "h") { moveLeft(); m_dirty_display = true; }
-        else if (ch == "j") { moveDown(); m_dirty_display = true; }
-        else if (ch == "k") { moveUp(); m_dirty_display = true; }
-        else if (ch == "l") { moveRight(); m_dirty_display = true; }
-        else if (ch == "w") { moveWordForward(); m_dirty_display = true; }
-        else if (ch == "b") { moveWordBackward(); m_dirty_display = true; }
-        else if (ch == "0") { moveLineBegin(); m_dirty_display = true; }
-        else if (ch == "$") { moveLineEnd(); m_dirty_display = true; }
-        else if (ch == "G") { moveLastLine(); m_dirty_display = true; }
+        if (ch == "h") moveLeft();
+        else if (ch == "j") moveDown();
+        else if (ch == "k") moveUp();
+        else if (ch == "l") moveRight();
+        else if (ch == "w") moveWordForward();
+        else if (ch == "b") moveWordBackward();
+        else if (ch == "0") moveLineBegin();
+        else if (ch == "$") moveLineEnd();
+        else if (ch == "G") moveLastLine();
         else if (ch == "i") enterInsertMode();
         else if (ch == "a") enterInsertModeAfter();
         else if (ch == "o") enterInsertModeNewLine();
@@ -377,22 +643,16 @@ void Editor::handleInsertMode(const KeyPress& key) {
                 break;
             case BACKSPACE:
                 m_buffer->deleteCharBefore();
-                m_dirty_display = true;  // Full redraw for backspace (line may change)
-                m_window->forceFullRefresh();  // Force complete screen refresh for Atari compatibility
                 break;
             case DELETE:
                 m_buffer->deleteChar();
-                m_dirty_display = true;  // Full redraw for delete
-                m_window->forceFullRefresh();  // Force complete screen refresh for Atari compatibility
                 break;
             case ENTER:
                 m_buffer->splitLine();
-                m_dirty_display = true;  // Full redraw for new line
                 break;
             case TAB:
                 // Insert tab as 4 spaces (configurable in future)
                 m_buffer->insertString("    ");
-                m_dirty_display = true;  // Full redraw for tab
                 break;
             case ARROW_LEFT: moveLeft(); break;  // No redraw needed for movement
             case ARROW_RIGHT: moveRight(); break;
@@ -402,17 +662,6 @@ void Editor::handleInsertMode(const KeyPress& key) {
         }
     } else if (key.isCharacter()) {
         m_buffer->insertString(key.utf8_char);
-        
-        // Enable fast mode and defer rendering for better typing performance
-        m_fast_mode = true;
-        m_render_delay_counter = 2;  // Defer for 2 input cycles
-        m_dirty_display = true;
-        
-        // Immediate cursor update for responsive feel (minimal cost)
-        if (m_window) {
-            m_window->updateCursor();
-            // Skip terminal refresh - will be done when rendering resumes
-        }
     }
 }
 
@@ -511,33 +760,54 @@ void Editor::moveFirstLine() {
 }
 
 void Editor::moveLastLine() {
+    if (!m_buffer->isFullyIndexed()) {
+        deferJump(JUMP_LAST_LINE, 0);
+        return;
+    }
     BufferPosition pos = m_buffer->getBufferEnd();
     m_buffer->setCursor(pos);
 }
 
+void Editor::moveToLine(size_t line) {
+    if (!m_buffer->isLineIndexed(line)) {
+        deferJump(JUMP_LINE, line);
+        return;
+    }
+    m_buffer->setCursor(BufferPosition(line, 0));
+}
+
+void Editor::moveToByte(size_t byte_offset) {
+    if (!m_buffer->isOffsetIndexed(byte_offset)) {
+        deferJump(JUMP_BYTE, byte_offset);
+        return;
+    }
+    m_buffer->setCursor(m_buffer->getPositionAtByte(byte_offset));
+}
+
 // Edit mode implementations
 void Editor::enterInsertMode() { setMode(INSERT); }
 void Editor::enterInsertModeAfter() { moveRight(); setMode(INSERT); }
 
 void Editor::enterInsertModeNewLine() {
+    // The new line belongs to the insert session's undo group
+    m_buffer->beginUndoGroup();
     m_buffer->insertLineAfter();
     setMode(INSERT);
+    m_buffer->endUndoGroup();
 }
 
 void Editor::enterInsertModeNewLineAbove() {
+    m_buffer->beginUndoGroup();
     m_buffer->insertLine();
     setMode(INSERT);
+    m_buffer->endUndoGroup();
 }
 
 void Editor::deleteCharacter() { 
     m_buffer->deleteChar(); 
-    m_dirty_display = true;  // Fix: Update screen after character deletion
-    m_window->forceFullRefresh();  // Force complete screen refresh for Atari compatibility
 }
 void Editor::deleteLine() { 
     m_buffer->deleteLine(); 
-    m_dirty_display = true;  // Fix: Update screen after line deletion
-    m_window->forceFullRefresh();  // Force complete screen refresh for Atari compatibility
 }
 
 void Editor::yankLine() {
@@ -558,7 +828,19 @@ void Editor::pasteBefore() {
     }
 }
 
-void Editor::undoChange() { m_buffer->undo(); }
+void Editor::undoChange() {
+    if (!m_buffer->undo()) {
+        setStatusMessage("Already at oldest change");
+        return;
+    }
+}
+
+void Editor::redoChange() {
+    if (!m_buffer->redo()) {
+        setStatusMessage("Already at newest change");
+        return;
+    }
+}
 
 void Editor::enterCommandMode() {
     setMode(COMMAND);
@@ -660,99 +942,27 @@ bool Editor::findInBuffer(const std::string& pattern, bool forward, bool wrap_ar
         return false;
     }
     
+    m_highlight_search = true;
     BufferPosition current = m_buffer->getCursor();
-    int start_line = current.line;
-    int start_col = current.column;
     
-    // For forward search, start from next position
-    // For backward search, start from current position
+    // Searches scan the text itself, so only the line holding the match
+    // has to be indexed; wrapping around takes the rest of the text
+    size_t start = m_buffer->getByteOffset(current);
+    size_t match;
+    bool found;
     if (forward) {
-        start_col++;
-    }
-    
-    // Search from current position
-    for (int line = start_line; line < (int)m_buffer->getLineCount(); line++) {
-        std::string line_text = m_buffer->getLine(line);
-        int search_start = (line == start_line) ? start_col : 0;
-        
-        if (forward) {
-            int found_pos;
-            if (findInLine(line_text, pattern, search_start, found_pos, true)) {
-                m_buffer->setCursor(BufferPosition(line, found_pos));
-                return true;
-            }
-        } else {
-            // Backward search in current line
-            if (line == start_line) {
-                for (int col = start_col - 1; col >= 0; col--) {
-                    if (matchesAtPosition(line_text, pattern, col, true)) {
-                        m_buffer->setCursor(BufferPosition(line, col));
-                        return true;
-                    }
-                }
-            } else {
-                // Search entire line from end
-                for (int col = (int)line_text.length() - (int)pattern.length(); col >= 0; col--) {
-                    if (matchesAtPosition(line_text, pattern, col, true)) {
-                        m_buffer->setCursor(BufferPosition(line, col));
-                        return true;
-                    }
-                }
-            }
-        }
-    }
-    
-    // If wrap_around is enabled and we haven't found anything, search from beginning/end
-    if (wrap_around) {
-        if (forward) {
-            // Search from beginning to current position
-            for (int line = 0; line <= start_line; line++) {
-                std::string line_text = m_buffer->getLine(line);
-                int search_end = (line == start_line) ? start_col : (int)line_text.length();
-                
-                int found_pos;
-                if (findInLine(line_text, pattern, 0, found_pos, true) && found_pos < search_end) {
-                    m_buffer->setCursor(BufferPosition(line, found_pos));
-                    return true;
-                }
-            }
-        } else {
-            // Search from end to current position
-            for (int line = m_buffer->getLineCount() - 1; line >= start_line; line--) {
-                std::string line_text = m_buffer->getLine(line);
-                
-                if (line == start_line) {
-                    // Already searched this part
-                    continue;
-                } else {
-                    // Search entire line from end
-                    for (int col = (int)line_text.length() - (int)pattern.length(); col >= 0; col--) {
-                        if (matchesAtPosition(line_text, pattern, col, true)) {
-                            m_buffer->setCursor(BufferPosition(line, col));
-                            return true;
-                        }
-                    }
-                }
-            }
-        }
+        found = m_buffer->findNext(pattern, start + 1, std::string::npos, match) ||
+                (wrap_around && m_buffer->findNext(pattern, 0, start + 1, match));
+    } else {
+        found = m_buffer->findPrevious(pattern, 0, start, match) ||
+                (wrap_around && m_buffer->findPrevious(pattern, start, std::string::npos, match));
     }
-    
-    return false;
-}
-
-bool Editor::findInLine(const std::string& line, const std::string& pattern, int start_pos, int& found_pos, bool case_sensitive) {
-    if (start_pos < 0 || start_pos >= (int)line.length() || pattern.empty()) {
+    if (!found) {
         return false;
     }
-    
-    for (int pos = start_pos; pos <= (int)line.length() - (int)pattern.length(); pos++) {
-        if (matchesAtPosition(line, pattern, pos, case_sensitive)) {
-            found_pos = pos;
-            return true;
-        }
-    }
-    
-    return false;
+    m_buffer->ensureOffsetIndexed(match);
+    m_buffer->setCursor(m_buffer->getPositionAtByte(match));
+    return true;
 }
 
 bool Editor::matchesAtPosition(const std::string& text, const std::string& pattern, size_t pos, bool case_sensitive) {
@@ -810,13 +1020,23 @@ std::string Editor::getCurrentWord() {
     return line.substr(start, end - start);
 }
 
-void Editor::enterVisualMode() { setMode(VISUAL); }
-void Editor::enterVisualLineMode() { setMode(VISUAL_LINE); }
+void Editor::enterVisualMode() {
+    m_visual_anchor = m_buffer->getCursor();
+    setMode(VISUAL);
+}
+
+void Editor::enterVisualLineMode() {
+    m_visual_anchor = m_buffer->getCursor();
+    setMode(VISUAL_LINE);
+}
 
 void Editor::executeCommand(const std::string& command) {
     if (command.empty()) return;
     
-    if (command == "q" || command == "quit") {
+    if ((command == "q" || command == "quit" || command == "q!" || command == "quit!") && getWindowCount() > 1) {
+        // With several windows, quitting closes the window; its buffer stays open
+        closeWindow();
+    } else if (command == "q" || command == "quit") {
         // If we have multiple buffers, close the current buffer
         if (m_buffers.size() > 1) {
             if (m_buffer->isModified()) {
@@ -843,8 +1063,32 @@ void Editor::executeCommand(const std::string& command) {
         saveFile();
     } else if (command == "wq" || command == "x") {
         if (saveFile()) {
-            quit();
+            if (getWindowCount() > 1) {
+                closeWindow();
+            } else {
+                quit();
+            }
+        }
+    } else if (command == "sp" || command == "split" || command == "vs" || command == "vsplit" ||
+               command.substr(0, 3) == "sp " || command.substr(0, 6) == "split " ||
+               command.substr(0, 3) == "vs " || command.substr(0, 7) == "vsplit ") {
+        // A filename opens that file in the new window
+        size_t space = command.find(' ');
+        std::string filename;
+        if (space != std::string::npos) {
+            size_t start = command.find_first_not_of(" \t", space);
+            size_t end = command.find_last_not_of(" \t");
+            if (start != std::string::npos) {
+                filename = command.substr(start, end - start + 1);
+            }
+        }
+        if (splitWindow(command[0] == 'v') && !filename.empty()) {
+            openFile(filename);
         }
+    } else if (command == "clo" || command == "close") {
+        closeWindow();
+    } else if (command == "on" || command == "only") {
+        onlyWindow();
     } else if (command.substr(0, 2) == "w ") {
         saveFile(command.substr(2));
     } else if (command == "e" || command == "edit") {
@@ -854,7 +1098,20 @@ void Editor::executeCommand(const std::string& command) {
         if (m_buffer->getFilename().empty()) {
             setErrorMessage("No filename to reload");
         } else {
-            openFile(m_buffer->getFilename());
+            openFile(m_buffer->getFilename(), m_buffer->isReadonly());
+        }
+    } else if (command == "view" || command.substr(0, 5) == "view ") {
+        // Without a filename the current file is viewed again, read-only
+        std::string filename = m_buffer->getFilename();
+        size_t start = command.find_first_not_of(" \t", 4);
+        size_t end = command.find_last_not_of(" \t");
+        if (start != std::string::npos) {
+            filename = command.substr(start, end - start + 1);
+        }
+        if (filename.empty()) {
+            setErrorMessage("No filename specified");
+        } else {
+            openFile(filename, true);
         }
     } else if (command.substr(0, 2) == "e ") {
         std::string filename = command.substr(2);
@@ -933,13 +1190,78 @@ void Editor::executeCommand(const std::string& command) {
                 setErrorMessage("Invalid buffer number: " + buffer_num_str + ". Use :ls to see all buffers.");
             }
         }
+    } else if (command == "noh" || command == "nohlsearch") {
+        m_highlight_search = false;
+    } else if (command.substr(0, 4) == "set " || command.substr(0, 3) == "se ") {
+        setOption(command.substr(command.find(' ') + 1));
     } else if (command == "help" || command == "h") {
         showHelp();
+    } else if (command == "mem" || command == "memory") {
+        showMemoryUsage();
+    } else if (command.substr(0, 5) == "goto " || command.substr(0, 3) == "go ") {
+        // Jump to a byte offset in the file (1-based, like vi's :goto)
+        std::string offset_str = command.substr(command.find(' ') + 1);
+        size_t byte_number = 0;
+        if (parseNumber(offset_str, byte_number)) {
+            moveToByte(byte_number > 0 ? byte_number - 1 : 0);
+        } else {
+            setErrorMessage("Invalid byte offset: " + offset_str);
+        }
+    } else if (isDigit(command)) {
+        // :N jumps to line N
+        size_t line_number = 0;
+        if (parseNumber(command, line_number)) {
+            moveToLine(line_number > 0 ? line_number - 1 : 0);
+        } else {
+            setErrorMessage("Unknown command: " + command);
+        }
     } else {
         setErrorMessage("Unknown command: " + command);
     }
 }
 
+void Editor::showMemoryUsage() {
+    // Bookkeeping per line, on top of the text itself (which is either the
+    // mapped file or the piece table's add buffer)
+    size_t lines = m_buffer->getLineCount();
+    size_t index_bytes = m_buffer->getIndexMemory();
+    std::ostringstream message;
+    message << std::fixed << std::setprecision(1)
+            << lines << " lines | index " << index_bytes / 1024 << " KB ("
+            << static_cast<double>(index_bytes) / (lines > 0 ? lines : 1) << " bytes/line) | undo "
+            << m_buffer->getUndoMemory() / 1024 << " KB";
+    setStatusMessage(message.str());
+}
+
+void Editor::setOption(const std::string& option) {
+    // Options belong to the current window
+    size_t start = option.find_first_not_of(" \t");
+    size_t end = option.find_last_not_of(" \t");
+    std::string name = start == std::string::npos ? std::string() : option.substr(start, end - start + 1);
+    
+    if (name == "wrap") {
+        m_window->setWrapLines(true);
+    } else if (name == "nowrap") {
+        m_window->setWrapLines(false);
+    } else if (name == "number" || name == "nu") {
+        m_window->setShowLineNumbers(true);
+    } else if (name == "nonumber" || name == "nonu") {
+        m_window->setShowLineNumbers(false);
+    } else if (name == "relativenumber" || name == "rnu") {
+        m_window->setRelativeNumbers(true);
+    } else if (name == "norelativenumber" || name == "nornu") {
+        m_window->setRelativeNumbers(false);
+    } else if (name == "undofile" || name == "udf" || name == "noundofile" || name == "noudf") {
+        // Unlike the others this applies to every buffer
+        m_undo_file = name[0] != 'n';
+        for (size_t i = 0; i < m_buffers.size(); ++i) {
+            m_buffers[i]->setUndoFileEnabled(m_undo_file);
+        }
+    } else {
+        setErrorMessage("Unknown option: " + name);
+    }
+}
+
 void Editor::showHelp() {
     // Create a comprehensive help message
     std::string help_text = "SubZero Editor - Command Reference\n\n";
@@ -953,7 +1275,8 @@ void Editor::showHelp() {
     help_text += "  :wq, :x            - Save and quit\n";
     help_text += "  :e filename        - Edit file\n";
     help_text += "  :e!                - Reload current file (discard changes)\n";
-    help_text += "  :e! filename       - Force edit file (discard changes)\n\n";
+    help_text += "  :e! filename       - Force edit file (discard changes)\n";
+    help_text += "  :view [filename]   - View file (default: this one) read-only\n\n";
     
     help_text += "Buffer Management:\n";
     help_text += "  :ls, :buffers      - List all open buffers\n";
@@ -963,8 +1286,30 @@ void Editor::showHelp() {
     help_text += "  :bd, :bdelete      - Close current buffer\n";
     help_text += "  :bd!               - Force close buffer\n\n";
     
+    help_text += "Windows:\n";
+    help_text += "  :sp, :split [file] - Split window horizontally\n";
+    help_text += "  :vs, :vsplit [file]- Split window vertically\n";
+    help_text += "  :clo, :close       - Close window\n";
+    help_text += "  :on, :only         - Close all other windows\n";
+    help_text += "  Ctrl-W s/v         - Split horizontally/vertically\n";
+    help_text += "  Ctrl-W h/j/k/l     - Move to window left/below/above/right\n";
+    help_text += "  Ctrl-W w, Ctrl-W W - Next/previous window\n";
+    help_text += "  Ctrl-W c, Ctrl-W o - Close window/close others\n\n";
+    
+    help_text += "Navigation:\n";
+    help_text += "  :N                 - Go to line N\n";
+    help_text += "  :goto N, :go N     - Go to byte N of the file\n\n";
+    
+    help_text += "Options:\n";
+    help_text += "  :set wrap          - Wrap long lines\n";
+    help_text += "  :set nowrap        - Scroll long lines sideways\n";
+    help_text += "  :set nu, :set nonu - Show or hide line numbers\n";
+    help_text += "  :set rnu, :set nornu - Number lines from the cursor, or not\n";
+    help_text += "  :set udf, :set noudf - Keep undo history in a file, or not\n\n";
+    
     help_text += "Help:\n";
-    help_text += "  :help, :h          - Show this help\n\n";
+    help_text += "  :help, :h          - Show this help\n";
+    help_text += "  :mem, :memory      - Show memory used per line\n\n";
     
     help_text += "=== NORMAL MODE (default mode) ===\n";
     help_text += "Movement:\n";
@@ -988,7 +1333,8 @@ void Editor::showHelp() {
     help_text += "  dd                 - Delete line\n";
     help_text += "  yy                 - Copy line\n";
     help_text += "  p                  - Paste\n";
-    help_text += "  u                  - Undo\n\n";
+    help_text += "  u                  - Undo\n";
+    help_text += "  Ctrl-R             - Redo\n\n";
     
     help_text += "Search:\n";
     help_text += "  /pattern           - Search forward\n";
@@ -996,7 +1342,8 @@ void Editor::showHelp() {
     help_text += "  n                  - Next search result\n";
     help_text += "  N                  - Previous search result\n";
     help_text += "  *                  - Search word under cursor (forward)\n";
-    help_text += "  #                  - Search word under cursor (backward)\n\n";
+    help_text += "  #                  - Search word under cursor (backward)\n";
+    help_text += "  :noh               - Clear search highlighting\n\n";
     
     help_text += "Visual Mode:\n";
     help_text += "  v                  - Character visual mode\n";
@@ -1047,7 +1394,7 @@ void Editor::clearMessages() {
     if (!m_status_message.empty() || !m_error_message.empty()) {
         m_status_message.clear();
         m_error_message.clear();
-        m_dirty_display = true;
+        invalidate(INVALIDATE_STATUS);
     }
 }
 
@@ -1061,16 +1408,21 @@ void Editor::handleCommandSequence(const std::string& key) {
     m_command_sequence += key;
     
     // Check for complete commands
-    if (m_command_sequence == "gg") {
+    if (m_command_sequence.compare(0, 2, "^W") == 0) {
+        clearCommandSequence();
+        windowCommand(key);
+    } else if (m_command_sequence == "gg") {
         for (int i = 0; i < (m_repeat_count > 0 ? m_repeat_count : 1); ++i) {
             moveFirstLine();
         }
         m_repeat_count = 0;
         clearCommandSequence();
     } else if (m_command_sequence == "dd") {
+        m_buffer->beginUndoGroup();
         for (int i = 0; i < (m_repeat_count > 0 ? m_repeat_count : 1); ++i) {
             deleteLine();
         }
+        m_buffer->endUndoGroup();
         m_repeat_count = 0;
         clearCommandSequence();
     } else if (m_command_sequence == "yy") {
@@ -1085,15 +1437,19 @@ void Editor::handleCommandSequence(const std::string& key) {
             // Wait for next character
             return;
         } else if (key == "p") {
+            m_buffer->beginUndoGroup();
             for (int i = 0; i < (m_repeat_count > 0 ? m_repeat_count : 1); ++i) {
                 pasteAfter();
             }
+            m_buffer->endUndoGroup();
             m_repeat_count = 0;
             clearCommandSequence();
         } else if (key == "P") {
+            m_buffer->beginUndoGroup();
             for (int i = 0; i < (m_repeat_count > 0 ? m_repeat_count : 1); ++i) {
                 pasteBefore();
             }
+            m_buffer->endUndoGroup();
             m_repeat_count = 0;
             clearCommandSequence();
         } else {
@@ -1143,7 +1499,6 @@ void Editor::switchToBuffer(int buffer_index) {
             filename = "[No Name]";
         }
         setStatusMessage("Switched to buffer " + compat::to_string(buffer_index + 1) + ": " + filename);
-        m_dirty_display = true;
         
         // Force immediate screen clear and redraw when switching buffers
         render();
@@ -1189,6 +1544,7 @@ bool Editor::closeBuffer(int buffer_index) {
     }
     
     // Remove the buffer
+    shared_ptr<Buffer> closed = m_buffers[buffer_index];
     m_buffers.erase(m_buffers.begin() + buffer_index);
     
     // Adjust current buffer index
@@ -1202,9 +1558,9 @@ bool Editor::closeBuffer(int buffer_index) {
     // Switch to the new current buffer
     m_buffer = m_buffers[m_current_buffer_index];
     m_window->setBuffer(m_buffer);
+    replaceBufferInWindows(closed);
     
     setStatusMessage("Buffer closed. Now showing buffer " + compat::to_string(m_current_buffer_index + 1));
-    m_dirty_display = true;
     return true;
 }
 
@@ -1225,6 +1581,7 @@ bool Editor::forceCloseBuffer(int buffer_index) {
     }
     
     // Remove the buffer (no modification check)
+    shared_ptr<Buffer> closed = m_buffers[buffer_index];
     m_buffers.erase(m_buffers.begin() + buffer_index);
     
     // Adjust current buffer index
@@ -1238,12 +1595,119 @@ bool Editor::forceCloseBuffer(int buffer_index) {
     // Switch to the new current buffer
     m_buffer = m_buffers[m_current_buffer_index];
     m_window->setBuffer(m_buffer);
+    replaceBufferInWindows(closed);
     
     setStatusMessage("Buffer force closed. Now showing buffer " + compat::to_string(m_current_buffer_index + 1));
-    m_dirty_display = true;
     return true;
 }
 
+void Editor::replaceBufferInWindows(const shared_ptr<Buffer>& closed) {
+    // Other windows showing a closed buffer show the current one instead
+    const std::vector<shared_ptr<Window> >& windows = m_layout->getWindows();
+    for (size_t i = 0; i < windows.size(); ++i) {
+        if (windows[i]->getBuffer() == closed) {
+            windows[i]->setBuffer(m_buffer);
+            windows[i]->setSyntaxHighlighter(m_window->getSyntaxHighlighter());
+        }
+    }
+}
+
+// Window management methods
+bool Editor::splitWindow(bool vertical) {
+    // The new window shows the same part of the buffer and becomes active
+    shared_ptr<Window> window(new Window(m_terminal, m_buffer));
+    window->setSyntaxHighlighter(m_window->getSyntaxHighlighter());
+    window->copyView(*m_window);
+    if (!m_layout->split(m_window, window, vertical)) {
+        setErrorMessage("Not enough room to split");
+        return false;
+    }
+    
+    m_window->saveCursor();
+    m_window = window;
+    layoutWindows();
+    return true;
+}
+
+bool Editor::closeWindow() {
+    const std::vector<shared_ptr<Window> >& windows = m_layout->getWindows();
+    if (windows.size() <= 1) {
+        setErrorMessage("Cannot close last window");
+        return false;
+    }
+    
+    // The window before the closed one takes over, or the next if it
+    // was first
+    size_t index = 0;
+    while (index < windows.size() && windows[index] != m_window) {
+        ++index;
+    }
+    shared_ptr<Window> closed = m_window;
+    m_layout->remove(closed);
+    shared_ptr<Window> next = windows[index > 0 ? index - 1 : 0];
+    
+    m_window = next;
+    m_buffer = next->getBuffer();
+    next->restoreCursor();
+    for (size_t i = 0; i < m_buffers.size(); ++i) {
+        if (m_buffers[i] == m_buffer) {
+            m_current_buffer_index = static_cast<int>(i);
+        }
+    }
+    layoutWindows();
+    return true;
+}
+
+void Editor::onlyWindow() {
+    m_layout->keepOnly(m_window);
+    layoutWindows();
+}
+
+void Editor::focusWindow(shared_ptr<Window> window) {
+    if (!window || window == m_window) {
+        return;
+    }
+    
+    // Visual selections belong to the window they were made in
+    if (m_mode == VISUAL || m_mode == VISUAL_LINE) {
+        setMode(NORMAL);
+    }
+    
+    m_window->saveCursor();
+    m_window = window;
+    m_buffer = window->getBuffer();
+    window->restoreCursor();
+    for (size_t i = 0; i < m_buffers.size(); ++i) {
+        if (m_buffers[i] == m_buffer) {
+            m_current_buffer_index = static_cast<int>(i);
+        }
+    }
+    invalidate(INVALIDATE_STATUS);  // Title rows show which window is active
+}
+
+void Editor::windowCommand(const std::string& key) {
+    const std::vector<shared_ptr<Window> >& windows = m_layout->getWindows();
+    size_t index = 0;
+    while (index < windows.size() && windows[index] != m_window) {
+        ++index;
+    }
+    
+    Position cursor(m_window->getPosition().row + m_window->getScreenCursor().row,
+                    m_window->getPosition().col + m_window->getScreenCursor().col);
+    
+    if (key == "s" || key == "S") splitWindow(false);
+    else if (key == "v") splitWindow(true);
+    else if (key == "w") focusWindow(windows[(index + 1) % windows.size()]);
+    else if (key == "W") focusWindow(windows[(index + windows.size() - 1) % windows.size()]);
+    else if (key == "h") focusWindow(m_layout->findNeighbor(m_window, WINDOW_LEFT, cursor));
+    else if (key == "j") focusWindow(m_layout->findNeighbor(m_window, WINDOW_DOWN, cursor));
+    else if (key == "k") focusWindow(m_layout->findNeighbor(m_window, WINDOW_UP, cursor));
+    else if (key == "l") focusWindow(m_layout->findNeighbor(m_window, WINDOW_RIGHT, cursor));
+    else if (key == "c") closeWindow();
+    else if (key == "q") executeCommand("q");
+    else if (key == "o") onlyWindow();
+}
+
 void Editor::listBuffers() {
     // Create buffer list content
     std::string buffer_list_text = "Buffer List\n";
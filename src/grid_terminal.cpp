@@ -0,0 +1,189 @@
+#include "grid_terminal.h"
+
+namespace subzero {
+
+namespace {
+
+// A front cell that matches no glyph, for cells whose content is unknown
+const ScreenCell UNKNOWN_CELL(0);
+
+} // anonymous namespace
+
+GridTerminal::GridTerminal(shared_ptr<ITerminal> terminal)
+    : m_terminal(terminal)
+    , m_cursor(0, 0)
+{
+}
+
+void GridTerminal::invalidate() {
+    m_front.reset(m_back.getRows(), m_back.getCols(), UNKNOWN_CELL);
+}
+
+void GridTerminal::syncSize() {
+    TerminalSize size = m_terminal->getSize();
+    if (size.rows != m_back.getRows() || size.cols != m_back.getCols()) {
+        m_back.reset(size.rows, size.cols);
+        invalidate();
+    }
+}
+
+bool GridTerminal::initialize() {
+    bool ok = m_terminal->initialize();
+    syncSize();
+    invalidate();
+    return ok;
+}
+
+void GridTerminal::shutdown() {
+    m_terminal->shutdown();
+    invalidate();
+}
+
+bool GridTerminal::isInitialized() const {
+    return m_terminal->isInitialized();
+}
+
+TerminalSize GridTerminal::getSize() const {
+    return m_terminal->getSize();
+}
+
+void GridTerminal::clear() {
+    m_terminal->clear();
+    syncSize();
+    m_back.reset(m_back.getRows(), m_back.getCols());
+    m_front.reset(m_back.getRows(), m_back.getCols());
+}
+
+void GridTerminal::refresh() {
+    syncSize();
+    for (int row = 0; row < m_back.getRows(); ++row) {
+        flushRow(row);
+    }
+    m_terminal->setCursor(m_cursor);
+    m_terminal->refresh();
+}
+
+bool GridTerminal::scrollRegion(int top, int bottom, int lines) {
+    syncSize();
+    if (top < 0 || bottom >= m_back.getRows() || top > bottom) {
+        return false;
+    }
+
+    // The frame moves either way; the front only moves if the terminal
+    // scrolled, otherwise the next refresh sends the moved rows
+    m_back.scroll(top, bottom, lines);
+    if (m_terminal->scrollRegion(top, bottom, lines)) {
+        m_front.scroll(top, bottom, lines);
+    }
+    return true;
+}
+
+void GridTerminal::flushRow(int row) {
+    int cols = m_back.getCols();
+    int col = 0;
+    while (col < cols) {
+        if (m_back.at(row, col) == m_front.at(row, col)) {
+            ++col;
+            continue;
+        }
+
+        // Runs start and end on whole characters
+        if (col > 0 && m_back.at(row, col).glyph == ScreenCell::WIDE_TAIL) {
+            --col;
+        }
+        const ScreenCell& first = m_back.at(row, col);
+        int end = col + 1;
+        for (int scan = end; scan < cols && scan - end < MAX_GAP && m_back.at(row, scan).sameColors(first); ++scan) {
+            if (m_back.at(row, scan) != m_front.at(row, scan)) {
+                end = scan + 1;
+            }
+        }
+        if (end < cols && m_back.at(row, end).glyph == ScreenCell::WIDE_TAIL) {
+            ++end;
+        }
+        sendRun(row, col, end);
+        col = end;
+    }
+}
+
+void GridTerminal::sendRun(int row, int first, int end) {
+    std::string text;
+    text.reserve(end - first);
+    for (int col = first; col < end; ++col) {
+        const ScreenCell& cell = m_back.at(row, col);
+        cell.appendGlyph(text);
+        m_front.at(row, col) = cell;
+    }
+
+    const ScreenCell& cell = m_back.at(row, first);
+    if (cell.fg == ScreenCell::DEFAULT_COLOR) {
+        m_terminal->putString(text, Position(row, first));
+    } else {
+        m_terminal->putStringWithColor(text, Position(row, first),
+                                       static_cast<Color::Value>(cell.fg), static_cast<Color::Value>(cell.bg));
+    }
+}
+
+void GridTerminal::setCursor(const Position& pos) {
+    // Applied again after the next flush, which moves the terminal's cursor
+    m_cursor = pos;
+    m_terminal->setCursor(pos);
+}
+
+Position GridTerminal::getCursor() const {
+    return m_cursor;
+}
+
+void GridTerminal::showCursor(bool visible) {
+    m_terminal->showCursor(visible);
+}
+
+void GridTerminal::putChar(const std::string& utf8_char, const Position& pos) {
+    syncSize();
+    m_back.put(pos, utf8_char, ScreenCell::DEFAULT_COLOR, ScreenCell::DEFAULT_COLOR);
+}
+
+void GridTerminal::putString(const std::string& utf8_str, const Position& pos) {
+    syncSize();
+    m_back.put(pos, utf8_str, ScreenCell::DEFAULT_COLOR, ScreenCell::DEFAULT_COLOR);
+}
+
+void GridTerminal::putStringWithColor(const std::string& utf8_str, const Position& pos,
+                                      Color::Value fg, Color::Value bg) {
+    syncSize();
+    m_back.put(pos, utf8_str, static_cast<uint8_t>(fg), static_cast<uint8_t>(bg));
+}
+
+KeyPress GridTerminal::getKey() {
+    return m_terminal->getKey();
+}
+
+bool GridTerminal::hasInput() {
+    return m_terminal->hasInput();
+}
+
+void GridTerminal::setColors(Color::Value fg, Color::Value bg) {
+    m_terminal->setColors(fg, bg);
+}
+
+void GridTerminal::resetAttributes() {
+    m_terminal->resetAttributes();
+}
+
+void GridTerminal::enableRawMode() {
+    m_terminal->enableRawMode();
+}
+
+void GridTerminal::disableRawMode() {
+    m_terminal->disableRawMode();
+}
+
+bool GridTerminal::isRawMode() const {
+    return m_terminal->isRawMode();
+}
+
+std::string GridTerminal::getLastError() const {
+    return m_terminal->getLastError();
+}
+
+} // namespace subzero
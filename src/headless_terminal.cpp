@@ -0,0 +1,285 @@
+#include "headless_terminal.h"
+#include "utf8_utils.h"
+#include <cctype>
+#include <cstdlib>
+
+namespace subzero {
+
+namespace {
+
+std::string toLower(const std::string& text) {
+    std::string lower(text);
+    for (size_t i = 0; i < lower.size(); ++i) {
+        lower[i] = static_cast<char>(tolower(static_cast<unsigned char>(lower[i])));
+    }
+    return lower;
+}
+
+// A control byte as the terminal would hand it over
+KeyPress controlKey(unsigned char ch) {
+    if (ch == 27) return KeyPress(ESCAPE);
+    if (ch == 8 || ch == 127) return KeyPress(BACKSPACE);
+    if (ch == 9) return KeyPress(TAB);
+    if (ch == 10 || ch == 13) return KeyPress(ENTER);
+    if (ch >= 1 && ch <= 26) {
+        return KeyPress(static_cast<Key>(static_cast<int>(CTRL_A) + ch - 1));
+    }
+    return KeyPress(UNKNOWN);
+}
+
+} // anonymous namespace
+
+HeadlessTerminal::HeadlessTerminal(const TerminalSize& size)
+    : m_initialized(false)
+    , m_raw_mode(false)
+    , m_size(size)
+    , m_cursor(0, 0)
+    , m_cursor_visible(true)
+{
+}
+
+HeadlessTerminal::~HeadlessTerminal() {
+    shutdown();
+}
+
+bool HeadlessTerminal::parseKeyName(const std::string& name, KeyPress& key) {
+    std::string lower = toLower(name);
+    if (lower.size() == 3 && lower.compare(0, 2, "c-") == 0 && lower[2] >= 'a' && lower[2] <= 'z') {
+        key = KeyPress(static_cast<Key>(static_cast<int>(CTRL_A) + lower[2] - 'a'));
+        return true;
+    }
+    if (lower.size() >= 2 && lower[0] == 'f' && isdigit(static_cast<unsigned char>(lower[1]))) {
+        int number = atoi(lower.c_str() + 1);
+        if (number >= 1 && number <= 12 && lower.size() <= 3) {
+            key = KeyPress(static_cast<Key>(static_cast<int>(F1) + number - 1));
+            return true;
+        }
+        return false;
+    }
+
+    struct Name { const char* name; Key key; };
+    static const Name names[] = {
+        { "esc", ESCAPE }, { "cr", ENTER }, { "enter", ENTER }, { "return", ENTER },
+        { "bs", BACKSPACE }, { "tab", TAB }, { "del", DELETE }, { "delete", DELETE },
+        { "up", ARROW_UP }, { "down", ARROW_DOWN }, { "left", ARROW_LEFT }, { "right", ARROW_RIGHT },
+        { "home", HOME }, { "end", END }, { "pageup", PAGE_UP }, { "pagedown", PAGE_DOWN },
+        { NULL, UNKNOWN }
+    };
+    for (int i = 0; names[i].name != NULL; ++i) {
+        if (lower == names[i].name) {
+            key = KeyPress(names[i].key);
+            return true;
+        }
+    }
+    if (lower == "lt") {
+        key = KeyPress(std::string("<"));
+        return true;
+    }
+    if (lower == "space") {
+        key = KeyPress(std::string(" "));
+        return true;
+    }
+    return false;
+}
+
+bool HeadlessTerminal::addKeys(const std::string& script) {
+    std::deque<KeyPress> keys;
+    for (size_t i = 0; i < script.size(); ) {
+        unsigned char ch = static_cast<unsigned char>(script[i]);
+
+        // <Name>; a '<' that starts no name is just the character
+        if (ch == '<') {
+            size_t end = script.find('>', i + 1);
+            if (end != std::string::npos && end > i + 1) {
+                KeyPress key(UNKNOWN);
+                if (!parseKeyName(script.substr(i + 1, end - i - 1), key)) {
+                    m_last_error = "Unknown key name: " + script.substr(i, end + 1 - i);
+                    return false;
+                }
+                keys.push_back(key);
+                i = end + 1;
+                continue;
+            }
+        }
+
+        if (ch < 32 || ch == 127) {
+            keys.push_back(controlKey(ch));
+            ++i;
+            continue;
+        }
+
+        size_t length = utf8::charByteLength(script, i);
+        if (length == 0 || i + length > script.size()) {
+            length = 1;
+        }
+        keys.push_back(KeyPress(script.substr(i, length)));
+        i += length;
+    }
+    m_keys.insert(m_keys.end(), keys.begin(), keys.end());
+    return true;
+}
+
+void HeadlessTerminal::addKey(const KeyPress& key) {
+    m_keys.push_back(key);
+}
+
+void HeadlessTerminal::setSize(const TerminalSize& size) {
+    m_size = size;
+    if (m_initialized) {
+        m_screen.reset(size.rows, size.cols);
+    }
+}
+
+std::string HeadlessTerminal::getRowText(int row) const {
+    std::string text;
+    if (row < 0 || row >= m_screen.getRows()) {
+        return text;
+    }
+    for (int col = 0; col < m_screen.getCols(); ++col) {
+        m_screen.at(row, col).appendGlyph(text);
+    }
+    size_t end = text.find_last_not_of(' ');
+    text.erase(end == std::string::npos ? 0 : end + 1);
+    return text;
+}
+
+void HeadlessTerminal::writeReport(FILE* out) const {
+    for (int row = 0; row < m_screen.getRows(); ++row) {
+        fprintf(out, "%s\n", getRowText(row).c_str());
+    }
+    fprintf(out, "cursor %d,%d\n", m_cursor.row + 1, m_cursor.col + 1);
+    fprintf(out, "keys %lu, refreshes %lu, put calls %lu, bytes %lu, scrolls %lu, clears %lu\n",
+            static_cast<unsigned long>(m_stats.keys), static_cast<unsigned long>(m_stats.refreshes),
+            static_cast<unsigned long>(m_stats.put_calls), static_cast<unsigned long>(m_stats.bytes),
+            static_cast<unsigned long>(m_stats.scrolls), static_cast<unsigned long>(m_stats.clears));
+    if (m_stats.keys > 0) {
+        fprintf(out, "per key: %.1f put calls, %.1f bytes\n",
+                static_cast<double>(m_stats.put_calls) / m_stats.keys,
+                static_cast<double>(m_stats.bytes) / m_stats.keys);
+    }
+}
+
+bool HeadlessTerminal::initialize() {
+    if (m_initialized) {
+        return true;
+    }
+    if (!m_size.isValid()) {
+        m_last_error = "Invalid screen size";
+        return false;
+    }
+    m_screen.reset(m_size.rows, m_size.cols);
+    m_cursor = Position(0, 0);
+    m_initialized = true;
+    return true;
+}
+
+void HeadlessTerminal::shutdown() {
+    // The screen is kept, to be looked at afterwards
+    m_raw_mode = false;
+    m_initialized = false;
+}
+
+bool HeadlessTerminal::isInitialized() const {
+    return m_initialized;
+}
+
+TerminalSize HeadlessTerminal::getSize() const {
+    return m_initialized ? m_size : TerminalSize(0, 0);
+}
+
+void HeadlessTerminal::clear() {
+    if (!m_initialized) return;
+    ++m_stats.clears;
+    m_screen.reset(m_size.rows, m_size.cols);
+}
+
+void HeadlessTerminal::refresh() {
+    if (!m_initialized) return;
+    ++m_stats.refreshes;
+}
+
+bool HeadlessTerminal::scrollRegion(int top, int bottom, int lines) {
+    if (!m_initialized || top < 0 || bottom >= m_size.rows || top > bottom) {
+        return false;
+    }
+    ++m_stats.scrolls;
+    m_screen.scroll(top, bottom, lines);
+    return true;
+}
+
+void HeadlessTerminal::setCursor(const Position& pos) {
+    m_cursor = pos;
+}
+
+Position HeadlessTerminal::getCursor() const {
+    return m_cursor;
+}
+
+void HeadlessTerminal::showCursor(bool visible) {
+    m_cursor_visible = visible;
+}
+
+void HeadlessTerminal::putChar(const std::string& utf8_char, const Position& pos) {
+    putText(utf8_char, pos, ScreenCell::DEFAULT_COLOR, ScreenCell::DEFAULT_COLOR);
+}
+
+void HeadlessTerminal::putString(const std::string& utf8_str, const Position& pos) {
+    putText(utf8_str, pos, ScreenCell::DEFAULT_COLOR, ScreenCell::DEFAULT_COLOR);
+}
+
+void HeadlessTerminal::putStringWithColor(const std::string& utf8_str, const Position& pos,
+                                          Color::Value fg, Color::Value bg) {
+    putText(utf8_str, pos, static_cast<uint8_t>(fg), static_cast<uint8_t>(bg));
+}
+
+void HeadlessTerminal::putText(const std::string& text, const Position& pos, uint8_t fg, uint8_t bg) {
+    if (!m_initialized) return;
+    ++m_stats.put_calls;
+    m_stats.bytes += text.size();
+    m_screen.put(pos, text, fg, bg);
+}
+
+KeyPress HeadlessTerminal::getKey() {
+    if (!m_initialized) return KeyPress(UNKNOWN);
+
+    // Nothing more will be typed: end the session
+    if (m_keys.empty()) {
+        shutdown();
+        return KeyPress(UNKNOWN);
+    }
+    KeyPress key = m_keys.front();
+    m_keys.pop_front();
+    ++m_stats.keys;
+    return key;
+}
+
+bool HeadlessTerminal::hasInput() {
+    // Each key is typed after the last one was drawn, never queued up
+    return false;
+}
+
+void HeadlessTerminal::setColors(Color::Value /*fg*/, Color::Value /*bg*/) {
+    // Only colors given with the text are recorded
+}
+
+void HeadlessTerminal::resetAttributes() {
+}
+
+void HeadlessTerminal::enableRawMode() {
+    if (!m_initialized) return;
+    m_raw_mode = true;
+}
+
+void HeadlessTerminal::disableRawMode() {
+    m_raw_mode = false;
+}
+
+bool HeadlessTerminal::isRawMode() const {
+    return m_raw_mode;
+}
+
+std::string HeadlessTerminal::getLastError() const {
+    return m_last_error;
+}
+
+} // namespace subzero
@@ -0,0 +1,836 @@
+#include "line_index.h"
+#include "cpu_features.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef SUBZERO_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace subzero {
+
+namespace {
+
+// Turns line breaks into line records. The scanners below only differ in
+// how they find breaks and count characters; this does the bookkeeping.
+// Characters are counted as bytes that do not continue a UTF-8 sequence.
+struct LineEmitter {
+    std::vector<LineInfo>& out;
+    LineScanStats& stats;
+    const char* line_start;
+    size_t chars;   // Characters between line_start and the scan position
+
+    LineEmitter(std::vector<LineInfo>& o, LineScanStats& s, const char* start)
+        : out(o), stats(s), line_start(start), chars(0) {}
+
+    void lineBreak(const char* nl) {
+        size_t bytes = nl - line_start;
+        size_t line_chars = chars;
+        uint8_t eol = 1;
+        if (bytes > 0 && nl[-1] == '\r') {
+            --bytes;
+            --line_chars;
+            eol = 2;
+            stats.crlf_lines++;
+        } else {
+            stats.lf_lines++;
+        }
+
+        out.push_back(LineInfo(bytes, line_chars, eol));
+        line_start = nl + 1;
+        chars = 0;
+    }
+
+#ifdef SUBZERO_X86_SIMD
+    // One SIMD block: bit i of nl is set for a '\n' at p[i], bit i of starts
+    // for a byte that starts a character
+    void block(const char* p, uint64_t nl, uint64_t starts) {
+        while (nl) {
+            unsigned bit = __builtin_ctzll(nl);
+            uint64_t through_break = (((uint64_t(1) << bit) - 1) << 1) | 1;
+            chars += __builtin_popcountll(starts & (through_break >> 1));
+            lineBreak(p + bit);
+            starts &= ~through_break;
+            nl &= nl - 1;
+        }
+        chars += __builtin_popcountll(starts);
+    }
+#endif
+};
+
+void scanScalar(const char* p, const char* end, LineEmitter& emitter) {
+    unsigned char high = 0;
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* stop = nl ? nl : end;
+        for (; p < stop; ++p) {
+            unsigned char byte = static_cast<unsigned char>(*p);
+            high |= byte;
+            if ((byte & 0xC0) != 0x80) {
+                emitter.chars++;
+            }
+        }
+        if (!nl) break;
+
+        emitter.lineBreak(nl);
+        p = nl + 1;
+    }
+
+    if (high & 0x80) {
+        emitter.stats.ascii = false;
+    }
+}
+
+#ifdef SUBZERO_X86_SIMD
+// Bytes 0x80-0xBF continue a character; as signed bytes they are below -64
+
+const char* scanSSE2(const char* p, const char* end, LineEmitter& emitter) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i continuation = _mm_set1_epi8(-64);
+    int high = 0;
+
+    for (; end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t nl = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+        uint32_t starts = ~_mm_movemask_epi8(_mm_cmplt_epi8(bytes, continuation)) & 0xFFFF;
+        high |= _mm_movemask_epi8(bytes);
+        emitter.block(p, nl, starts);
+    }
+
+    if (high) {
+        emitter.stats.ascii = false;
+    }
+    return p;
+}
+
+SUBZERO_TARGET_AVX2
+const char* scanAVX2(const char* p, const char* end, LineEmitter& emitter) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i continuation = _mm256_set1_epi8(-64);
+    int high = 0;
+
+    for (; end - p >= 32; p += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline));
+        uint32_t starts = ~_mm256_movemask_epi8(_mm256_cmpgt_epi8(continuation, bytes));
+        high |= _mm256_movemask_epi8(bytes);
+        emitter.block(p, nl, starts);
+    }
+
+    if (high) {
+        emitter.stats.ascii = false;
+    }
+    return p;
+}
+#endif
+
+} // anonymous namespace
+
+void LineIndex::Block::recount() {
+    bytes = 0;
+    chars = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bytes += lines[i].totalBytes();
+        chars += lines[i].totalChars();
+    }
+}
+
+LineIndex::LineIndex()
+    : m_line_count(0)
+    , m_total_bytes(0)
+    , m_total_chars(0)
+    , m_tree_valid(false)
+    , m_tree_rebuilds(0)
+    , m_sparse_text(NULL)
+    , m_span_clock(0)
+{
+}
+
+LineIndex::~LineIndex() {
+    clear();
+}
+
+void LineIndex::clear() {
+    // Blocks live in the slabs, so this is a handful of deletes however
+    // many lines there were
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        delete[] m_slabs[i].blocks;
+    }
+    m_slabs.clear();
+    m_free_blocks.clear();
+    m_blocks.clear();
+    m_line_count = 0;
+    m_total_bytes = 0;
+    m_total_chars = 0;
+    m_tree_valid = false;
+
+    m_sparse_text = NULL;
+    m_span_lines.clear();
+    m_span_bytes.clear();
+    m_span_chars.clear();
+    m_span_cache.clear();
+}
+
+void LineIndex::clearSparse(const char* text) {
+    clear();
+    m_sparse_text = text;
+    m_span_lines.assign(1, 0);
+    m_span_bytes.assign(1, 0);
+    m_span_chars.assign(1, 0);
+}
+
+const LineInfo& LineIndex::getLine(size_t line) const {
+    static const LineInfo empty_line;
+    if (line >= m_line_count) {
+        return empty_line;
+    }
+    if (m_sparse_text) {
+        size_t span = findSpan(m_span_lines, line);
+        return loadSpan(span).lines[line - m_span_lines[span]];
+    }
+
+    size_t lines_before = 0;
+    size_t block = findBlockByLine(line, lines_before);
+    return m_blocks[block]->lines[line - lines_before];
+}
+
+size_t LineIndex::getLineOffset(size_t line) const {
+    if (line >= m_line_count) {
+        return m_total_bytes;
+    }
+    if (m_sparse_text) {
+        size_t span = findSpan(m_span_lines, line);
+        return m_span_bytes[span] + loadSpan(span).bytes[line - m_span_lines[span]];
+    }
+
+    size_t lines_before = 0;
+    size_t block = findBlockByLine(line, lines_before);
+    size_t offset = prefixSum(m_tree_bytes, block);
+
+    const LineInfo* lines = m_blocks[block]->lines;
+    for (size_t i = 0; i < line - lines_before; ++i) {
+        offset += lines[i].totalBytes();
+    }
+    return offset;
+}
+
+size_t LineIndex::getLineCharOffset(size_t line) const {
+    if (line >= m_line_count) {
+        return m_total_chars;
+    }
+    if (m_sparse_text) {
+        size_t span = findSpan(m_span_lines, line);
+        return m_span_chars[span] + loadSpan(span).chars[line - m_span_lines[span]];
+    }
+
+    size_t lines_before = 0;
+    size_t block = findBlockByLine(line, lines_before);
+    size_t offset = prefixSum(m_tree_chars, block);
+
+    const LineInfo* lines = m_blocks[block]->lines;
+    for (size_t i = 0; i < line - lines_before; ++i) {
+        offset += lines[i].totalChars();
+    }
+    return offset;
+}
+
+size_t LineIndex::findLineByOffset(size_t byte_offset) const {
+    if (m_line_count == 0) {
+        return 0;
+    }
+    if (byte_offset >= m_total_bytes) {
+        return m_line_count - 1;
+    }
+    if (m_sparse_text) {
+        size_t span = findSpan(m_span_bytes, byte_offset);
+        const SpanLines& found = loadSpan(span);
+        return m_span_lines[span] + findSpan(found.bytes, byte_offset - m_span_bytes[span]);
+    }
+
+    ensureTree();
+    size_t bytes_before = 0;
+    size_t block = findBlock(m_tree_bytes, byte_offset, bytes_before);
+    size_t line = prefixSum(m_tree_lines, block);
+
+    // Offsets inside a line ending belong to the line they terminate
+    size_t remaining = byte_offset - bytes_before;
+    const Block& found = *m_blocks[block];
+    for (size_t i = 0; i < found.count; ++i) {
+        if (remaining < found.lines[i].totalBytes()) {
+            return line + i;
+        }
+        remaining -= found.lines[i].totalBytes();
+    }
+    return std::min(line + found.count, m_line_count - 1);
+}
+
+size_t LineIndex::findLineByCharOffset(size_t char_offset) const {
+    if (m_line_count == 0) {
+        return 0;
+    }
+    if (char_offset >= m_total_chars) {
+        return m_line_count - 1;
+    }
+    if (m_sparse_text) {
+        size_t span = findSpan(m_span_chars, char_offset);
+        const SpanLines& found = loadSpan(span);
+        return m_span_lines[span] + findSpan(found.chars, char_offset - m_span_chars[span]);
+    }
+
+    ensureTree();
+    size_t chars_before = 0;
+    size_t block = findBlock(m_tree_chars, char_offset, chars_before);
+    size_t line = prefixSum(m_tree_lines, block);
+
+    size_t remaining = char_offset - chars_before;
+    const Block& found = *m_blocks[block];
+    for (size_t i = 0; i < found.count; ++i) {
+        if (remaining < found.lines[i].totalChars()) {
+            return line + i;
+        }
+        remaining -= found.lines[i].totalChars();
+    }
+    return std::min(line + found.count, m_line_count - 1);
+}
+
+void LineIndex::append(const LineInfo& info) {
+    if (m_sparse_text) {
+        appendSpan(&info, 1);
+        return;
+    }
+
+    if (m_blocks.empty() || m_blocks.back()->count >= BLOCK_SIZE) {
+        m_blocks.push_back(allocateBlock());
+        m_tree_valid = false;
+    }
+
+    Block& block = *m_blocks.back();
+    block.lines[block.count++] = info;
+    block.bytes += info.totalBytes();
+    block.chars += info.totalChars();
+
+    m_line_count++;
+    m_total_bytes += info.totalBytes();
+    m_total_chars += info.totalChars();
+
+    if (m_tree_valid) {
+        updateTree(m_blocks.size() - 1, 1, info.totalBytes(), info.totalChars());
+    }
+}
+
+void LineIndex::append(const std::vector<LineInfo>& lines) {
+    if (m_sparse_text) {
+        if (!lines.empty()) {
+            appendSpan(&lines[0], lines.size());
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < lines.size(); ++i) {
+        append(lines[i]);
+    }
+}
+
+void LineIndex::replace(size_t first, size_t count, const std::vector<LineInfo>& lines) {
+    if (m_sparse_text || (count == 0 && lines.empty())) {
+        return;
+    }
+    first = std::min(first, m_line_count);
+    count = std::min(count, m_line_count - first);
+
+    if (m_blocks.empty()) {
+        append(lines);
+        return;
+    }
+
+    // Locate the block holding the first affected line
+    size_t block_index = m_blocks.size() - 1;
+    size_t lines_before = m_line_count - m_blocks.back()->count;
+    if (first < m_line_count) {
+        block_index = findBlockByLine(first, lines_before);
+    }
+    size_t local = first - lines_before;
+
+    size_t added_bytes = 0;
+    size_t added_chars = 0;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        added_bytes += lines[i].totalBytes();
+        added_chars += lines[i].totalChars();
+    }
+
+    Block& block = *m_blocks[block_index];
+    if (local + count <= block.count && block.count - count + lines.size() <= MAX_BLOCK_SIZE) {
+        // Common case: the edit stays inside one block and fits in it
+        size_t old_bytes = block.bytes;
+        size_t old_chars = block.chars;
+        size_t new_count = block.count - count + lines.size();
+
+        if (lines.size() > count) {
+            std::copy_backward(block.lines + local + count, block.lines + block.count, block.lines + new_count);
+        } else if (lines.size() < count) {
+            std::copy(block.lines + local + count, block.lines + block.count, block.lines + local + lines.size());
+        }
+        std::copy(lines.begin(), lines.end(), block.lines + local);
+        block.count = new_count;
+        block.recount();
+
+        m_line_count = m_line_count - count + lines.size();
+        m_total_bytes = m_total_bytes - old_bytes + block.bytes;
+        m_total_chars = m_total_chars - old_chars + block.chars;
+
+        if (block.count == 0) {
+            removeEmptyBlocks(block_index, block_index + 1);
+        } else {
+            if (m_tree_valid) {
+                updateTree(block_index, lines.size() - count, block.bytes - old_bytes, block.chars - old_chars);
+            }
+            mergeSmallBlock(block_index);
+        }
+        return;
+    }
+
+    // The removed range spans several blocks, or the new lines overflow
+    size_t removed_bytes = 0;
+    size_t removed_chars = 0;
+    size_t remaining = count;
+    size_t current = block_index;
+    size_t position = local;
+    while (remaining > 0 && current < m_blocks.size()) {
+        Block& victim = *m_blocks[current];
+        size_t take = std::min(remaining, victim.count - position);
+        size_t old_bytes = victim.bytes;
+        size_t old_chars = victim.chars;
+
+        std::copy(victim.lines + position + take, victim.lines + victim.count, victim.lines + position);
+        victim.count -= take;
+        victim.recount();
+
+        removed_bytes += old_bytes - victim.bytes;
+        removed_chars += old_chars - victim.chars;
+        if (m_tree_valid) {
+            updateTree(current, 0 - take, victim.bytes - old_bytes, victim.chars - old_chars);
+        }
+        remaining -= take;
+        position = 0;
+        ++current;
+    }
+    current = std::max(current, block_index + 1);
+
+    // The tree follows the new lines while they fit in the block; if they
+    // don't, insertLines() adds blocks and the tree is rebuilt anyway
+    size_t block_count = m_blocks.size();
+    size_t old_bytes = block.bytes;
+    size_t old_chars = block.chars;
+    insertLines(block_index, local, lines.empty() ? NULL : &lines[0], lines.size());
+    current += m_blocks.size() - block_count;
+    if (m_tree_valid) {
+        updateTree(block_index, lines.size(), block.bytes - old_bytes, block.chars - old_chars);
+    }
+
+    m_line_count = m_line_count - count + lines.size();
+    m_total_bytes = m_total_bytes - removed_bytes + added_bytes;
+    m_total_chars = m_total_chars - removed_chars + added_chars;
+
+    removeEmptyBlocks(block_index, current);
+    if (!m_blocks.empty()) {
+        mergeSmallBlock(std::min(block_index, m_blocks.size() - 1));
+    }
+}
+
+size_t LineIndex::getMemoryUsage() const {
+    size_t span_lines = 0;
+    for (size_t i = 0; i < m_span_cache.size(); ++i) {
+        span_lines += m_span_cache[i].lines.capacity() * sizeof(LineInfo) +
+                      (m_span_cache[i].bytes.capacity() + m_span_cache[i].chars.capacity()) * sizeof(size_t);
+    }
+    size_t sparse = span_lines + m_span_cache.capacity() * sizeof(SpanLines) +
+                    (m_span_lines.capacity() + m_span_bytes.capacity() + m_span_chars.capacity()) * sizeof(size_t);
+
+    size_t slab_blocks = 0;
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        slab_blocks += m_slabs[i].capacity;
+    }
+    return sizeof(*this) + sparse + slab_blocks * sizeof(Block) +
+           m_slabs.capacity() * sizeof(Slab) +
+           (m_blocks.capacity() + m_free_blocks.capacity()) * sizeof(Block*) +
+           (m_tree_lines.capacity() + m_tree_bytes.capacity() + m_tree_chars.capacity()) * sizeof(size_t);
+}
+
+bool LineIndex::needsCompaction() const {
+    // Worth it once a good part of the slabs is unused, or once blocks are
+    // on average less than half full (some neighbours can then be merged)
+    size_t used = m_blocks.size();
+    size_t unused = m_free_blocks.size();
+    return (unused >= MAX_SLAB_BLOCKS && unused * 4 > used + unused) ||
+           (used > 2 && m_line_count * 2 < (used - 1) * BLOCK_SIZE);
+}
+
+void LineIndex::compact() {
+    mergeBlocks();
+    releaseSparseSlabs();
+}
+
+void LineIndex::appendSpan(const LineInfo* lines, size_t count) {
+    size_t bytes = 0;
+    size_t chars = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bytes += lines[i].totalBytes();
+        chars += lines[i].totalChars();
+    }
+
+    m_line_count += count;
+    m_total_bytes += bytes;
+    m_total_chars += chars;
+    m_span_lines.push_back(m_line_count);
+    m_span_bytes.push_back(m_total_bytes);
+    m_span_chars.push_back(m_total_chars);
+}
+
+const LineIndex::SpanLines& LineIndex::loadSpan(size_t span) const {
+    ++m_span_clock;
+    size_t oldest = 0;
+    for (size_t i = 0; i < m_span_cache.size(); ++i) {
+        if (m_span_cache[i].span == span) {
+            m_span_cache[i].used = m_span_clock;
+            return m_span_cache[i];
+        }
+        if (m_span_cache[i].used < m_span_cache[oldest].used) {
+            oldest = i;
+        }
+    }
+
+    // Replace the least recently used span, so the lines of the last few
+    // spans looked up stay valid
+    if (m_span_cache.size() < SPAN_CACHE_SIZE) {
+        m_span_cache.push_back(SpanLines());
+        oldest = m_span_cache.size() - 1;
+    }
+    SpanLines& entry = m_span_cache[oldest];
+    entry.span = span;
+    entry.used = m_span_clock;
+
+    // Spans other than the last end with a line break, after which the scan
+    // reports an empty final line that is not part of the span
+    size_t count = m_span_lines[span + 1] - m_span_lines[span];
+    entry.lines.clear();
+    scanLines(m_sparse_text + m_span_bytes[span], m_span_bytes[span + 1] - m_span_bytes[span], true, entry.lines);
+    entry.lines.resize(count);
+
+    entry.bytes.assign(1, 0);
+    entry.chars.assign(1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        entry.bytes.push_back(entry.bytes.back() + entry.lines[i].totalBytes());
+        entry.chars.push_back(entry.chars.back() + entry.lines[i].totalChars());
+    }
+    return entry;
+}
+
+size_t LineIndex::findSpan(const std::vector<size_t>& sums, size_t value) {
+    // Last entry not above value; callers keep value below the final sum
+    return (std::upper_bound(sums.begin(), sums.end(), value) - sums.begin()) - 1;
+}
+
+LineIndex::Block* LineIndex::allocateBlock() {
+    if (m_free_blocks.empty()) {
+        // Slabs double in size up to a limit, so short files stay small
+        size_t capacity = m_slabs.empty() ? 1 : m_slabs.back().capacity * 2;
+        if (capacity > MAX_SLAB_BLOCKS) {
+            capacity = MAX_SLAB_BLOCKS;
+        }
+
+        Slab slab;
+        slab.blocks = new Block[capacity];
+        slab.capacity = capacity;
+        m_slabs.push_back(slab);
+        for (size_t i = capacity; i-- > 0; ) {
+            m_free_blocks.push_back(slab.blocks + i);
+        }
+    }
+
+    Block* block = m_free_blocks.back();
+    m_free_blocks.pop_back();
+    block->count = 0;
+    block->bytes = 0;
+    block->chars = 0;
+    return block;
+}
+
+void LineIndex::releaseBlock(Block* block) {
+    m_free_blocks.push_back(block);
+}
+
+void LineIndex::insertLines(size_t block_index, size_t local, const LineInfo* lines, size_t count) {
+    Block& block = *m_blocks[block_index];
+    if (block.count + count <= MAX_BLOCK_SIZE) {
+        std::copy_backward(block.lines + local, block.lines + block.count, block.lines + block.count + count);
+        std::copy(lines, lines + count, block.lines + local);
+        block.count += count;
+        block.recount();
+        return;
+    }
+
+    // The new lines and the rest of the block continue in new blocks
+    std::vector<LineInfo> moved(lines, lines + count);
+    moved.insert(moved.end(), block.lines + local, block.lines + block.count);
+    block.count = local;
+
+    std::vector<Block*> added;
+    Block* target = &block;
+    for (size_t i = 0; i < moved.size(); ++i) {
+        if (target->count >= BLOCK_SIZE) {
+            target = allocateBlock();
+            added.push_back(target);
+        }
+        target->lines[target->count++] = moved[i];
+    }
+
+    block.recount();
+    for (size_t i = 0; i < added.size(); ++i) {
+        added[i]->recount();
+    }
+    m_blocks.insert(m_blocks.begin() + block_index + 1, added.begin(), added.end());
+    m_tree_valid = false;
+}
+
+void LineIndex::removeEmptyBlocks(size_t first, size_t last) {
+    size_t kept = first;
+    for (size_t i = first; i < last; ++i) {
+        if (m_blocks[i]->count == 0) {
+            releaseBlock(m_blocks[i]);
+        } else {
+            m_blocks[kept++] = m_blocks[i];
+        }
+    }
+    if (kept < last) {
+        m_blocks.erase(m_blocks.begin() + kept, m_blocks.begin() + last);
+        m_tree_valid = false;
+    }
+}
+
+void LineIndex::mergeSmallBlock(size_t index) {
+    // A block that edits left with few lines joins a neighbour, so the
+    // next edits there stay inside one block instead of crossing into the
+    // next and changing the block list each time
+    if (m_blocks[index]->count >= MIN_BLOCK_SIZE) {
+        return;
+    }
+    size_t into = index;
+    if (index > 0 && m_blocks[index - 1]->count + m_blocks[index]->count <= BLOCK_SIZE) {
+        into = index - 1;
+    } else if (index + 1 < m_blocks.size() && m_blocks[index]->count + m_blocks[index + 1]->count <= BLOCK_SIZE) {
+        into = index;
+    } else {
+        return;
+    }
+
+    Block& target = *m_blocks[into];
+    Block* merged = m_blocks[into + 1];
+    std::copy(merged->lines, merged->lines + merged->count, target.lines + target.count);
+    target.count += merged->count;
+    target.bytes += merged->bytes;
+    target.chars += merged->chars;
+    releaseBlock(merged);
+    m_blocks.erase(m_blocks.begin() + into + 1);
+    m_tree_valid = false;
+}
+
+void LineIndex::mergeBlocks() {
+    // Fold each block into its predecessor when both fit in one
+    size_t kept = 0;
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        Block* block = m_blocks[i];
+        if (kept > 0 && m_blocks[kept - 1]->count + block->count <= BLOCK_SIZE) {
+            Block& target = *m_blocks[kept - 1];
+            std::copy(block->lines, block->lines + block->count, target.lines + target.count);
+            target.count += block->count;
+            target.bytes += block->bytes;
+            target.chars += block->chars;
+            releaseBlock(block);
+            m_tree_valid = false;
+        } else {
+            m_blocks[kept++] = block;
+        }
+    }
+    m_blocks.resize(kept);
+}
+
+void LineIndex::releaseSparseSlabs() {
+    // Count the blocks in use in each slab
+    std::vector<std::pair<Block*, size_t> > starts;   // Slab start -> slab number
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        starts.push_back(std::make_pair(m_slabs[i].blocks, i));
+    }
+    std::sort(starts.begin(), starts.end());
+
+    std::vector<size_t> used(m_slabs.size(), 0);
+    std::vector<size_t> home(m_blocks.size());
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        std::vector<std::pair<Block*, size_t> >::iterator it =
+            std::upper_bound(starts.begin(), starts.end(), std::make_pair(m_blocks[i], m_slabs.size()));
+        home[i] = (it - 1)->second;
+        used[home[i]]++;
+    }
+
+    // Keep the fullest slabs that together can hold every block
+    std::vector<std::pair<size_t, size_t> > order;       // Blocks in use -> slab number
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        order.push_back(std::make_pair(used[i], i));
+    }
+    std::sort(order.rbegin(), order.rend());
+
+    std::vector<bool> keep(m_slabs.size(), false);
+    size_t capacity = 0;
+    size_t kept_slabs = 0;
+    for (; kept_slabs < order.size() && capacity < m_blocks.size(); ++kept_slabs) {
+        keep[order[kept_slabs].second] = true;
+        capacity += m_slabs[order[kept_slabs].second].capacity;
+    }
+    if (kept_slabs == m_slabs.size()) {
+        return;
+    }
+
+    // Free slots in the kept slabs receive the blocks of the others
+    std::vector<std::vector<bool> > occupied(m_slabs.size());
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        if (keep[i]) {
+            occupied[i].assign(m_slabs[i].capacity, false);
+        }
+    }
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        if (keep[home[i]]) {
+            occupied[home[i]][m_blocks[i] - m_slabs[home[i]].blocks] = true;
+        }
+    }
+
+    std::vector<Block*> free_slots;
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        for (size_t j = 0; keep[i] && j < m_slabs[i].capacity; ++j) {
+            if (!occupied[i][j]) {
+                free_slots.push_back(m_slabs[i].blocks + j);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        if (!keep[home[i]]) {
+            Block* slot = free_slots.back();
+            free_slots.pop_back();
+            *slot = *m_blocks[i];
+            m_blocks[i] = slot;
+        }
+    }
+
+    std::vector<Slab> slabs;
+    for (size_t i = 0; i < m_slabs.size(); ++i) {
+        if (keep[i]) {
+            slabs.push_back(m_slabs[i]);
+        } else {
+            delete[] m_slabs[i].blocks;
+        }
+    }
+    m_slabs.swap(slabs);
+    m_free_blocks.swap(free_slots);
+}
+
+size_t LineIndex::countChars(const char* data, size_t length) {
+    size_t chars = 0;
+    for (size_t i = 0; i < length; ++i) {
+        if ((static_cast<uint8_t>(data[i]) & 0xC0) != 0x80) {
+            ++chars;
+        }
+    }
+    return chars;
+}
+
+void LineIndex::scanLines(const char* data, size_t length, bool final_line, std::vector<LineInfo>& out,
+                          LineScanStats* stats) {
+    LineScanStats local_stats;
+    LineEmitter emitter(out, stats ? *stats : local_stats, data);
+    const char* p = data;
+    const char* end = data + length;
+
+#ifdef SUBZERO_X86_SIMD
+    p = cpu::hasAVX2() ? scanAVX2(p, end, emitter) : scanSSE2(p, end, emitter);
+#endif
+    scanScalar(p, end, emitter);
+
+    if (final_line) {
+        out.push_back(LineInfo(end - emitter.line_start, emitter.chars, 0));
+    }
+}
+
+void LineIndex::ensureTree() const {
+    if (m_tree_valid) {
+        return;
+    }
+
+    // Linear-time Fenwick construction
+    size_t n = m_blocks.size();
+    m_tree_lines.assign(n + 1, 0);
+    m_tree_bytes.assign(n + 1, 0);
+    m_tree_chars.assign(n + 1, 0);
+
+    for (size_t i = 1; i <= n; ++i) {
+        const Block& block = *m_blocks[i - 1];
+        m_tree_lines[i] += block.count;
+        m_tree_bytes[i] += block.bytes;
+        m_tree_chars[i] += block.chars;
+
+        size_t parent = i + (i & (~i + 1));
+        if (parent <= n) {
+            m_tree_lines[parent] += m_tree_lines[i];
+            m_tree_bytes[parent] += m_tree_bytes[i];
+            m_tree_chars[parent] += m_tree_chars[i];
+        }
+    }
+
+    m_tree_valid = true;
+    ++m_tree_rebuilds;
+}
+
+void LineIndex::updateTree(size_t block, size_t lines_delta, size_t bytes_delta, size_t chars_delta) {
+    // Deltas may be "negative"; unsigned wrap-around keeps the sums exact
+    size_t n = m_tree_lines.size() - 1;
+    for (size_t i = block + 1; i <= n; i += (i & (~i + 1))) {
+        m_tree_lines[i] += lines_delta;
+        m_tree_bytes[i] += bytes_delta;
+        m_tree_chars[i] += chars_delta;
+    }
+}
+
+size_t LineIndex::prefixSum(const std::vector<size_t>& tree, size_t blocks) const {
+    ensureTree();
+    size_t sum = 0;
+    for (size_t i = blocks; i > 0; i -= (i & (~i + 1))) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+size_t LineIndex::findBlock(const std::vector<size_t>& tree, size_t value, size_t& before) const {
+    // Fenwick descent: the largest prefix of blocks whose total is <= value
+    size_t n = tree.size() - 1;
+    size_t position = 0;
+    before = 0;
+
+    size_t step = 1;
+    while (step * 2 <= n) {
+        step *= 2;
+    }
+
+    for (; step > 0; step >>= 1) {
+        if (position + step <= n && before + tree[position + step] <= value) {
+            position += step;
+            before += tree[position];
+        }
+    }
+
+    return position;
+}
+
+size_t LineIndex::findBlockByLine(size_t line, size_t& lines_before) const {
+    ensureTree();
+    return findBlock(m_tree_lines, line, lines_before);
+}
+
+} // namespace subzero
@@ -0,0 +1,195 @@
+#include "line_layout.h"
+#include "utf8_utils.h"
+#include <algorithm>
+
+namespace subzero {
+
+size_t LineColumns::columnOf(size_t ch) const {
+    if (ch >= chars) {
+        return width + (ch - chars);
+    }
+    return starts.empty() ? ch : starts[ch];
+}
+
+size_t LineColumns::charAt(size_t column) const {
+    if (column >= width) {
+        return chars + (column - width);
+    }
+    if (starts.empty()) {
+        return column;
+    }
+    // The last character starting at or before the column; combining marks
+    // start where the character after them does, so they come first
+    std::vector<uint32_t>::const_iterator it = std::upper_bound(starts.begin(), starts.begin() + chars,
+                                                                static_cast<uint32_t>(column));
+    return static_cast<size_t>(it - starts.begin()) - 1;
+}
+
+LineLayout::LineLayout()
+    : m_tab_width(4)
+    , m_wrap_width(0)
+    , m_first(0)
+{
+}
+
+void LineLayout::setTabWidth(size_t tab_width) {
+    if (tab_width != m_tab_width) {
+        m_tab_width = tab_width;
+        clear();
+    }
+}
+
+void LineLayout::setWrapWidth(size_t width) {
+    if (width != m_wrap_width) {
+        m_wrap_width = width;
+        for (std::deque<Entry>::iterator it = m_lines.begin(); it != m_lines.end(); ++it) {
+            it->row_starts.clear();
+        }
+    }
+}
+
+void LineLayout::clear() {
+    m_lines.clear();
+    m_first = 0;
+}
+
+LineLayout::Entry& LineLayout::getEntry(const Buffer& buffer, size_t line) {
+    // Grow the run to reach the line, or start a new one if it is far away
+    if (m_lines.empty() || line + MAX_LINES < m_first || line >= m_first + MAX_LINES) {
+        m_lines.clear();
+        m_first = line;
+    }
+    while (line < m_first) {
+        m_lines.push_front(Entry());
+        --m_first;
+    }
+    if (line >= m_first + m_lines.size()) {
+        m_lines.resize(line - m_first + 1);
+    }
+
+    // Drop lines from the far end once the run is too long
+    while (m_lines.size() > MAX_LINES) {
+        if (line - m_first < m_lines.size() / 2) {
+            m_lines.pop_back();
+        } else {
+            m_lines.pop_front();
+            ++m_first;
+        }
+    }
+
+    Entry& entry = m_lines[line - m_first];
+    if (!entry.measured) {
+        measureLine(buffer.getLine(line), entry.columns);
+        entry.measured = true;
+    }
+    return entry;
+}
+
+const LineColumns& LineLayout::getColumns(const Buffer& buffer, size_t line) {
+    return getEntry(buffer, line).columns;
+}
+
+const std::vector<size_t>& LineLayout::getRowStarts(const Buffer& buffer, size_t line) {
+    Entry& entry = getEntry(buffer, line);
+    if (entry.row_starts.empty()) {
+        breakLine(entry.columns, entry.row_starts);
+    }
+    return entry.row_starts;
+}
+
+size_t LineLayout::getRowOf(const Buffer& buffer, size_t line, size_t ch) {
+    const std::vector<size_t>& starts = getRowStarts(buffer, line);
+    size_t column = getEntry(buffer, line).columns.columnOf(ch);
+    return static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), column) - starts.begin()) - 1;
+}
+
+void LineLayout::linesChanged(const BufferChange& change) {
+    size_t end = m_first + m_lines.size();
+    if (change.first_line >= end) {
+        return;
+    }
+    if (change.first_line < m_first) {
+        // An edit reaching into the run from above is rare; start over
+        if (change.first_line + change.old_line_count > m_first) {
+            clear();
+        } else {
+            m_first = m_first - change.old_line_count + change.new_line_count;
+        }
+        return;
+    }
+
+    // The edited lines are laid out again when next asked for
+    size_t index = change.first_line - m_first;
+    size_t replaced = std::min(change.old_line_count, end - change.first_line);
+    m_lines.erase(m_lines.begin() + index, m_lines.begin() + index + replaced);
+    m_lines.insert(m_lines.begin() + index, change.new_line_count, Entry());
+}
+
+void LineLayout::measureLine(const std::string& text, LineColumns& columns) const {
+    columns = LineColumns();
+
+    // Most lines are printable ASCII, one column a character
+    size_t i = 0;
+    while (i < text.size() && text[i] >= 0x20 && text[i] < 0x7F) {
+        ++i;
+    }
+    if (i == text.size()) {
+        columns.chars = columns.width = text.size();
+        return;
+    }
+
+    // Counted as ScreenGrid draws the line, with tabs expanded: characters
+    // are counted as utf8::charToByte does, an invalid byte being one
+    size_t column = 0;
+    columns.starts.reserve(text.size() + 1);
+    for (i = 0; i < text.size(); ) {
+        columns.starts.push_back(static_cast<uint32_t>(column));
+        uint8_t byte = static_cast<uint8_t>(text[i]);
+        size_t length = utf8::charByteLength(text, i);
+        if (byte == '\t') {
+            column += m_tab_width - (column % m_tab_width);
+        } else if (byte < 0x20 || byte == 0x7F) {
+            column += 2;
+        } else if (length == 0 || i + length > text.size()) {
+            column += 1;
+        } else {
+            column += utf8::charWidth(text, i);
+        }
+        i += length > 0 ? length : 1;
+    }
+    columns.chars = columns.starts.size();
+    columns.width = column;
+    columns.starts.push_back(static_cast<uint32_t>(column));
+}
+
+void LineLayout::breakLine(const LineColumns& columns, std::vector<size_t>& starts) const {
+    starts.push_back(0);
+    if (m_wrap_width == 0) {
+        return;
+    }
+    if (columns.starts.empty()) {
+        for (size_t column = m_wrap_width; column < columns.width; column += m_wrap_width) {
+            starts.push_back(column);
+        }
+        return;
+    }
+
+    // A character that doesn't fit at the end of a row starts the next,
+    // so wide characters are never cut in two; tabs are wider and may be
+    size_t row_start = 0;
+    for (size_t ch = 0; ch < columns.chars; ++ch) {
+        size_t first = columns.starts[ch];
+        size_t end = columns.starts[ch + 1];
+        if (end - first > 2) {
+            while (end > row_start + m_wrap_width) {
+                row_start += m_wrap_width;
+                starts.push_back(row_start);
+            }
+        } else if (end > row_start + m_wrap_width && first > row_start) {
+            row_start = first;
+            starts.push_back(row_start);
+        }
+    }
+}
+
+} // namespace subzero
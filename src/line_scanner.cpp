@@ -0,0 +1,251 @@
+#include "line_scanner.h"
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#if defined(LINUX_PLATFORM) || defined(MACOS_PLATFORM)
+#include <pthread.h>
+#include <sys/time.h>
+#include <errno.h>
+#define SUBZERO_PTHREADS
+#elif defined(WINDOWS_PLATFORM)
+#include <windows.h>
+#define SUBZERO_WIN32_THREADS
+#endif
+
+namespace subzero {
+
+void LineScanner::scanChunk(const char* data, size_t begin, size_t end, size_t chunk_size, Chunk& chunk) {
+    size_t stop = std::min(end, begin + chunk_size);
+
+    // Only complete lines, extending the chunk to the next line break
+    if (stop < end) {
+        const char* nl = static_cast<const char*>(memchr(data + stop, '\n', end - stop));
+        stop = nl ? static_cast<size_t>(nl - data) + 1 : end;
+    }
+
+    chunk.lines.clear();
+    chunk.stats = LineScanStats();
+    chunk.end = stop;
+    chunk.last = (stop == end);
+    LineIndex::scanLines(data + begin, stop - begin, chunk.last, chunk.lines, &chunk.stats);
+}
+
+#if defined(SUBZERO_PTHREADS) || defined(SUBZERO_WIN32_THREADS)
+
+// Chunks the worker may run ahead of the reader; bounds the memory held in
+// scanned but not yet indexed lines
+static const size_t MAX_QUEUED_CHUNKS = 64;
+
+struct LineScanner::Worker {
+    const char* data;
+    size_t begin;
+    size_t end;
+    bool stopping;
+    std::deque<Chunk> queue;
+
+#ifdef SUBZERO_PTHREADS
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+
+    Worker() {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&changed, NULL);
+    }
+    ~Worker() {
+        pthread_cond_destroy(&changed);
+        pthread_mutex_destroy(&mutex);
+    }
+    void lock() { pthread_mutex_lock(&mutex); }
+    void unlock() { pthread_mutex_unlock(&mutex); }
+    void notify() { pthread_cond_broadcast(&changed); }
+
+    // Returns false when the wait timed out
+    bool wait(int wait_ms) {
+        if (wait_ms < 0) {
+            pthread_cond_wait(&changed, &mutex);
+            return true;
+        }
+
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long usec = now.tv_usec + static_cast<long>(wait_ms % 1000) * 1000;
+        struct timespec deadline;
+        deadline.tv_sec = now.tv_sec + wait_ms / 1000 + usec / 1000000;
+        deadline.tv_nsec = (usec % 1000000) * 1000;
+        return pthread_cond_timedwait(&changed, &mutex, &deadline) != ETIMEDOUT;
+    }
+
+    bool launch() { return pthread_create(&thread, NULL, &Worker::entry, this) == 0; }
+    void join() { pthread_join(thread, NULL); }
+    static void* entry(void* arg) {
+        static_cast<Worker*>(arg)->run();
+        return NULL;
+    }
+#else
+    HANDLE thread;
+    CRITICAL_SECTION mutex;
+    CONDITION_VARIABLE changed;
+
+    Worker() {
+        InitializeCriticalSection(&mutex);
+        InitializeConditionVariable(&changed);
+    }
+    ~Worker() { DeleteCriticalSection(&mutex); }
+    void lock() { EnterCriticalSection(&mutex); }
+    void unlock() { LeaveCriticalSection(&mutex); }
+    void notify() { WakeAllConditionVariable(&changed); }
+
+    bool wait(int wait_ms) {
+        DWORD timeout = wait_ms < 0 ? INFINITE : static_cast<DWORD>(wait_ms);
+        return SleepConditionVariableCS(&changed, &mutex, timeout) != 0;
+    }
+
+    bool launch() {
+        thread = CreateThread(NULL, 0, &Worker::entry, this, 0, NULL);
+        return thread != NULL;
+    }
+    void join() {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+    }
+    static DWORD WINAPI entry(LPVOID arg) {
+        static_cast<Worker*>(arg)->run();
+        return 0;
+    }
+#endif
+
+    void run() {
+        size_t position = begin;
+        for (;;) {
+            Chunk chunk;
+            scanChunk(data, position, end, CHUNK_SIZE, chunk);
+            position = chunk.end;
+
+            lock();
+            while (!stopping && queue.size() >= MAX_QUEUED_CHUNKS) {
+                wait(-1);
+            }
+            if (stopping) {
+                unlock();
+                return;
+            }
+            queue.push_back(Chunk());
+            queue.back().end = chunk.end;
+            queue.back().last = chunk.last;
+            queue.back().stats = chunk.stats;
+            queue.back().lines.swap(chunk.lines);
+            notify();
+            unlock();
+
+            if (chunk.last) {
+                return;
+            }
+        }
+    }
+};
+
+#else
+
+// No threads on this platform; chunks are scanned when they are taken
+struct LineScanner::Worker {};
+
+#endif
+
+LineScanner::LineScanner()
+    : m_data(NULL)
+    , m_end(0)
+    , m_next(0)
+    , m_active(false)
+    , m_worker(NULL)
+{
+}
+
+LineScanner::~LineScanner() {
+    stop();
+}
+
+void LineScanner::start(const char* data, size_t begin, size_t end) {
+    stop();
+    m_data = data;
+    m_next = begin;
+    m_end = end;
+    m_active = true;
+
+#if defined(SUBZERO_PTHREADS) || defined(SUBZERO_WIN32_THREADS)
+    // Small remainders are not worth a thread
+    if (end - begin <= CHUNK_SIZE) {
+        return;
+    }
+
+    Worker* worker = new Worker();
+    worker->data = data;
+    worker->begin = begin;
+    worker->end = end;
+    worker->stopping = false;
+    if (worker->launch()) {
+        m_worker = worker;
+    } else {
+        delete worker;
+    }
+#endif
+}
+
+void LineScanner::stop() {
+#if defined(SUBZERO_PTHREADS) || defined(SUBZERO_WIN32_THREADS)
+    if (m_worker) {
+        m_worker->lock();
+        m_worker->stopping = true;
+        m_worker->notify();
+        m_worker->unlock();
+        m_worker->join();
+        delete m_worker;
+        m_worker = NULL;
+    }
+#endif
+    m_active = false;
+}
+
+bool LineScanner::takeChunk(Chunk& chunk, int wait_ms) {
+    if (!m_active) {
+        return false;
+    }
+
+#if defined(SUBZERO_PTHREADS) || defined(SUBZERO_WIN32_THREADS)
+    if (m_worker) {
+        m_worker->lock();
+        while (m_worker->queue.empty()) {
+            if (wait_ms == 0 || !m_worker->wait(wait_ms)) {
+                if (m_worker->queue.empty()) {
+                    m_worker->unlock();
+                    return false;
+                }
+            }
+        }
+
+        Chunk& front = m_worker->queue.front();
+        chunk.end = front.end;
+        chunk.last = front.last;
+        chunk.stats = front.stats;
+        chunk.lines.swap(front.lines);
+        m_worker->queue.pop_front();
+        m_worker->notify();
+        m_worker->unlock();
+
+        m_next = chunk.end;
+        if (chunk.last) {
+            stop();
+        }
+        return true;
+    }
+#endif
+
+    (void)wait_ms;
+    scanChunk(m_data, m_next, m_end, CHUNK_SIZE, chunk);
+    m_next = chunk.end;
+    m_active = !chunk.last;
+    return true;
+}
+
+} // namespace subzero
@@ -56,11 +56,19 @@ int main(int argc, char* argv[]) {
         
         DEBUG_PRINT("Editor created successfully\n");
         
+        // -R opens the file read-only, for viewing
+        bool read_only = false;
+        int file_arg = 1;
+        if (argc > 1 && std::string(argv[1]) == "-R") {
+            read_only = true;
+            file_arg = 2;
+        }
+        
         // Open file if provided, otherwise create new file
-        if (argc > 1) {
-            DEBUG_PRINT("Opening file: %s\n", argv[1]);
-            if (!editor.openFile(argv[1])) {
-                DEBUG_PRINT("Warning: Could not open file: %s\n", argv[1]);
+        if (argc > file_arg) {
+            DEBUG_PRINT("Opening file: %s\n", argv[file_arg]);
+            if (!editor.openFile(argv[file_arg], read_only)) {
+                DEBUG_PRINT("Warning: Could not open file: %s\n", argv[file_arg]);
                 DEBUG_PRINT("Creating new file instead\n");
                 // Fall back to new file
                 editor.newFile();
@@ -78,6 +86,13 @@ int main(int argc, char* argv[]) {
         
         DEBUG_PRINT("Editor exited normally\n");
         
+        // A headless run reports the screen it ended on and what drawing it cost
+        HeadlessTerminal* headless = dynamic_cast<HeadlessTerminal*>(shared_terminal.get());
+        if (headless) {
+            headless->writeReport(stdout);
+            fflush(stdout);
+        }
+        
     } catch (const std::exception& e) {
         printf("EXCEPTION: %s\n", e.what());
         fflush(stdout);
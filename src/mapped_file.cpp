@@ -0,0 +1,177 @@
+#include "mapped_file.h"
+#include <fstream>
+
+#if defined(LINUX_PLATFORM) || defined(MACOS_PLATFORM)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SUBZERO_POSIX_MMAP
+#elif defined(WINDOWS_PLATFORM)
+#include <windows.h>
+#endif
+
+namespace subzero {
+
+MappedFile::MappedFile()
+    : m_data("")
+    , m_size(0)
+    , m_open(false)
+    , m_mapped(false)
+    , m_mtime(0)
+#if defined(SUBZERO_POSIX_MMAP)
+    , m_fd(-1)
+#elif defined(WINDOWS_PLATFORM)
+    , m_file_handle(INVALID_HANDLE_VALUE)
+    , m_mapping_handle(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+    close();
+    m_filename = filename;
+
+#if defined(SUBZERO_POSIX_MMAP)
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        m_last_error = "Cannot open " + filename;
+        return false;
+    }
+
+    // Pipes, devices and files such as those in /proc that report no
+    // size are read instead; so are small files, which mapping saves
+    // nothing on
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size < MIN_MAP_SIZE) {
+        ::close(fd);
+        return readWholeFile(filename);
+    }
+
+    // MAP_PRIVATE only protects against our own writes. If another program
+    // truncates the file, touching the lost pages raises SIGBUS, and if it
+    // rewrites the file in place, pages not read yet show the new text.
+    // The descriptor is kept so that hasChanged() can check for either
+    // before the text is relied on for saving.
+    m_size = static_cast<size_t>(info.st_size);
+    void* address = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+        ::close(fd);
+        m_size = 0;
+        return readWholeFile(filename);
+    }
+    m_data = static_cast<const char*>(address);
+    m_mapped = true;
+    m_fd = fd;
+    m_mtime = static_cast<uint64_t>(info.st_mtime);
+    m_open = true;
+    return true;
+#elif defined(WINDOWS_PLATFORM)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        m_last_error = "Cannot open " + filename;
+        return false;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return readWholeFile(filename);
+    }
+
+    FILETIME write_time;
+    if (file_size.QuadPart < MIN_MAP_SIZE || !GetFileTime(file, NULL, NULL, &write_time)) {
+        CloseHandle(file);
+        return readWholeFile(filename);
+    }
+
+    // Windows refuses to truncate a mapped file, but it can still be
+    // rewritten in place; hasChanged() looks at the write time
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const void* address = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!address) {
+        if (mapping) CloseHandle(mapping);
+        CloseHandle(file);
+        m_size = 0;
+        return readWholeFile(filename);
+    }
+    m_file_handle = file;
+    m_mapping_handle = mapping;
+    m_data = static_cast<const char*>(address);
+    m_mapped = true;
+    m_mtime = (static_cast<uint64_t>(write_time.dwHighDateTime) << 32) | write_time.dwLowDateTime;
+    m_open = true;
+    return true;
+#else
+    return readWholeFile(filename);
+#endif
+}
+
+void MappedFile::close() {
+    if (m_mapped) {
+#if defined(SUBZERO_POSIX_MMAP)
+        munmap(const_cast<char*>(m_data), m_size);
+        ::close(m_fd);
+        m_fd = -1;
+#elif defined(WINDOWS_PLATFORM)
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping_handle);
+        CloseHandle(m_file_handle);
+        m_file_handle = INVALID_HANDLE_VALUE;
+        m_mapping_handle = NULL;
+#endif
+    }
+
+    m_contents.clear();
+    m_data = "";
+    m_size = 0;
+    m_open = false;
+    m_mapped = false;
+    m_mtime = 0;
+}
+
+bool MappedFile::hasChanged() const {
+    if (!m_mapped) {
+        return false;
+    }
+#if defined(SUBZERO_POSIX_MMAP)
+    struct stat info;
+    return fstat(m_fd, &info) != 0 || static_cast<uint64_t>(info.st_size) != m_size ||
+           static_cast<uint64_t>(info.st_mtime) != m_mtime;
+#elif defined(WINDOWS_PLATFORM)
+    FILETIME write_time;
+    return !GetFileTime(m_file_handle, NULL, NULL, &write_time) ||
+           ((static_cast<uint64_t>(write_time.dwHighDateTime) << 32) | write_time.dwLowDateTime) != m_mtime;
+#else
+    return false;
+#endif
+}
+
+bool MappedFile::readWholeFile(const std::string& filename) {
+    std::ifstream file(filename.c_str(), std::ios::binary);
+    if (!file.is_open()) {
+        m_last_error = "Cannot open " + filename;
+        return false;
+    }
+
+    std::string contents;
+    char chunk[64 * 1024];
+    while (file.read(chunk, sizeof(chunk)) || file.gcount() > 0) {
+        contents.append(chunk, static_cast<size_t>(file.gcount()));
+    }
+
+    m_contents.swap(contents);
+    m_data = m_contents.data();
+    m_size = m_contents.size();
+    m_mapped = false;
+    m_open = true;
+    return true;
+}
+
+} // namespace subzero
@@ -113,6 +113,7 @@ bool NcursesTerminal::initialize() {
     noecho();           // Don't echo keys
     keypad(stdscr, TRUE); // Enable function keys
     nodelay(stdscr, FALSE); // Blocking input by default
+    idlok(stdscr, TRUE);    // Scroll with the terminal's scroll region or insert/delete line
     
     // Clear screen to remove any debug output from startup
     clear();
@@ -161,6 +162,19 @@ void NcursesTerminal::refresh() {
     ::refresh();
 }
 
+bool NcursesTerminal::scrollRegion(int top, int bottom, int lines) {
+    if (!m_initialized || top < 0 || bottom >= LINES || top > bottom) return false;
+    
+    // With idlok() set, refresh() sends this as a scroll or insert/delete
+    // line sequence rather than repainting the rows
+    setscrreg(top, bottom);
+    scrollok(stdscr, TRUE);
+    bool scrolled = (scrl(lines) == OK);
+    scrollok(stdscr, FALSE);
+    setscrreg(0, LINES - 1);
+    return scrolled;
+}
+
 void NcursesTerminal::setCursor(const Position& pos) {
     if (!m_initialized) return;
     move(pos.row, pos.col);
@@ -0,0 +1,346 @@
+#include "piece_table.h"
+#include <algorithm>
+#include <cstring>
+
+namespace subzero {
+
+namespace {
+
+// First occurrence of pattern in data: memchr finds candidates for the
+// first byte and the rest is compared
+const char* findBytes(const char* data, size_t length, const std::string& pattern) {
+    const char* end = data + (length - pattern.size() + 1);
+    for (const char* p = data; p < end; ++p) {
+        p = static_cast<const char*>(memchr(p, pattern[0], end - p));
+        if (!p) {
+            return NULL;
+        }
+        if (memcmp(p + 1, pattern.data() + 1, pattern.size() - 1) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Last occurrence of pattern in data, comparing from the end
+const char* findLastBytes(const char* data, size_t length, const std::string& pattern) {
+    for (const char* p = data + (length - pattern.size() + 1); p-- > data; ) {
+        if (*p == pattern[0] && memcmp(p + 1, pattern.data() + 1, pattern.size() - 1) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+} // anonymous namespace
+
+TextSnapshot::TextSnapshot()
+    : m_original(new std::string())
+    , m_original_data("")
+    , m_original_size(0)
+    , m_add(new std::string())
+    , m_add_data("")
+    , m_pieces(new std::vector<Piece>())
+    , m_size(0)
+{
+}
+
+void TextSnapshot::getPieceData(size_t index, const char*& data, size_t& length) const {
+    const Piece& piece = (*m_pieces)[index];
+    data = sourceData(piece.source) + piece.start;
+    length = piece.length;
+}
+
+char TextSnapshot::byteAt(size_t offset) const {
+    size_t piece_offset = 0;
+    size_t index = findPiece(offset, piece_offset);
+    if (index >= m_pieces->size()) {
+        return '\0';
+    }
+
+    const Piece& piece = (*m_pieces)[index];
+    return sourceData(piece.source)[piece.start + (offset - piece_offset)];
+}
+
+void TextSnapshot::read(size_t offset, size_t length, std::string& out) const {
+    out.clear();
+    if (offset >= m_size || length == 0) {
+        return;
+    }
+
+    size_t end = std::min(m_size, offset + length);
+    out.reserve(end - offset);
+
+    const std::vector<Piece>& pieces = *m_pieces;
+    size_t piece_offset = 0;
+    size_t index = findPiece(offset, piece_offset);
+    while (index < pieces.size() && piece_offset < end) {
+        const Piece& piece = pieces[index];
+        size_t from = std::max(offset, piece_offset);
+        size_t to = std::min(end, piece_offset + piece.length);
+        out.append(sourceData(piece.source) + piece.start + (from - piece_offset), to - from);
+        piece_offset += piece.length;
+        ++index;
+    }
+}
+
+std::string TextSnapshot::read(size_t offset, size_t length) const {
+    std::string out;
+    read(offset, length, out);
+    return out;
+}
+
+bool TextSnapshot::getSpan(size_t offset, size_t length, const char*& data) const {
+    if (length == 0) {
+        data = "";
+        return true;
+    }
+
+    size_t piece_offset = 0;
+    size_t index = findPiece(offset, piece_offset);
+    if (index >= m_pieces->size()) {
+        return false;
+    }
+
+    const Piece& piece = (*m_pieces)[index];
+    if (offset + length > piece_offset + piece.length) {
+        return false;
+    }
+
+    data = sourceData(piece.source) + piece.start + (offset - piece_offset);
+    return true;
+}
+
+bool TextSnapshot::find(const std::string& pattern, size_t from, size_t to, size_t& match) const {
+    if (pattern.empty() || pattern.size() > m_size) {
+        return false;
+    }
+    to = std::min(to, m_size - pattern.size() + 1);
+
+    // Windows overlap by the pattern length, so matches across them are
+    // found; a window within one piece is searched in place
+    const size_t window = 1024 * 1024;
+    std::string copy;
+    for (size_t pos = from; pos < to; pos += window) {
+        size_t length = std::min(window, to - pos) + pattern.size() - 1;
+        const char* data;
+        if (!getSpan(pos, length, data)) {
+            read(pos, length, copy);
+            data = copy.data();
+        }
+        const char* found = findBytes(data, length, pattern);
+        if (found) {
+            match = pos + (found - data);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TextSnapshot::findLast(const std::string& pattern, size_t from, size_t to, size_t& match) const {
+    if (pattern.empty() || pattern.size() > m_size) {
+        return false;
+    }
+    to = std::min(to, m_size - pattern.size() + 1);
+
+    // As find(), with the windows taken from the end back
+    const size_t window = 1024 * 1024;
+    std::string copy;
+    for (size_t end = to; end > from; ) {
+        size_t pos = end - std::min(window, end - from);
+        size_t length = (end - pos) + pattern.size() - 1;
+        const char* data;
+        if (!getSpan(pos, length, data)) {
+            read(pos, length, copy);
+            data = copy.data();
+        }
+        const char* found = findLastBytes(data, length, pattern);
+        if (found) {
+            match = pos + (found - data);
+            return true;
+        }
+        end = pos;
+    }
+    return false;
+}
+
+const char* TextSnapshot::sourceData(Source source) const {
+    return source == ORIGINAL ? m_original_data : m_add_data;
+}
+
+size_t TextSnapshot::findPiece(size_t offset, size_t& piece_offset) const {
+    const std::vector<Piece>& pieces = *m_pieces;
+    piece_offset = 0;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        if (offset < piece_offset + pieces[i].length) {
+            return i;
+        }
+        piece_offset += pieces[i].length;
+    }
+    return pieces.size();
+}
+
+PieceTable::PieceTable()
+    : m_pieces_shared(false)
+    , m_add_shared(false)
+{
+}
+
+void PieceTable::reset() {
+    std::string empty;
+    reset(empty);
+}
+
+void PieceTable::reset(std::string& original) {
+    // Snapshots may still hold the old storage, so it is replaced rather
+    // than cleared
+    m_mapping.reset();
+    m_original.reset(new std::string());
+    m_original->swap(original);
+    m_original_data = m_original->data();
+    m_original_size = m_original->size();
+
+    m_add.reset(new std::string());
+    m_add_data = m_add->data();
+    m_pieces.reset(new std::vector<Piece>());
+    m_pieces_shared = false;
+    m_add_shared = false;
+    m_size = m_original_size;
+    if (m_size > 0) {
+        m_pieces->push_back(Piece(ORIGINAL, 0, m_size));
+    }
+}
+
+void PieceTable::reset(shared_ptr<MappedFile> file) {
+    m_original.reset(new std::string());
+    m_mapping = file;
+    m_original_data = file->data();
+    m_original_size = file->size();
+
+    m_add.reset(new std::string());
+    m_add_data = m_add->data();
+    m_pieces.reset(new std::vector<Piece>());
+    m_pieces_shared = false;
+    m_add_shared = false;
+    m_size = m_original_size;
+    if (m_size > 0) {
+        m_pieces->push_back(Piece(ORIGINAL, 0, m_size));
+    }
+}
+
+void PieceTable::detach() {
+    if (!m_mapping) {
+        return;
+    }
+
+    m_original.reset(new std::string(m_original_data, m_original_size));
+    m_original_data = m_original->data();
+    m_mapping.reset();
+}
+
+TextSnapshot PieceTable::snapshot() const {
+    m_pieces_shared = true;
+    m_add_shared = true;
+    return *this;
+}
+
+void PieceTable::insert(size_t offset, const std::string& text) {
+    if (text.empty()) {
+        return;
+    }
+    offset = std::min(offset, m_size);
+
+    size_t add_start = appendAdd(text);
+    Piece piece(ADD, add_start, text.size());
+    m_size += piece.length;
+
+    std::vector<Piece>& pieces = editPieces();
+    size_t piece_offset = 0;
+    size_t index = findPiece(offset, piece_offset);
+
+    if (offset == piece_offset) {
+        // Typing extends the previous add piece instead of creating a new one
+        if (index > 0) {
+            Piece& prev = pieces[index - 1];
+            if (prev.source == ADD && prev.start + prev.length == add_start) {
+                prev.length += piece.length;
+                return;
+            }
+        }
+        pieces.insert(pieces.begin() + index, piece);
+        return;
+    }
+
+    // Split the piece that contains the insertion point
+    Piece original = pieces[index];
+    size_t left_length = offset - piece_offset;
+    Piece left(original.source, original.start, left_length);
+    Piece right(original.source, original.start + left_length, original.length - left_length);
+
+    pieces[index] = left;
+    Piece inserted[2] = { piece, right };
+    pieces.insert(pieces.begin() + index + 1, inserted, inserted + 2);
+}
+
+void PieceTable::erase(size_t offset, size_t length) {
+    if (offset >= m_size || length == 0) {
+        return;
+    }
+    length = std::min(length, m_size - offset);
+    size_t end = offset + length;
+
+    std::vector<Piece>& pieces = editPieces();
+    size_t piece_offset = 0;
+    size_t first = findPiece(offset, piece_offset);
+    size_t last = first;
+
+    // Keep the parts of the affected pieces that lie outside the range
+    std::vector<Piece> remaining;
+    while (last < pieces.size() && piece_offset < end) {
+        const Piece& piece = pieces[last];
+        size_t piece_end = piece_offset + piece.length;
+
+        if (piece_offset < offset) {
+            remaining.push_back(Piece(piece.source, piece.start, offset - piece_offset));
+        }
+        if (piece_end > end) {
+            remaining.push_back(Piece(piece.source, piece.start + (end - piece_offset), piece_end - end));
+        }
+
+        piece_offset = piece_end;
+        ++last;
+    }
+
+    pieces.erase(pieces.begin() + first, pieces.begin() + last);
+    pieces.insert(pieces.begin() + first, remaining.begin(), remaining.end());
+    m_size -= length;
+}
+
+std::vector<TextSnapshot::Piece>& PieceTable::editPieces() {
+    if (m_pieces_shared) {
+        m_pieces.reset(new std::vector<Piece>(*m_pieces));
+        m_pieces_shared = false;
+    }
+    return *m_pieces;
+}
+
+size_t PieceTable::appendAdd(const std::string& text) {
+    // Appending within capacity leaves the bytes a snapshot can see in
+    // place; growing a shared buffer moves to a new one and leaves the old
+    // one to the snapshots
+    std::string& add = *m_add;
+    size_t start = add.size();
+    if (m_add_shared && start + text.size() > add.capacity()) {
+        shared_ptr<std::string> grown(new std::string());
+        grown->reserve(std::max(add.capacity() * 2, start + text.size()));
+        grown->append(add);
+        m_add = grown;
+        m_add_shared = false;
+    }
+
+    m_add->append(text);
+    m_add_data = m_add->data();
+    return start;
+}
+
+} // namespace subzero
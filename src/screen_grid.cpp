@@ -0,0 +1,130 @@
+#include "screen_grid.h"
+#include "utf8_utils.h"
+#include <algorithm>
+
+namespace subzero {
+
+namespace {
+
+// U+FFFD, shown for bytes that are not valid UTF-8
+const uint32_t REPLACEMENT_GLYPH = 0xBDBFEF;
+
+} // anonymous namespace
+
+void ScreenCell::appendGlyph(std::string& out) const {
+    if (glyph == WIDE_TAIL) {
+        return;
+    }
+    for (uint32_t g = glyph; g != 0; g >>= 8) {
+        out += static_cast<char>(g & 0xFF);
+    }
+}
+
+ScreenGrid::ScreenGrid()
+    : m_rows(0)
+    , m_cols(0)
+{
+}
+
+void ScreenGrid::reset(int rows, int cols, const ScreenCell& fill) {
+    m_rows = rows > 0 ? rows : 0;
+    m_cols = cols > 0 ? cols : 0;
+    m_cells.assign(static_cast<size_t>(m_rows) * m_cols, fill);
+}
+
+void ScreenGrid::scroll(int top, int bottom, int lines, const ScreenCell& fill) {
+    if (top < 0 || bottom >= m_rows || top > bottom || lines == 0) {
+        return;
+    }
+
+    int height = bottom - top + 1;
+    int shift = std::min(lines < 0 ? -lines : lines, height);
+    std::vector<ScreenCell>::iterator first = m_cells.begin() + static_cast<size_t>(top) * m_cols;
+    std::vector<ScreenCell>::iterator last = first + static_cast<size_t>(height) * m_cols;
+    size_t offset = static_cast<size_t>(shift) * m_cols;
+    if (lines > 0) {
+        std::copy(first + offset, last, first);
+        std::fill(last - offset, last, fill);
+    } else {
+        std::copy_backward(first, last - offset, last);
+        std::fill(first, first + offset, fill);
+    }
+}
+
+int ScreenGrid::put(const Position& pos, const std::string& utf8, uint8_t fg, uint8_t bg) {
+    if (pos.row < 0 || pos.row >= m_rows || pos.col < 0) {
+        return 0;
+    }
+
+    int col = pos.col;
+    for (size_t i = 0; i < utf8.size() && col < m_cols; ) {
+        uint8_t byte = static_cast<uint8_t>(utf8[i]);
+
+        // Control characters take two cells in caret notation, as the
+        // terminal shows them
+        if (byte < 0x20 || byte == 0x7F) {
+            set(pos.row, col++, ScreenCell('^', fg, bg));
+            if (col < m_cols) {
+                set(pos.row, col++, ScreenCell(byte == 0x7F ? '?' : byte + '@', fg, bg));
+            }
+            ++i;
+            continue;
+        }
+
+        // An invalid byte takes one cell, like a character
+        size_t length = utf8::charByteLength(utf8, i);
+        if (length == 0 || i + length > utf8.size()) {
+            set(pos.row, col++, ScreenCell(REPLACEMENT_GLYPH, fg, bg));
+            ++i;
+            continue;
+        }
+
+        uint32_t glyph = 0;
+        for (size_t k = 0; k < length; ++k) {
+            glyph |= static_cast<uint32_t>(static_cast<uint8_t>(utf8[i + k])) << (8 * k);
+        }
+        int width = utf8::charWidth(utf8, i);
+        if (width == 0) {
+            // A combining mark joins the glyph before it while the bytes of
+            // both fit in a cell; otherwise it is dropped
+            int base = col - 1;
+            if (base >= 0 && at(pos.row, base).glyph == ScreenCell::WIDE_TAIL) {
+                --base;
+            }
+            if (base >= pos.col) {
+                ScreenCell& cell = at(pos.row, base);
+                int used = 0;
+                while (used < 4 && (cell.glyph >> (8 * used)) != 0) {
+                    ++used;
+                }
+                if (used + static_cast<int>(length) <= 4) {
+                    cell.glyph |= glyph << (8 * used);
+                }
+            }
+        } else if (width == 2) {
+            if (col + 1 < m_cols) {
+                set(pos.row, col++, ScreenCell(glyph, fg, bg));
+                set(pos.row, col++, ScreenCell(ScreenCell::WIDE_TAIL, fg, bg));
+            } else {
+                set(pos.row, col++, ScreenCell(' ', fg, bg));    // No room for both halves
+            }
+        } else {
+            set(pos.row, col++, ScreenCell(glyph, fg, bg));
+        }
+        i += length;
+    }
+    return col - pos.col;
+}
+
+void ScreenGrid::set(int row, int col, const ScreenCell& cell) {
+    ScreenCell& current = at(row, col);
+    if (current.glyph == ScreenCell::WIDE_TAIL && cell.glyph != ScreenCell::WIDE_TAIL && col > 0) {
+        at(row, col - 1).glyph = ' ';
+    }
+    if (col + 1 < m_cols && at(row, col + 1).glyph == ScreenCell::WIDE_TAIL) {
+        at(row, col + 1).glyph = ' ';
+    }
+    current = cell;
+}
+
+} // namespace subzero
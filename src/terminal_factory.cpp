@@ -1,6 +1,10 @@
 #include "terminal_factory.h"
+#include "headless_terminal.h"
+#include <cstdio>
+#include <cstdlib>
 
 #if defined(LINUX_PLATFORM) || defined(MINTOS_PLATFORM)
+#include "ansi_terminal.h"
 #include "ncurses_terminal.h"
 #elif defined(WINDOWS_PLATFORM)
 #include "win_console_terminal.h"
@@ -8,8 +12,63 @@
 
 namespace subzero {
 
+namespace {
+
+// SUBZERO_TERMINAL=headless runs without a tty, typing the keys in
+// SUBZERO_KEYS on a LINES x COLUMNS screen (24 x 80 by default)
+bool useHeadlessTerminal() {
+    const char* backend = getenv("SUBZERO_TERMINAL");
+    return backend && std::string(backend) == "headless";
+}
+
+std::unique_ptr<ITerminal> createHeadlessTerminal() {
+    TerminalSize size(24, 80);
+    const char* lines = getenv("LINES");
+    const char* columns = getenv("COLUMNS");
+    if (lines && columns && atoi(lines) > 0 && atoi(columns) > 0) {
+        size = TerminalSize(atoi(lines), atoi(columns));
+    }
+
+    HeadlessTerminal* terminal = new HeadlessTerminal(size);
+    const char* keys = getenv("SUBZERO_KEYS");
+    if (keys && !terminal->addKeys(keys)) {
+        fprintf(stderr, "SUBZERO_KEYS: %s\n", terminal->getLastError().c_str());
+        delete terminal;
+        return std::unique_ptr<ITerminal>();
+    }
+    return std::unique_ptr<ITerminal>(terminal);
+}
+
+#if defined(LINUX_PLATFORM) || defined(MINTOS_PLATFORM)
+// SUBZERO_TERMINAL=ansi or ncurses picks the backend. Otherwise Linux
+// drives VT compatible terminals itself and leaves the rest to ncurses,
+// as MiNTOS does for all of them (its TW100/VT52 consoles are not ANSI).
+bool useAnsiTerminal() {
+    const char* backend = getenv("SUBZERO_TERMINAL");
+    if (backend && std::string(backend) == "ansi") {
+        return true;
+    }
+    if (backend && std::string(backend) == "ncurses") {
+        return false;
+    }
+#ifdef LINUX_PLATFORM
+    return AnsiTerminal::isSupported();
+#else
+    return false;
+#endif
+}
+#endif
+
+} // anonymous namespace
+
 std::unique_ptr<ITerminal> TerminalFactory::create() {
+    if (useHeadlessTerminal()) {
+        return createHeadlessTerminal();
+    }
 #if defined(LINUX_PLATFORM) || defined(MINTOS_PLATFORM)
+    if (useAnsiTerminal()) {
+        return std::unique_ptr<ITerminal>(new AnsiTerminal());
+    }
     return std::unique_ptr<ITerminal>(new NcursesTerminal());
 #elif defined(WINDOWS_PLATFORM)
     return std::unique_ptr<ITerminal>(new WinConsoleTerminal());
@@ -20,10 +79,13 @@ std::unique_ptr<ITerminal> TerminalFactory::create() {
 }
 
 std::string TerminalFactory::getPlatformName() {
+    if (useHeadlessTerminal()) {
+        return "Headless";
+    }
 #ifdef LINUX_PLATFORM
-    return "Linux (ncurses)";
+    return useAnsiTerminal() ? "Linux (ANSI/VT)" : "Linux (ncurses)";
 #elif defined(MINTOS_PLATFORM)
-    return "Atari MiNTOS (ncurses)";
+    return useAnsiTerminal() ? "Atari MiNTOS (ANSI/VT)" : "Atari MiNTOS (ncurses)";
 #elif defined(WINDOWS_PLATFORM)
     return "Windows (Console API)";
 #else
@@ -31,4 +93,4 @@ std::string TerminalFactory::getPlatformName() {
 #endif
 }
 
-} // namespace subzero
\ No newline at end of file
+} // namespace subzero
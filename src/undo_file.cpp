@@ -0,0 +1,376 @@
+#include "undo_file.h"
+#include <cstring>
+#include <climits>
+
+#if defined(LINUX_PLATFORM) || defined(MACOS_PLATFORM)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SUBZERO_POSIX_FILES
+#endif
+
+namespace subzero {
+
+namespace {
+
+const char MAGIC[8] = { 'S', 'Z', 'U', 'N', 'D', 'O', '1', '\n' };
+const size_t HEADER_SIZE = 9;       // Record type and payload length
+
+// Numbers are stored little-endian whatever the host byte order
+void putNumber(std::string& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+uint64_t getNumber(const unsigned char* in) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+// Reads numbers and byte strings from a record payload, failing once the
+// payload is exhausted
+class PayloadReader {
+public:
+    PayloadReader(const std::string& payload) : m_data(payload), m_pos(0), m_ok(true) {}
+
+    uint64_t number() {
+        if (!m_ok || m_data.size() - m_pos < 8) {
+            m_ok = false;
+            return 0;
+        }
+        uint64_t value = getNumber(reinterpret_cast<const unsigned char*>(m_data.data() + m_pos));
+        m_pos += 8;
+        return value;
+    }
+
+    void bytes(uint64_t length, std::string& out) {
+        if (!m_ok || m_data.size() - m_pos < length) {
+            m_ok = false;
+            return;
+        }
+        out.assign(m_data, m_pos, static_cast<size_t>(length));
+        m_pos += static_cast<size_t>(length);
+    }
+
+    bool ok() const { return m_ok; }
+
+private:
+    const std::string& m_data;
+    size_t m_pos;
+    bool m_ok;
+};
+
+// Undo files can outgrow a 32-bit long, so offsets go through 64-bit seeks
+bool seekTo(FILE* file, uint64_t offset, int whence) {
+#if defined(SUBZERO_POSIX_FILES)
+    return fseeko(file, static_cast<off_t>(offset), whence) == 0;
+#elif defined(WINDOWS_PLATFORM)
+    return _fseeki64(file, static_cast<__int64>(offset), whence) == 0;
+#else
+    return offset <= static_cast<uint64_t>(LONG_MAX) && fseek(file, static_cast<long>(offset), whence) == 0;
+#endif
+}
+
+uint64_t tell(FILE* file) {
+#if defined(SUBZERO_POSIX_FILES)
+    return static_cast<uint64_t>(ftello(file));
+#elif defined(WINDOWS_PLATFORM)
+    return static_cast<uint64_t>(_ftelli64(file));
+#else
+    return static_cast<uint64_t>(ftell(file));
+#endif
+}
+
+bool readHeader(FILE* file, char& type, uint64_t& length) {
+    unsigned char header[HEADER_SIZE];
+    if (fread(header, 1, HEADER_SIZE, file) != HEADER_SIZE) {
+        return false;
+    }
+    type = static_cast<char>(header[0]);
+    length = getNumber(header + 1);
+    return true;
+}
+
+bool readPayload(FILE* file, uint64_t length, std::string& payload) {
+    if (length > payload.max_size()) {
+        return false;
+    }
+    payload.resize(static_cast<size_t>(length));
+    return length == 0 || fread(&payload[0], 1, payload.size(), file) == payload.size();
+}
+
+} // anonymous namespace
+
+ContentHash::ContentHash()
+    : m_hash(0xcbf29ce484222325ULL)
+    , m_length(0)
+    , m_tail_size(0)
+{
+}
+
+void ContentHash::mix(uint64_t word) {
+    m_hash ^= word * 0x9e3779b97f4a7c15ULL;
+    m_hash = ((m_hash << 27) | (m_hash >> 37)) * 0x100000001b3ULL;
+}
+
+void ContentHash::update(const char* data, size_t length) {
+    m_length += length;
+
+    // Complete a word left over from the previous call
+    while (m_tail_size > 0 && length > 0) {
+        m_tail[m_tail_size++] = static_cast<unsigned char>(*data++);
+        --length;
+        if (m_tail_size == 8) {
+            mix(getNumber(m_tail));
+            m_tail_size = 0;
+        }
+    }
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    while (length >= 8) {
+        mix(getNumber(bytes));
+        bytes += 8;
+        length -= 8;
+    }
+
+    memcpy(m_tail + m_tail_size, bytes, length);
+    m_tail_size += length;
+}
+
+uint64_t ContentHash::value() const {
+    uint64_t hash = m_hash;
+    for (size_t i = 0; i < m_tail_size; ++i) {
+        hash = (hash ^ m_tail[i]) * 0x100000001b3ULL;
+    }
+
+    // Final avalanche so that similar texts give unrelated hashes
+    hash ^= m_length;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+UndoFile::UndoFile()
+    : m_file(NULL)
+    , m_offset(0)
+{
+}
+
+UndoFile::~UndoFile() {
+    close();
+}
+
+std::string UndoFile::pathFor(const std::string& filename) {
+    size_t slash = filename.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? filename : filename.substr(slash + 1);
+    return directory + "." + name + ".sz-undo";
+}
+
+bool UndoFile::readIndex(const std::string& path, Index& index) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char magic[sizeof(MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        !seekTo(file, 0, SEEK_END)) {
+        fclose(file);
+        return false;
+    }
+    uint64_t file_size = tell(file);
+    seekTo(file, sizeof(MAGIC), SEEK_SET);
+
+    // Only headers are read; group payloads are skipped over. A record cut
+    // short by a crash ends the list, and only what the last save marker
+    // covered is used.
+    std::vector<uint64_t> groups;
+    uint64_t position = sizeof(MAGIC);
+    uint64_t committed_end = 0;
+    std::string payload;
+    char type;
+    uint64_t length;
+    while (readHeader(file, type, length) && length <= file_size - position - HEADER_SIZE) {
+        if (type == 'G') {
+            if (!seekTo(file, length, SEEK_CUR)) break;
+            groups.push_back(position);
+        } else if (type == 'T') {
+            if (!readPayload(file, length, payload)) break;
+            PayloadReader reader(payload);
+            uint64_t count = reader.number();
+            if (!reader.ok() || count > groups.size()) break;
+            groups.resize(static_cast<size_t>(count));
+        } else if (type == 'S') {
+            if (!readPayload(file, length, payload)) break;
+            PayloadReader reader(payload);
+            uint64_t count = reader.number();
+            uint64_t size = reader.number();
+            uint64_t hash = reader.number();
+            if (!reader.ok() || count > groups.size()) break;
+            index.groups = groups;
+            index.saved_count = count;
+            index.saved_size = size;
+            index.saved_hash = hash;
+            committed_end = position + HEADER_SIZE + length;
+        } else {
+            break;
+        }
+        position += HEADER_SIZE + length;
+    }
+
+    fclose(file);
+    index.clean = (committed_end == file_size);
+    return committed_end != 0;
+}
+
+bool UndoFile::readGroup(const std::string& path, uint64_t offset, std::vector<UndoEntry>& entries,
+                         size_t& cursor_line, size_t& cursor_column) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    char type;
+    uint64_t length;
+    std::string payload;
+    bool read = seekTo(file, offset, SEEK_SET) && readHeader(file, type, length) &&
+                type == 'G' && readPayload(file, length, payload);
+    fclose(file);
+    if (!read) {
+        return false;
+    }
+
+    PayloadReader reader(payload);
+    cursor_line = static_cast<size_t>(reader.number());
+    cursor_column = static_cast<size_t>(reader.number());
+    uint64_t count = reader.number();
+    entries.clear();
+    for (uint64_t i = 0; i < count && reader.ok(); ++i) {
+        UndoEntry entry;
+        entry.offset = static_cast<size_t>(reader.number());
+        uint64_t erased_length = reader.number();
+        uint64_t inserted_length = reader.number();
+        reader.bytes(erased_length, entry.erased);
+        reader.bytes(inserted_length, entry.inserted);
+        entries.push_back(entry);
+    }
+    return reader.ok() && !entries.empty();
+}
+
+bool UndoFile::open(const std::string& path, bool truncate, const std::string& source) {
+    close();
+
+#ifdef SUBZERO_POSIX_FILES
+    // The file holds text from the source, so no one may read it who
+    // cannot read the source. Permissions are set before anything is
+    // written, also on a file left by an older version.
+    struct stat info;
+    mode_t mode = stat(source.c_str(), &info) == 0 ? (info.st_mode & 0666) : 0600;
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND), 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (fchmod(fd, mode) != 0 || fstat(fd, &info) != 0 || !(m_file = fdopen(fd, truncate ? "wb" : "ab"))) {
+        ::close(fd);
+        return false;
+    }
+    m_offset = static_cast<uint64_t>(info.st_size);
+    if (truncate) {
+        if (fwrite(MAGIC, 1, sizeof(MAGIC), m_file) != sizeof(MAGIC)) {
+            close();
+            return false;
+        }
+        m_offset = sizeof(MAGIC);
+    }
+    return true;
+#else
+    (void)source;
+    if (truncate) {
+        m_file = fopen(path.c_str(), "wb");
+        if (!m_file || fwrite(MAGIC, 1, sizeof(MAGIC), m_file) != sizeof(MAGIC)) {
+            close();
+            return false;
+        }
+        m_offset = sizeof(MAGIC);
+        return true;
+    }
+
+    m_file = fopen(path.c_str(), "r+b");
+    if (!m_file || !seekTo(m_file, 0, SEEK_END)) {
+        close();
+        return false;
+    }
+    m_offset = tell(m_file);
+    return true;
+#endif
+}
+
+bool UndoFile::writeGroup(const std::vector<UndoEntry>& entries, size_t cursor_line, size_t cursor_column,
+                          uint64_t& offset) {
+    m_buffer.clear();
+    putNumber(m_buffer, cursor_line);
+    putNumber(m_buffer, cursor_column);
+    putNumber(m_buffer, entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const UndoEntry& entry = entries[i];
+        putNumber(m_buffer, entry.offset);
+        putNumber(m_buffer, entry.erased.size());
+        putNumber(m_buffer, entry.inserted.size());
+        m_buffer += entry.erased;
+        m_buffer += entry.inserted;
+    }
+
+    offset = m_offset;
+    return writeRecord('G');
+}
+
+bool UndoFile::writeTruncate(uint64_t count) {
+    m_buffer.clear();
+    putNumber(m_buffer, count);
+    return writeRecord('T');
+}
+
+bool UndoFile::writeSave(uint64_t count, uint64_t size, uint64_t hash) {
+    m_buffer.clear();
+    putNumber(m_buffer, count);
+    putNumber(m_buffer, size);
+    putNumber(m_buffer, hash);
+    return writeRecord('S');
+}
+
+bool UndoFile::writeRecord(char type) {
+    if (!m_file) {
+        return false;
+    }
+
+    std::string header(1, type);
+    putNumber(header, m_buffer.size());
+    if (fwrite(header.data(), 1, header.size(), m_file) != header.size() ||
+        fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+        return false;
+    }
+    m_offset += header.size() + m_buffer.size();
+    return true;
+}
+
+bool UndoFile::close() {
+    if (!m_file) {
+        return true;
+    }
+
+    bool ok = fflush(m_file) == 0;
+    ok = fclose(m_file) == 0 && ok;
+    m_file = NULL;
+    return ok;
+}
+
+} // namespace subzero
@@ -1,12 +1,180 @@
 #include "utf8_utils.h"
 #include "compat.h"
+#include "cpu_features.h"
+#include <algorithm>
+
+#ifdef SUBZERO_X86_SIMD
+#include <immintrin.h>
+#endif
 
 namespace subzero {
 namespace utf8 {
 
+namespace {
+
+// The SIMD kernels below skip over runs of well-formed characters 16 or
+// 32 bytes at a time. Anything they are unsure about (invalid bytes,
+// truncated sequences, block ends) is left to the scalar code, so every
+// function keeps exactly the behaviour of its byte-at-a-time loop.
+
+bool g_simd_enabled = true;
+
+#ifdef SUBZERO_X86_SIMD
+
+// Byte classes of one block as bitmasks, bit i describing byte i
+struct BlockMasks {
+    uint32_t high;           // 1xxxxxxx
+    uint32_t continuation;   // 10xxxxxx
+    uint32_t lead2;          // 110xxxxx
+    uint32_t lead3;          // 1110xxxx
+    uint32_t lead4;          // 11110xxx
+    uint32_t invalid;        // 11111xxx
+};
+
+// Consume the well-formed characters at the start of a block that starts
+// on a character boundary, at most `budget` of them. Returns the number
+// of bytes consumed; 0 means the scalar code has to take over.
+inline size_t consumeBlock(const BlockMasks& m, unsigned width, size_t& budget, size_t& chars) {
+    uint64_t block_mask = (uint64_t(1) << width) - 1;
+    uint64_t starts = ~uint64_t(m.continuation) & block_mask;
+    size_t valid = width;
+
+    if (m.high != 0) {
+        if (!(starts & 1)) {
+            return 0;
+        }
+
+        // A character running into the next block is left for the next step
+        uint64_t lead2 = m.lead2, lead3 = m.lead3, lead4 = m.lead4;
+        uint64_t expected = (lead2 << 1) | (lead3 << 1) | (lead3 << 2) | (lead4 << 1) | (lead4 << 2) | (lead4 << 3);
+        if (expected >> width) {
+            valid = 63 - __builtin_clzll(starts);
+            uint64_t valid_mask = (uint64_t(1) << valid) - 1;
+            lead2 &= valid_mask;
+            lead3 &= valid_mask;
+            lead4 &= valid_mask;
+            expected = (lead2 << 1) | (lead3 << 1) | (lead3 << 2) | (lead4 << 1) | (lead4 << 2) | (lead4 << 3);
+        }
+
+        // Continuation bytes must be exactly where the lead bytes want them
+        uint64_t valid_mask = (uint64_t(1) << valid) - 1;
+        if (valid == 0 || (expected >> valid) != 0 || (m.invalid & valid_mask) != 0 ||
+            ((expected ^ m.continuation) & valid_mask) != 0) {
+            return 0;
+        }
+        starts &= valid_mask;
+    }
+
+    size_t count = __builtin_popcountll(starts);
+    if (count > budget) {
+        // Stop at the start of the first character over the budget
+        for (size_t i = 0; i < budget; ++i) {
+            starts &= starts - 1;
+        }
+        chars += budget;
+        budget = 0;
+        return __builtin_ctzll(starts);
+    }
+
+    chars += count;
+    budget -= count;
+    return valid;
+}
+
+// Continuation bytes 0x80-0xBF are -128..-65 as signed bytes, leads follow
+// in order up to 0xF8-0xFF at -8..-1
+
+BlockMasks classifySSE2(const char* p) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    BlockMasks m;
+    m.high = _mm_movemask_epi8(bytes);
+    m.continuation = _mm_movemask_epi8(_mm_cmplt_epi8(bytes, _mm_set1_epi8(-64)));
+    m.lead2 = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(-65)),
+                                              _mm_cmplt_epi8(bytes, _mm_set1_epi8(-32))));
+    m.lead3 = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(-33)),
+                                              _mm_cmplt_epi8(bytes, _mm_set1_epi8(-16))));
+    m.lead4 = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(-17)),
+                                              _mm_cmplt_epi8(bytes, _mm_set1_epi8(-8))));
+    m.invalid = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(-9)),
+                                                _mm_cmplt_epi8(bytes, _mm_setzero_si128())));
+    return m;
+}
+
+size_t skipCharsSSE2(const char* data, size_t length, size_t max_chars, size_t& chars) {
+    size_t pos = 0;
+    while (max_chars > 0 && length - pos >= 16) {
+        BlockMasks m = classifySSE2(data + pos);
+        size_t consumed = consumeBlock(m, 16, max_chars, chars);
+        if (consumed == 0) break;
+        pos += consumed;
+    }
+    return pos;
+}
+
+SUBZERO_TARGET_AVX2
+BlockMasks classifyAVX2(const char* p) {
+    __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    BlockMasks m;
+    m.high = _mm256_movemask_epi8(bytes);
+    m.continuation = _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8(-64), bytes));
+    m.lead2 = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-65)),
+                                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(-32), bytes)));
+    m.lead3 = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-33)),
+                                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(-16), bytes)));
+    m.lead4 = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-17)),
+                                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(-8), bytes)));
+    m.invalid = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(-9)),
+                                                      _mm256_cmpgt_epi8(_mm256_setzero_si256(), bytes)));
+    return m;
+}
+
+SUBZERO_TARGET_AVX2
+size_t skipCharsAVX2(const char* data, size_t length, size_t max_chars, size_t& chars) {
+    size_t pos = 0;
+    while (max_chars > 0 && length - pos >= 32) {
+        BlockMasks m = classifyAVX2(data + pos);
+        size_t consumed = consumeBlock(m, 32, max_chars, chars);
+        if (consumed == 0) break;
+        pos += consumed;
+    }
+    return pos;
+}
+
+#endif
+
+size_t skipCharsScalar(const char*, size_t, size_t, size_t&) {
+    return 0;
+}
+
+typedef size_t (*SkipCharsFunction)(const char* data, size_t length, size_t max_chars, size_t& chars);
+
+SkipCharsFunction selectSkipChars() {
+#ifdef SUBZERO_X86_SIMD
+    if (cpu::hasAVX2()) return skipCharsAVX2;
+    if (cpu::hasSSE2()) return skipCharsSSE2;
+#endif
+    return skipCharsScalar;
+}
+
+// Skip well-formed characters at the start of data, at most max_chars of
+// them; adds the characters skipped to chars and returns the bytes skipped
+inline size_t skipChars(const char* data, size_t length, size_t max_chars, size_t& chars) {
+    static const SkipCharsFunction kernel = selectSkipChars();
+    return g_simd_enabled ? kernel(data, length, max_chars, chars) : 0;
+}
+
+} // anonymous namespace
+
+void setSimdEnabled(bool enabled) {
+    g_simd_enabled = enabled;
+}
+
 size_t length(const std::string& str) {
     size_t len = 0;
     for (size_t i = 0; i < str.length(); ) {
+        i += skipChars(str.data() + i, str.length() - i, std::string::npos, len);
+        if (i >= str.length()) break;
+        
         size_t char_len = charByteLength(str, i);
         if (char_len == 0) break; // Invalid UTF-8
         i += char_len;
@@ -66,6 +234,9 @@ size_t charToByte(const std::string& str, size_t char_pos) {
     size_t current_char = 0;
     
     while (byte_pos < str.length() && current_char < char_pos) {
+        byte_pos += skipChars(str.data() + byte_pos, str.length() - byte_pos, char_pos - current_char, current_char);
+        if (byte_pos >= str.length() || current_char >= char_pos) break;
+        
         size_t char_len = charByteLength(str, byte_pos);
         if (char_len == 0) {
             ++byte_pos; // Skip invalid byte
@@ -81,8 +252,12 @@ size_t charToByte(const std::string& str, size_t char_pos) {
 size_t byteToChar(const std::string& str, size_t byte_pos) {
     size_t char_pos = 0;
     size_t current_byte = 0;
+    size_t limit = std::min(byte_pos, str.length());
     
-    while (current_byte < byte_pos && current_byte < str.length()) {
+    while (current_byte < limit) {
+        current_byte += skipChars(str.data() + current_byte, limit - current_byte, std::string::npos, char_pos);
+        if (current_byte >= limit) break;
+        
         size_t char_len = charByteLength(str, current_byte);
         if (char_len == 0) {
             ++current_byte; // Skip invalid byte
@@ -97,6 +272,10 @@ size_t byteToChar(const std::string& str, size_t byte_pos) {
 
 bool isValid(const std::string& str) {
     for (size_t i = 0; i < str.length(); ) {
+        size_t skipped = 0;
+        i += skipChars(str.data() + i, str.length() - i, std::string::npos, skipped);
+        if (i >= str.length()) break;
+        
         size_t char_len = charByteLength(str, i);
         if (char_len == 0) return false;
         
@@ -129,6 +308,43 @@ bool isValidChar(const std::string& str, size_t pos) {
     return true;
 }
 
+int charWidth(const std::string& str, size_t pos) {
+    size_t char_len = charByteLength(str, pos);
+    if (char_len < 2 || pos + char_len > str.length()) return 1;
+    
+    static const uint8_t lead_mask[] = { 0, 0, 0x1F, 0x0F, 0x07 };
+    uint32_t cp = static_cast<uint8_t>(str[pos]) & lead_mask[char_len];
+    for (size_t j = 1; j < char_len; ++j) {
+        cp = (cp << 6) | (static_cast<uint8_t>(str[pos + j]) & 0x3F);
+    }
+    
+    bool zero = (cp >= 0x0300 && cp <= 0x036F) ||     // Combining diacritical marks
+                (cp >= 0x0483 && cp <= 0x0489) ||     // Cyrillic combining marks
+                (cp >= 0x0591 && cp <= 0x05BD) ||     // Hebrew points
+                (cp >= 0x064B && cp <= 0x065F) ||     // Arabic marks
+                (cp >= 0x1AB0 && cp <= 0x1AFF) ||     // Combining marks extended
+                (cp >= 0x1DC0 && cp <= 0x1DFF) ||     // Combining marks supplement
+                (cp >= 0x200B && cp <= 0x200F) ||     // Zero width space, joiners, marks
+                (cp >= 0x20D0 && cp <= 0x20FF) ||     // Combining marks for symbols
+                (cp >= 0xFE00 && cp <= 0xFE0F) ||     // Variation selectors
+                (cp >= 0xFE20 && cp <= 0xFE2F) ||     // Combining half marks
+                cp == 0xFEFF;                         // Zero width no-break space
+    if (zero) return 0;
+    
+    bool wide = (cp >= 0x1100 && cp <= 0x115F) ||     // Hangul Jamo
+                cp == 0x2329 || cp == 0x232A ||
+                (cp >= 0x2E80 && cp <= 0xA4CF && cp != 0x303F) ||  // CJK ... Yi
+                (cp >= 0xAC00 && cp <= 0xD7A3) ||     // Hangul syllables
+                (cp >= 0xF900 && cp <= 0xFAFF) ||     // CJK compatibility ideographs
+                (cp >= 0xFE30 && cp <= 0xFE4F) ||     // CJK compatibility forms
+                (cp >= 0xFF00 && cp <= 0xFF60) ||     // Fullwidth forms
+                (cp >= 0xFFE0 && cp <= 0xFFE6) ||
+                (cp >= 0x1F300 && cp <= 0x1F64F) ||   // Pictographs, emoticons
+                (cp >= 0x1F900 && cp <= 0x1F9FF) ||
+                (cp >= 0x20000 && cp <= 0x3FFFD);     // CJK extensions
+    return wide ? 2 : 1;
+}
+
 std::string substr(const std::string& str, size_t char_start, size_t char_length) {
     size_t byte_start = charToByte(str, char_start);
     if (byte_start >= str.length()) return "";
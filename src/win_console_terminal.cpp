@@ -138,6 +138,24 @@ void WinConsoleTerminal::refresh() {
     // Windows console updates immediately, no explicit refresh needed
 }
 
+bool WinConsoleTerminal::scrollRegion(int top, int bottom, int lines) {
+    if (!m_initialized || top < 0 || top > bottom || lines == 0) return false;
+    
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(m_stdout_handle, &info) || bottom >= info.dwSize.Y) {
+        return false;
+    }
+    
+    SMALL_RECT region = {0, static_cast<SHORT>(top), static_cast<SHORT>(info.dwSize.X - 1), static_cast<SHORT>(bottom)};
+    COORD destination = {0, static_cast<SHORT>(top - lines)};
+    CHAR_INFO fill;
+    fill.Char.UnicodeChar = L' ';
+    fill.Attributes = info.wAttributes;
+    
+    // Rows moved outside the region are clipped; the ones left behind are filled
+    return ScrollConsoleScreenBufferW(m_stdout_handle, &region, &region, destination, &fill) != 0;
+}
+
 void WinConsoleTerminal::setCursor(const Position& pos) {
     if (!m_initialized) return;
     
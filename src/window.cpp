@@ -1,35 +1,269 @@
 #include "window.h"
 #include "utf8_utils.h"
 #include <algorithm>
-#include <iomanip>
-#include <sstream>
 
 namespace subzero {
 
+namespace {
+
+// Line of a ScreenRow below the end of the buffer, and of one whose
+// content is unknown
+const size_t PAST_END = static_cast<size_t>(-1);
+const size_t UNKNOWN_LINE = static_cast<size_t>(-2);
+
+// Gutter of a row showing no line number, and the flag marking the cursor
+// line's number
+const size_t NO_NUMBER = static_cast<size_t>(-1);
+const size_t CURSOR_NUMBER = ~(static_cast<size_t>(-1) >> 1);
+
+} // anonymous namespace
+
 Window::Window(shared_ptr<ITerminal> terminal, shared_ptr<Buffer> buffer)
     : m_buffer(buffer)
     , m_terminal(terminal)
     , m_window_pos(0, 0)
     , m_window_size(0, 0)
     , m_top_line(0)
+    , m_top_row(0)
     , m_left_column(0)
     , m_screen_cursor(0, 0)
+    , m_cursor_saved(false)
     , m_show_line_numbers(true)
+    , m_relative_numbers(false)
     , m_wrap_lines(false)
     , m_tab_width(4)
     , m_force_full_clear(true)
+    , m_number_width(0)
+    , m_number_width_low(0)
+    , m_number_width_high(0)
     , m_syntax_highlighter(NULL)
+    , m_selection_active(false)
+    , m_selection_lines(false)
+    , m_dirty_first(0)
+    , m_dirty_end(0)
+    , m_layout_valid(false)
+    , m_rendered_top_line(0)
+    , m_rendered_cursor_line(0)
+    , m_rendered_top_row(0)
+    , m_rendered_left_column(0)
+    , m_rendered_number_width(0)
+    , m_rendered_size(0, 0)
+    , m_rendered_pos(0, 0)
+    , m_rendered_highlighter(NULL)
 {
     if (m_terminal) {
         m_window_size = m_terminal->getSize();
     }
+    if (m_buffer) {
+        m_buffer->addObserver(this);
+    }
+}
+
+Window::~Window() {
+    if (m_buffer) {
+        m_buffer->removeObserver(this);
+    }
+}
+
+void Window::bufferChanged(const Buffer& /*buffer*/, const BufferChange& change) {
+    m_line_layout.linesChanged(change);
+    
+    // A saved cursor follows lines added or removed above it
+    if (m_cursor.line >= change.first_line + change.old_line_count) {
+        m_cursor.line = m_cursor.line - change.old_line_count + change.new_line_count;
+    } else if (m_cursor.line >= change.first_line + change.new_line_count) {
+        m_cursor.line = change.first_line + change.new_line_count;
+    }
+    
+
+    // Lines after an edit that adds or removes lines all move
+    if (change.new_line_count != change.old_line_count) {
+        markLinesDirty(change.first_line, static_cast<size_t>(-1));
+    } else {
+        markLinesDirty(change.first_line, change.first_line + change.new_line_count);
+    }
+}
+
+void Window::bufferReset(const Buffer& /*buffer*/) {
+    m_line_layout.clear();
+    m_layout_valid = false;
+}
+
+void Window::markLinesDirty(size_t first, size_t end) {
+    if (m_dirty_first >= m_dirty_end) {
+        m_dirty_first = first;
+        m_dirty_end = end;
+    } else {
+        m_dirty_first = std::min(m_dirty_first, first);
+        m_dirty_end = std::max(m_dirty_end, end);
+    }
+}
+
+bool Window::viewChanged() const {
+    return !m_layout_valid || m_force_full_clear || m_rendered_left_column != m_left_column ||
+           m_rendered_number_width != getLineNumberWidth() || m_rendered_highlighter != m_syntax_highlighter ||
+           m_rendered_size.rows != m_window_size.rows || m_rendered_size.cols != m_window_size.cols ||
+           m_rendered_pos.row != m_window_pos.row || m_rendered_pos.col != m_window_pos.col;
+}
+
+bool Window::layoutChanged() const {
+    return viewChanged() || m_rendered_top_line != m_top_line || m_rendered_top_row != m_top_row;
+}
+
+bool Window::scrollScreen(int rows) {
+    // Scroll regions are full width, so the window has to span the terminal
+    if (rows == 0 || rows >= m_window_size.rows || -rows >= m_window_size.rows ||
+        m_window_pos.col != 0 || m_window_size.cols != m_terminal->getSize().cols) {
+        return false;
+    }
+    return m_terminal->scrollRegion(m_window_pos.row, m_window_pos.row + m_window_size.rows - 1, rows);
+}
+
+void Window::buildRows(std::vector<ScreenRow>& rows) const {
+    // Walk down from the top of the view; wrapped lines take several rows
+    size_t line_count = m_buffer->getLineCount();
+    size_t line = m_top_line;
+    size_t row = m_wrap_lines ? m_top_row : 0;
+    rows.clear();
+    for (int screen_row = 0; screen_row < m_window_size.rows; ++screen_row) {
+        if (line >= line_count) {
+            rows.push_back(ScreenRow(PAST_END, 0));
+            continue;
+        }
+        rows.push_back(ScreenRow(line, row));
+        if (m_wrap_lines && row + 1 < m_line_layout.getRowCount(*m_buffer, line)) {
+            ++row;
+        } else {
+            ++line;
+            row = 0;
+        }
+    }
+}
+
+void Window::setTopAbove(size_t line, size_t row, size_t rows_above) {
+    // Walk up from the given row, through the rows of wrapped lines
+    while (rows_above > 0) {
+        if (row >= rows_above) {
+            row -= rows_above;
+            break;
+        }
+        rows_above -= row;
+        row = 0;
+        if (line == 0) {
+            break;
+        }
+        --line;
+        row = m_wrap_lines ? m_line_layout.getRowCount(*m_buffer, line) - 1 : 0;
+        --rows_above;
+    }
+    m_top_line = line;
+    m_top_row = row;
+}
+
+size_t Window::rowsFromTop(size_t line, size_t row, size_t limit) const {
+    // Rows from the top of the view down to the given one, counting no
+    // further than limit
+    size_t rows = 0;
+    size_t current = m_top_line;
+    size_t current_row = m_top_row;
+    while (current < line && rows < limit) {
+        rows += m_line_layout.getRowCount(*m_buffer, current) - current_row;
+        current_row = 0;
+        ++current;
+    }
+    if (current == line) {
+        rows += row - std::min(row, current_row);
+    }
+    return std::min(rows, limit);
+}
+
+void Window::copyView(const Window& other) {
+    m_wrap_lines = other.m_wrap_lines;
+    m_show_line_numbers = other.m_show_line_numbers;
+    m_relative_numbers = other.m_relative_numbers;
+    m_top_line = other.m_top_line;
+    m_top_row = other.m_top_row;
+    m_left_column = other.m_left_column;
+    m_layout_valid = false;
+}
+
+void Window::setTabWidth(size_t width) {
+    m_tab_width = width;
+    m_line_layout.setTabWidth(width);
+    m_layout_valid = false;
+}
+
+void Window::setWrapLines(bool wrap) {
+    m_wrap_lines = wrap;
+    m_top_row = 0;
+    m_left_column = 0;
+    m_layout_valid = false;
+}
+
+void Window::setSelection(const BufferPosition& anchor, const BufferPosition& cursor, bool whole_lines) {
+    bool cursor_first = cursor.line < anchor.line || (cursor.line == anchor.line && cursor.column < anchor.column);
+    BufferPosition start = cursor_first ? cursor : anchor;
+    BufferPosition end = cursor_first ? anchor : cursor;
+    if (m_selection_active && m_selection_lines == whole_lines && m_selection_start == start && m_selection_end == end) {
+        return;
+    }
+    
+    // Lines that were or now are selected
+    if (m_selection_active) {
+        markLinesDirty(std::min(m_selection_start.line, start.line), std::max(m_selection_end.line, end.line) + 1);
+    } else {
+        markLinesDirty(start.line, end.line + 1);
+    }
+    m_selection_active = true;
+    m_selection_lines = whole_lines;
+    m_selection_start = start;
+    m_selection_end = end;
+}
+
+void Window::clearSelection() {
+    if (m_selection_active) {
+        markLinesDirty(m_selection_start.line, m_selection_end.line + 1);
+        m_selection_active = false;
+    }
+}
+
+void Window::setSearchHighlight(const std::string& pattern) {
+    if (pattern != m_search_highlight) {
+        m_search_highlight = pattern;
+        m_layout_valid = false;     // Matches may be on any row
+    }
+}
+
+void Window::saveCursor() {
+    if (m_buffer) {
+        m_cursor = m_buffer->getCursor();
+        m_cursor_saved = true;
+    }
+}
+
+void Window::restoreCursor() {
+    if (m_buffer) {
+        m_buffer->setCursor(m_cursor);
+    }
+    m_cursor_saved = false;
 }
 
 void Window::setBuffer(shared_ptr<Buffer> buffer) {
     bool buffer_changed = (m_buffer != buffer);
+    if (buffer_changed) {
+        if (m_buffer) {
+            m_buffer->removeObserver(this);
+        }
+        if (buffer) {
+            buffer->addObserver(this);
+        }
+        m_layout_valid = false;
+    }
     m_buffer = buffer;
     m_top_line = 0;
+    m_top_row = 0;
     m_left_column = 0;
+    m_line_layout.clear();
     
     // Force full screen clear on next render when buffer changes
     if (buffer_changed) {
@@ -45,12 +279,14 @@ void Window::scrollUp(size_t lines) {
     } else {
         m_top_line = 0;
     }
+    m_top_row = 0;
     calculateScreenCursor();
 }
 
 void Window::scrollDown(size_t lines) {
     if (!m_buffer) return;
     
+    m_buffer->ensureLineIndexed(m_top_line + lines + m_window_size.rows);
     size_t max_top_line = m_buffer->getLineCount();
     if (max_top_line > static_cast<size_t>(m_window_size.rows)) {
         max_top_line -= m_window_size.rows;
@@ -59,6 +295,7 @@ void Window::scrollDown(size_t lines) {
     }
     
     m_top_line = std::min(m_top_line + lines, max_top_line);
+    m_top_row = 0;
     calculateScreenCursor();
 }
 
@@ -81,6 +318,7 @@ void Window::scrollToLine(size_t line) {
     
     if (line < m_buffer->getLineCount()) {
         m_top_line = line;
+        m_top_row = 0;
         calculateScreenCursor();
     }
 }
@@ -91,7 +329,10 @@ void Window::centerOnCursor() {
     const BufferPosition& cursor = m_buffer->getCursor();
     
     // Center vertically
-    if (cursor.line >= static_cast<size_t>(m_window_size.rows / 2)) {
+    if (m_wrap_lines) {
+        m_line_layout.setWrapWidth(getTextAreaWidth());
+        setTopAbove(cursor.line, m_line_layout.getRowOf(*m_buffer, cursor.line, cursor.column), m_window_size.rows / 2);
+    } else if (cursor.line >= static_cast<size_t>(m_window_size.rows / 2)) {
         m_top_line = cursor.line - m_window_size.rows / 2;
     } else {
         m_top_line = 0;
@@ -100,8 +341,9 @@ void Window::centerOnCursor() {
     // Center horizontally (if not wrapping)
     if (!m_wrap_lines) {
         size_t text_width = getTextAreaWidth();
-        if (cursor.column >= text_width / 2) {
-            m_left_column = cursor.column - text_width / 2;
+        size_t column = getDisplayColumn(cursor);
+        if (column >= text_width / 2) {
+            m_left_column = column - text_width / 2;
         } else {
             m_left_column = 0;
         }
@@ -113,101 +355,148 @@ void Window::centerOnCursor() {
 void Window::render() {
     if (!m_terminal || !m_buffer) return;
     
-    // Much faster: only clear the screen once using terminal's clear function
     // Only do full clear if window size changed or buffer switched
-    static int last_window_rows = -1;
-    static int last_window_cols = -1;
-    
-    if (last_window_rows != m_window_size.rows || last_window_cols != m_window_size.cols || m_force_full_clear) {
+    if (m_rendered_size.rows != m_window_size.rows || m_rendered_size.cols != m_window_size.cols || m_force_full_clear) {
         // Full clear only when needed
         for (int row = 0; row < m_window_size.rows; ++row) {
             Position line_start(m_window_pos.row + row, m_window_pos.col);
             std::string clear_line(m_window_size.cols, ' ');
             m_terminal->putString(clear_line, line_start);  // Clear entire line at once
         }
-        last_window_rows = m_window_size.rows;
-        last_window_cols = m_window_size.cols;
         m_force_full_clear = false;  // Reset the flag after clearing
+        m_layout_valid = false;      // Every row has to be drawn again
     }
     
-    // Render buffer lines (skip rendering lines beyond buffer end)
-    size_t buffer_line_count = m_buffer->getLineCount();
-    for (size_t screen_row = 0; screen_row < static_cast<size_t>(m_window_size.rows); ++screen_row) {
-        size_t buffer_line = m_top_line + screen_row;
+    // Rows are repainted where they show another part of the buffer than
+    // last time or an edited line, or all of them if the layout changed
+    m_buffer->ensureLineIndexed(m_top_line + m_window_size.rows);
+    if (m_wrap_lines) {
+        m_line_layout.setWrapWidth(getTextAreaWidth());
+    }
+    std::vector<ScreenRow> rows;
+    buildRows(rows);
+    
+    std::vector<ScreenRow>& shown = m_rendered_rows;
+    std::vector<size_t>& shown_numbers = m_rendered_numbers;
+    if (viewChanged()) {
+        shown.assign(rows.size(), ScreenRow(UNKNOWN_LINE, 0));
+    } else if (!rows.empty() && !shown.empty() && rows[0] != shown[0] && rows[0].line != PAST_END) {
+        // A small vertical scroll moves the rows already on screen, so only
+        // the rows scrolled into view are drawn
+        int shift = 0;
+        for (size_t i = 1; i < shown.size() && shift == 0; ++i) {
+            if (shown[i] == rows[0]) shift = static_cast<int>(i);
+        }
+        for (size_t i = 1; i < rows.size() && shift == 0; ++i) {
+            if (rows[i] == shown[0]) shift = -static_cast<int>(i);
+        }
+        if (shift != 0 && scrollScreen(shift)) {
+            if (shift > 0) {
+                shown.erase(shown.begin(), shown.begin() + shift);
+                shown.resize(rows.size(), ScreenRow(UNKNOWN_LINE, 0));
+                shown_numbers.erase(shown_numbers.begin(), shown_numbers.begin() + std::min(shown_numbers.size(), static_cast<size_t>(shift)));
+            } else {
+                shown.insert(shown.begin(), -shift, ScreenRow(UNKNOWN_LINE, 0));
+                shown.resize(rows.size(), ScreenRow(UNKNOWN_LINE, 0));
+                shown_numbers.insert(shown_numbers.begin(), -shift, NO_NUMBER);
+            }
+        }
+    }
+    shown.resize(rows.size(), ScreenRow(UNKNOWN_LINE, 0));
+    shown_numbers.resize(rows.size(), NO_NUMBER);
+    
+    // Rows that stay only have their line numbers redrawn, if those
+    // changed: relative numbers follow the cursor
+    size_t text_width = getTextAreaWidth();
+    std::vector<size_t> numbers(rows.size(), NO_NUMBER);
+    for (size_t screen_row = 0; screen_row < rows.size(); ++screen_row) {
+        const ScreenRow& row = rows[screen_row];
+        numbers[screen_row] = getGutterNumber(row.line, row.row == 0);
+        bool dirty = row.line >= m_dirty_first && row.line < m_dirty_end;
+        if (!dirty && row == shown[screen_row]) {
+            if (numbers[screen_row] != shown_numbers[screen_row] && getLineNumberWidth() > 0) {
+                renderLineNumbers(screen_row, numbers[screen_row]);
+            }
+            continue;
+        }
         
-        // Only render lines that exist in buffer
-        if (buffer_line < buffer_line_count) {
-            renderLine(buffer_line, screen_row);
-        } else {
+        if (row.line == PAST_END) {
             // For empty lines below buffer, just clear the line efficiently
             Position line_start(m_window_pos.row + screen_row, m_window_pos.col);
-            if (m_show_line_numbers) {
-                // Clear line number area
-                std::string empty_line_num(getLineNumberWidth(), ' ');
-                m_terminal->putString(empty_line_num, line_start);
-                // Clear text area
-                std::string empty_text(getTextAreaWidth(), ' ');
-                Position text_pos(line_start.row, line_start.col + getLineNumberWidth());
-                m_terminal->putString(empty_text, text_pos);
-            } else {
-                std::string empty_line(m_window_size.cols, ' ');
-                m_terminal->putString(empty_line, line_start);
-            }
+            m_terminal->putString(std::string(m_window_size.cols, ' '), line_start);
+        } else if (m_wrap_lines) {
+            const std::vector<size_t>& starts = m_line_layout.getRowStarts(*m_buffer, row.line);
+            size_t first = starts[row.row];
+            size_t width = row.row + 1 < starts.size() ? starts[row.row + 1] - first : text_width;
+            renderRow(row.line, first, width, row.row == 0, screen_row);
+        } else {
+            renderLine(row.line, screen_row);
         }
     }
     
+    shown.swap(rows);
+    shown_numbers.swap(numbers);
+    m_rendered_cursor_line = getCursorLine();
+    m_dirty_first = m_dirty_end = 0;
+    m_layout_valid = true;
+    m_rendered_top_line = m_top_line;
+    m_rendered_top_row = m_top_row;
+    m_rendered_left_column = m_left_column;
+    m_rendered_number_width = getLineNumberWidth();
+    m_rendered_size = m_window_size;
+    m_rendered_pos = m_window_pos;
+    m_rendered_highlighter = m_syntax_highlighter;
+    
     updateCursor();
 }
 
 void Window::forceFullRefresh() {
     m_force_full_clear = true;
-    render();
 }
 
 void Window::renderLine(size_t buffer_line, size_t screen_row) {
+    renderRow(buffer_line, m_left_column, getTextAreaWidth(), true, screen_row);
+}
+
+void Window::renderRow(size_t buffer_line, size_t first_column, size_t width, bool first_row, size_t screen_row) {
     if (!m_terminal || !m_buffer) return;
     
-    Position line_pos(m_window_pos.row + screen_row, m_window_pos.col);
-    
-    // Always clear the entire line first to remove any leftover characters from deletions
-    std::string clear_line(m_window_size.cols, ' ');
-    m_terminal->putString(clear_line, line_pos);
-    
-    // Render line numbers if enabled
-    if (m_show_line_numbers) {
-        renderLineNumbers(screen_row, buffer_line);
+    // Every cell of the row is written once: the line number (blank on the
+    // rows a wrapped line continues on), the text in runs of one style,
+    // then blanks to the end of the row
+    if (getLineNumberWidth() > 0) {
+        renderLineNumbers(screen_row, getGutterNumber(buffer_line, first_row));
     }
     
-    // Render line content
+    size_t start_col = getLineNumberWidth();
+    size_t text_width = getTextAreaWidth();
+    size_t used = 0;
+    width = std::min(width, text_width);
     if (buffer_line < m_buffer->getLineCount()) {
+        // The characters in view: from the one covering the first column to
+        // the last that starts before the end, with any combining marks
+        // following it there
+        const LineColumns& columns = m_line_layout.getColumns(*m_buffer, buffer_line);
         std::string line = m_buffer->getLine(buffer_line);
-        
-        // Skip expensive tab expansion in fast mode if no tabs present
-        if (line.find('\t') != std::string::npos) {
-            line = expandTabs(line);
-        }
-        
-        // Handle horizontal scrolling
-        if (!m_wrap_lines && line.length() > m_left_column) {
-            size_t start_col = getLineNumberWidth();
-            std::string visible_text = utf8::substr(line, m_left_column, getTextAreaWidth());
-            
-            if (m_syntax_highlighter) {
-                renderSyntaxHighlightedText(visible_text, buffer_line, screen_row, start_col);
-            } else {
-                renderText(visible_text, screen_row, start_col);
-            }
-        } else if (!m_wrap_lines) {
-            // Render the entire line if it fits
-            size_t start_col = getLineNumberWidth();
-            std::string visible_text = utf8::substr(line, 0, getTextAreaWidth());
-            
-            if (m_syntax_highlighter) {
-                renderSyntaxHighlightedText(visible_text, buffer_line, screen_row, start_col);
-            } else {
-                renderText(visible_text, screen_row, start_col);
+        size_t end_column = first_column + width;
+        size_t first = columns.charAt(first_column);
+        size_t last = first;
+        while (last < columns.chars) {
+            size_t column = columns.columnOf(last);
+            if (column > end_column || (column == end_column && columns.columnOf(last + 1) != column)) {
+                break;
             }
+            ++last;
         }
+        
+        std::vector<TextStyle> styles(last - first);
+        styleLine(line, buffer_line, first, styles);
+        used = renderStyledText(line, columns, first, styles, first_column, end_column, screen_row, start_col);
+    }
+    
+    if (used < text_width) {
+        Position tail(m_window_pos.row + screen_row, m_window_pos.col + start_col + used);
+        m_terminal->putString(std::string(text_width - used, ' '), tail);
     }
 }
 
@@ -223,24 +512,45 @@ void Window::updateCursor() {
 
 Position Window::bufferToScreen(const BufferPosition& buffer_pos) const {
     int screen_row = static_cast<int>(buffer_pos.line) - static_cast<int>(m_top_line);
-    int screen_col = static_cast<int>(buffer_pos.column) - static_cast<int>(m_left_column);
-    
-    if (m_show_line_numbers) {
-        screen_col += static_cast<int>(getLineNumberWidth());
+    int screen_col = static_cast<int>(getDisplayColumn(buffer_pos)) - static_cast<int>(m_left_column);
+    
+    if (m_wrap_lines && m_buffer && buffer_pos.line < m_buffer->getLineCount()) {
+        // Rows are counted down from the top of the view, no further than
+        // just past its bottom
+        size_t row = m_line_layout.getRowOf(*m_buffer, buffer_pos.line, buffer_pos.column);
+        if (buffer_pos.line < m_top_line || (buffer_pos.line == m_top_line && row < m_top_row)) {
+            screen_row = -1;
+        } else {
+            screen_row = static_cast<int>(rowsFromTop(buffer_pos.line, row, m_window_size.rows));
+        }
+        screen_col = static_cast<int>(getDisplayColumn(buffer_pos) - m_line_layout.getRowStarts(*m_buffer, buffer_pos.line)[row]);
     }
     
+    screen_col += static_cast<int>(getLineNumberWidth());
+    
     return Position(screen_row, screen_col);
 }
 
 BufferPosition Window::screenToBuffer(const Position& screen_pos) const {
     size_t buffer_line = m_top_line + screen_pos.row;
-    size_t buffer_col = m_left_column + screen_pos.col;
+    size_t column = m_left_column + screen_pos.col;
+    
+    // Wrapped rows are found in what the last render drew
+    if (m_wrap_lines && screen_pos.row >= 0 && static_cast<size_t>(screen_pos.row) < m_rendered_rows.size() &&
+        m_rendered_rows[screen_pos.row].line < m_buffer->getLineCount()) {
+        const ScreenRow& row = m_rendered_rows[screen_pos.row];
+        buffer_line = row.line;
+        column = m_line_layout.getRowStarts(*m_buffer, row.line)[row.row] + screen_pos.col;
+    }
     
-    if (m_show_line_numbers && screen_pos.col >= static_cast<int>(getLineNumberWidth())) {
-        buffer_col -= getLineNumberWidth();
+    if (screen_pos.col >= static_cast<int>(getLineNumberWidth())) {
+        column -= getLineNumberWidth();
     }
     
-    return BufferPosition(buffer_line, buffer_col);
+    if (buffer_line < m_buffer->getLineCount()) {
+        return BufferPosition(buffer_line, m_line_layout.getColumns(*m_buffer, buffer_line).charAt(column));
+    }
+    return BufferPosition(buffer_line, column);
 }
 
 void Window::ensureCursorVisible() {
@@ -248,6 +558,23 @@ void Window::ensureCursorVisible() {
     
     const BufferPosition& cursor = m_buffer->getCursor();
     
+    // Wrapped lines take several rows, so the view moves by rows; only the
+    // rows between the view and the cursor are looked at
+    if (m_wrap_lines) {
+        m_line_layout.setWrapWidth(getTextAreaWidth());
+        size_t row = m_line_layout.getRowOf(*m_buffer, cursor.line, cursor.column);
+        size_t height = m_window_size.rows > 0 ? static_cast<size_t>(m_window_size.rows) : 1;
+        if (cursor.line < m_top_line || (cursor.line == m_top_line && row < m_top_row)) {
+            m_top_line = cursor.line;
+            m_top_row = row;
+        } else if (rowsFromTop(cursor.line, row, height) >= height) {
+            setTopAbove(cursor.line, row, height - 1);
+        }
+        m_left_column = 0;
+        calculateScreenCursor();
+        return;
+    }
+    
     // Ensure cursor is vertically visible
     if (cursor.line < m_top_line) {
         m_top_line = cursor.line;
@@ -255,13 +582,16 @@ void Window::ensureCursorVisible() {
         m_top_line = cursor.line - m_window_size.rows + 1;
     }
     
-    // Ensure cursor is horizontally visible (if not wrapping)
+    // Ensure cursor is horizontally visible (if not wrapping), all of a
+    // wide character or tab under it if there is room
     if (!m_wrap_lines) {
         size_t text_width = getTextAreaWidth();
-        if (cursor.column < m_left_column) {
-            m_left_column = cursor.column;
-        } else if (cursor.column >= m_left_column + text_width) {
-            m_left_column = cursor.column - text_width + 1;
+        size_t column = getDisplayColumn(cursor);
+        size_t end = std::max(getDisplayColumn(BufferPosition(cursor.line, cursor.column + 1)), column + 1);
+        if (column < m_left_column) {
+            m_left_column = column;
+        } else if (end > m_left_column + text_width) {
+            m_left_column = std::min(column, end - std::min(end, text_width));
         }
     }
     
@@ -286,7 +616,7 @@ void Window::calculateScreenCursor() {
 
 size_t Window::getTextAreaWidth() const {
     size_t total_width = static_cast<size_t>(m_window_size.cols);
-    size_t line_num_width = m_show_line_numbers ? getLineNumberWidth() : 0;
+    size_t line_num_width = getLineNumberWidth();
     
     if (total_width > line_num_width) {
         return total_width - line_num_width;
@@ -295,132 +625,228 @@ size_t Window::getTextAreaWidth() const {
 }
 
 size_t Window::getLineNumberWidth() const {
-    if (!m_show_line_numbers || !m_buffer) return 0;
+    if ((!m_show_line_numbers && !m_relative_numbers) || !m_buffer) return 0;
     
+    // Counted again only when the line count gains or loses a digit
     size_t line_count = m_buffer->getLineCount();
-    size_t digits = 1;
-    while (line_count >= 10) {
-        line_count /= 10;
-        digits++;
+    if (line_count < m_number_width_low || line_count >= m_number_width_high) {
+        size_t digits = 1;
+        m_number_width_low = 0;
+        m_number_width_high = 10;
+        while (line_count >= m_number_width_high && m_number_width_high <= static_cast<size_t>(-1) / 10) {
+            m_number_width_low = m_number_width_high;
+            m_number_width_high *= 10;
+            digits++;
+        }
+        m_number_width = digits + 2; // Add space for padding
     }
-    
-    return digits + 2; // Add space for padding
+    return m_number_width;
 }
 
-std::string Window::formatLineNumber(size_t line_num) const {
-    std::ostringstream oss;
-    oss << std::setw(static_cast<int>(getLineNumberWidth() - 1)) << std::right << (line_num + 1) << " ";
-    return oss.str();
+bool Window::gutterChanged() const {
+    return m_relative_numbers && m_buffer && getCursorLine() != m_rendered_cursor_line;
 }
 
-std::string Window::expandTabs(const std::string& line) const {
-    std::string result;
-    size_t column = 0;
-    
-    for (size_t i = 0; i < line.length(); ) {
-        if (line[i] == '\t') {
-            size_t spaces = m_tab_width - (column % m_tab_width);
-            result += std::string(spaces, ' ');
-            column += spaces;
-            i++;
-        } else {
-            size_t char_bytes = utf8::charByteLength(line, i);
-            if (char_bytes > 0) {
-                result += line.substr(i, char_bytes);
-                column++;
-                i += char_bytes;
-            } else {
-                i++; // Skip invalid byte
-            }
-        }
-    }
-    
-    return result;
+size_t Window::getCursorLine() const {
+    return m_cursor_saved ? m_cursor.line : m_buffer->getCursor().line;
 }
 
-void Window::renderLineNumbers(size_t screen_row, size_t buffer_line) {
-    if (!m_terminal || !m_show_line_numbers) return;
-    
-    Position pos(m_window_pos.row + screen_row, m_window_pos.col);
+size_t Window::getGutterNumber(size_t buffer_line, bool first_row) const {
+    if (!first_row || buffer_line >= m_buffer->getLineCount()) {
+        return NO_NUMBER;
+    }
+    if (!m_relative_numbers) {
+        return buffer_line + 1;
+    }
     
-    if (buffer_line < m_buffer->getLineCount()) {
-        std::string line_num = formatLineNumber(buffer_line);
-        m_terminal->putStringWithColor(line_num, pos, Color::CYAN, Color::BLACK);
+    // Relative numbers count from the cursor line, which shows 0, or its
+    // own number if line numbers are on as well
+    size_t cursor_line = getCursorLine();
+    if (buffer_line == cursor_line) {
+        return CURSOR_NUMBER | (m_show_line_numbers ? buffer_line + 1 : 0);
     }
+    return buffer_line > cursor_line ? buffer_line - cursor_line : cursor_line - buffer_line;
 }
 
-void Window::renderText(const std::string& text, size_t screen_row, size_t start_col) {
-    if (!m_terminal) return;
-    
-    Position pos(m_window_pos.row + screen_row, m_window_pos.col + start_col);
-    m_terminal->putString(text, pos);
+void Window::formatLineNumber(size_t number, bool left_aligned) {
+    // The gutter is the number, padded to the width, and a space; it is
+    // formatted into the same string every time
+    size_t width = getLineNumberWidth();
+    char digits[24];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while (number > 0 && count < sizeof(digits));
+    count = std::min(count, width - 1);
+    
+    m_gutter_text.assign(width, ' ');
+    size_t start = left_aligned ? 0 : width - 1 - count;
+    for (size_t i = 0; i < count; ++i) {
+        m_gutter_text[start + i] = digits[count - 1 - i];
+    }
 }
 
-void Window::renderSyntaxHighlightedText(const std::string& text, size_t buffer_line, size_t screen_row, size_t start_col) {
-    // If no syntax highlighter is set, try to get one based on buffer filename
-    if (!m_syntax_highlighter && m_buffer) {
-        // This shouldn't happen, but let's be defensive
-        renderText(text, screen_row, start_col);
-        return;
+size_t Window::getDisplayColumn(const BufferPosition& pos) const {
+    if (!m_buffer || pos.line >= m_buffer->getLineCount()) {
+        return pos.column;
     }
+    return m_line_layout.getColumns(*m_buffer, pos.line).columnOf(pos.column);
+}
+
+void Window::renderLineNumbers(size_t screen_row, size_t number) {
+    if (!m_terminal || getLineNumberWidth() == 0) return;
     
-    if (!m_terminal || !m_syntax_highlighter) {
-        renderText(text, screen_row, start_col);
+    Position pos(m_window_pos.row + screen_row, m_window_pos.col);
+    
+    // Clipped, so a narrow window doesn't spill into its neighbour
+    size_t cols = static_cast<size_t>(m_window_size.cols);
+    if (number == NO_NUMBER) {
+        m_gutter_text.assign(std::min(getLineNumberWidth(), cols), ' ');
+        m_terminal->putString(m_gutter_text, pos);
         return;
     }
     
-    // Get full line for context
-    std::string full_line = m_buffer->getLine(buffer_line);
-    full_line = expandTabs(full_line);
-    
-    // Get context lines for multiline constructs
-    std::vector<std::string> context_lines;
-    context_lines.push_back(full_line);
-    
-    // Get syntax highlighting
-    SyntaxHighlightResult highlight_result = m_syntax_highlighter->highlightLine(
-        full_line, buffer_line, context_lines);
-    
-    Position base_pos(m_window_pos.row + screen_row, m_window_pos.col + start_col);
-    
-    // If no tokens, render as plain text
-    if (highlight_result.tokens.empty()) {
-        m_terminal->putString(text, base_pos);
+    // The cursor line stands out; with both kinds of numbers on, its own
+    // number is set to the left, as in vim
+    bool cursor_line = (number & CURSOR_NUMBER) != 0;
+    formatLineNumber(number & ~CURSOR_NUMBER, cursor_line && m_show_line_numbers);
+    if (m_gutter_text.size() > cols) {
+        m_gutter_text.resize(cols);
+    }
+    m_terminal->putStringWithColor(m_gutter_text, pos, cursor_line ? Color::YELLOW : Color::CYAN, Color::BLACK);
+}
+
+void Window::styleLine(const std::string& line, size_t buffer_line, size_t first, std::vector<TextStyle>& styles) const {
+    // Layers from the bottom up: syntax colors, search matches, selection.
+    // Positions are characters of the line; styles[i] is the style of
+    // character first + i.
+    size_t end = first + styles.size();
+    if (styles.empty()) {
         return;
     }
     
-    // Use original simple approach: render the whole text, then apply tokens on top
-    // First render the entire text with default color - ALWAYS do this first
-    m_terminal->putString(text, base_pos);
-    
-    // Then apply colored tokens on top
-    size_t visible_start = m_left_column;
-    
-    for (std::vector<SyntaxToken>::const_iterator token_it = highlight_result.tokens.begin(); 
-         token_it != highlight_result.tokens.end(); ++token_it) {
-        const SyntaxToken& token = *token_it;
+    if (m_syntax_highlighter) {
+        std::vector<std::string> context_lines;
+        context_lines.push_back(line);
+        SyntaxHighlightResult result = m_syntax_highlighter->highlightLine(line, buffer_line, context_lines);
         
-        // Skip tokens completely outside visible area
-        if (token.start_pos + token.length <= visible_start || 
-            token.start_pos >= visible_start + text.length()) {
-            continue;
+        // Tokens are byte ranges; outside ASCII they are mapped to the
+        // characters holding their first and last bytes
+        bool ascii = true;
+        for (size_t i = 0; i < line.size() && ascii; ++i) {
+            ascii = static_cast<uint8_t>(line[i]) < 0x80;
+        }
+        std::vector<size_t> char_of_byte;
+        if (!ascii) {
+            char_of_byte.reserve(line.size() + 1);
+            for (size_t i = 0, ch = 0; i < line.size(); ++ch) {
+                size_t length = utf8::charByteLength(line, i);
+                length = (length == 0 || i + length > line.size()) ? 1 : length;
+                char_of_byte.insert(char_of_byte.end(), length, ch);
+                i += length;
+            }
+            char_of_byte.push_back(char_of_byte.empty() ? 0 : char_of_byte.back() + 1);
         }
         
-        // Calculate visible portion of token
-        size_t token_vis_start = std::max(token.start_pos, visible_start);
-        size_t token_vis_end = std::min(token.start_pos + token.length, visible_start + text.length());
-        
-        if (token_vis_start < token_vis_end) {
-            size_t text_start = token_vis_start - visible_start;
-            size_t text_len = token_vis_end - token_vis_start;
-            
-            if (text_start < text.length() && text_start + text_len <= text.length()) {
-                std::string token_text = text.substr(text_start, text_len);
-                Position token_pos(base_pos.row, base_pos.col + text_start);
-                m_terminal->putStringWithColor(token_text, token_pos, token.color, Color::BLACK);
+        for (std::vector<SyntaxToken>::const_iterator token = result.tokens.begin();
+             token != result.tokens.end(); ++token) {
+            size_t start = token->start_pos;
+            size_t stop = token->start_pos + token->length;
+            if (!char_of_byte.empty()) {
+                if (start >= line.size() || token->length == 0) {
+                    continue;
+                }
+                start = char_of_byte[start];
+                stop = stop >= line.size() ? char_of_byte.back() : char_of_byte[stop - 1] + 1;
             }
+            size_t from = std::max(start, first);
+            size_t to = std::min(stop, end);
+            for (size_t pos = from; pos < to; ++pos) {
+                styles[pos - first] = TextStyle(token->color, token->bg_color);
+            }
+        }
+    }
+    
+    if (!m_search_highlight.empty()) {
+        size_t length = utf8::length(m_search_highlight);
+        for (size_t byte = line.find(m_search_highlight); byte != std::string::npos;
+             byte = line.find(m_search_highlight, byte + m_search_highlight.size())) {
+            size_t start = utf8::byteToChar(line, byte);
+            if (start >= end) {
+                break;
+            }
+            for (size_t pos = std::max(start, first); pos < std::min(start + length, end); ++pos) {
+                styles[pos - first] = TextStyle(Color::BLACK, Color::YELLOW);
+            }
+        }
+    }
+    
+    if (m_selection_active && buffer_line >= m_selection_start.line && buffer_line <= m_selection_end.line) {
+        size_t from = first;
+        size_t to = end;
+        if (!m_selection_lines) {
+            if (buffer_line == m_selection_start.line) {
+                from = std::max(from, m_selection_start.column);
+            }
+            if (buffer_line == m_selection_end.line) {
+                to = std::min(to, m_selection_end.column + 1);
+            }
+        }
+        for (size_t pos = from; pos < to; ++pos) {
+            styles[pos - first] = TextStyle(Color::BLACK, Color::WHITE);
+        }
+    }
+}
+
+size_t Window::renderStyledText(const std::string& line, const LineColumns& columns, size_t first,
+                                const std::vector<TextStyle>& styles, size_t first_column, size_t end_column,
+                                size_t screen_row, size_t start_col) {
+    // One terminal call per run of characters with the same style; a
+    // combining mark stays in the run of the character it belongs to. Tabs
+    // become spaces, as do the parts of wide characters cut by an edge of
+    // the view. Returns the columns drawn.
+    size_t byte = columns.starts.empty() ? first : utf8::charToByte(line, first);
+    size_t drawn = first_column;
+    std::string run;
+    size_t run_column = first_column;
+    size_t run_start = 0;
+    for (size_t i = 0; i <= styles.size(); ++i) {
+        size_t column = columns.columnOf(first + i);
+        size_t next = columns.columnOf(first + i + 1);
+        bool joins = i > 0 && i < styles.size() && next == column;
+        if (!run.empty() && (i == styles.size() || (!joins && styles[i] != styles[run_start]))) {
+            Position pos(m_window_pos.row + screen_row, m_window_pos.col + start_col + run_column - first_column);
+            const TextStyle& style = styles[run_start];
+            if (style.plain) {
+                m_terminal->putString(run, pos);
+            } else {
+                m_terminal->putStringWithColor(run, pos, style.fg, style.bg);
+            }
+            run.clear();
+        }
+        if (i == styles.size()) {
+            break;
+        }
+        
+        size_t from = std::max(column, first_column);
+        size_t to = std::min(next, end_column);
+        if (run.empty()) {
+            run_column = from;
+            run_start = i;
+        }
+        size_t length = utf8::charByteLength(line, byte);
+        if (line[byte] == '\t' || column < first_column || next > end_column) {
+            run.append(to > from ? to - from : 0, ' ');
+        } else if (length == 0 || byte + length > line.size()) {
+            run += "\xEF\xBF\xBD";      // U+FFFD, as ScreenGrid shows invalid bytes
+        } else {
+            run.append(line, byte, length);
         }
+        drawn = std::max(drawn, to);
+        byte += length > 0 ? length : 1;
     }
+    return drawn - first_column;
 }
 
 } // namespace subzero
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include "window_layout.h"
+
+namespace subzero {
+
+namespace {
+
+// Whether an area can be divided into count windows of the minimum size
+bool fits(const TerminalSize& size, size_t count, bool vertical) {
+    int n = static_cast<int>(count);
+    if (vertical) {
+        return size.cols >= n * WindowLayout::MIN_COLS + (n - 1);   // Separators between
+    }
+    return size.rows >= n * WindowLayout::MIN_ROWS;
+}
+
+bool overlaps(int first_a, int length_a, int first_b, int length_b) {
+    return first_a < first_b + length_b && first_b < first_a + length_a;
+}
+
+} // anonymous namespace
+
+WindowLayout::WindowLayout(shared_ptr<Window> window)
+    : m_root(new Node())
+{
+    m_root->window = window;
+    collectWindows(m_root);
+}
+
+bool WindowLayout::split(const shared_ptr<Window>& target, shared_ptr<Window> window, bool vertical) {
+    shared_ptr<Node> node = findNode(m_root, target.get());
+    if (!node || !window) {
+        return false;
+    }
+
+    shared_ptr<Node> leaf(new Node());
+    leaf->window = window;
+
+    // A split in the same direction as the parent's adds a sibling, so the
+    // parent's area is shared evenly; otherwise the window becomes a split
+    Node* parent = node->parent;
+    if (parent && parent->vertical == vertical) {
+        if (!fits(parent->size, parent->children.size() + 1, vertical)) {
+            return false;
+        }
+        leaf->parent = parent;
+        for (size_t i = 0; i < parent->children.size(); ++i) {
+            if (parent->children[i] == node) {
+                parent->children.insert(parent->children.begin() + i, leaf);
+                break;
+            }
+        }
+    } else {
+        if (!fits(node->size, 2, vertical)) {
+            return false;
+        }
+        shared_ptr<Node> existing(new Node());
+        existing->window = node->window;
+        existing->parent = node.get();
+        leaf->parent = node.get();
+        node->window = shared_ptr<Window>();
+        node->vertical = vertical;
+        node->children.push_back(leaf);
+        node->children.push_back(existing);
+    }
+
+    m_windows.clear();
+    m_leaves.clear();
+    collectWindows(m_root);
+    return true;
+}
+
+bool WindowLayout::remove(const shared_ptr<Window>& window) {
+    shared_ptr<Node> node = findNode(m_root, window.get());
+    if (!node || node == m_root) {
+        return false;
+    }
+
+    Node* parent = node->parent;
+    for (size_t i = 0; i < parent->children.size(); ++i) {
+        if (parent->children[i] == node) {
+            parent->children.erase(parent->children.begin() + i);
+            break;
+        }
+    }
+
+    // A split left with one child is replaced by it
+    if (parent->children.size() == 1) {
+        shared_ptr<Node> child = parent->children[0];
+        parent->window = child->window;
+        parent->vertical = child->vertical;
+        parent->children = child->children;
+        for (size_t i = 0; i < parent->children.size(); ++i) {
+            parent->children[i]->parent = parent;
+        }
+    }
+
+    m_windows.clear();
+    m_leaves.clear();
+    collectWindows(m_root);
+    return true;
+}
+
+void WindowLayout::keepOnly(shared_ptr<Window> window) {
+    m_root = shared_ptr<Node>(new Node());
+    m_root->window = window;
+    m_windows.clear();
+    m_leaves.clear();
+    collectWindows(m_root);
+}
+
+void WindowLayout::arrange(const Position& pos, const TerminalSize& size) {
+    m_separators.clear();
+    arrangeNode(m_root, pos, size);
+}
+
+void WindowLayout::arrangeNode(const shared_ptr<Node>& node, const Position& pos, const TerminalSize& size) {
+    node->pos = pos;
+    node->size = size;
+
+    if (node->window) {
+        int rows = hasTitles() ? size.rows - 1 : size.rows;
+        node->window->setPosition(pos);
+        node->window->setSize(TerminalSize(rows > 0 ? rows : 0, size.cols > 0 ? size.cols : 0));
+        return;
+    }
+
+    // Children share the area evenly, the first ones taking what is left
+    // over; side by side children also leave a column for each separator
+    int count = static_cast<int>(node->children.size());
+    int extent = node->vertical ? size.cols - (count - 1) : size.rows;
+    int share = extent > 0 ? extent / count : 0;
+    int extra = extent > 0 ? extent % count : 0;
+    Position child_pos = pos;
+    for (int i = 0; i < count; ++i) {
+        int length = share + (i < extra ? 1 : 0);
+        if (node->vertical) {
+            arrangeNode(node->children[i], child_pos, TerminalSize(size.rows, length));
+            child_pos.col += length;
+            if (i + 1 < count) {
+                m_separators.push_back(WindowSeparator(child_pos, size.rows));
+                child_pos.col += 1;
+            }
+        } else {
+            arrangeNode(node->children[i], child_pos, TerminalSize(length, size.cols));
+            child_pos.row += length;
+        }
+    }
+}
+
+shared_ptr<Window> WindowLayout::findNeighbor(const shared_ptr<Window>& from, WindowDirection direction, const Position& near) const {
+    shared_ptr<Node> node = findNode(m_root, from.get());
+    if (!node) {
+        return shared_ptr<Window>();
+    }
+
+    const Position& a = node->pos;
+    const TerminalSize& a_size = node->size;
+    shared_ptr<Window> found;
+    for (size_t i = 0; i < m_leaves.size(); ++i) {
+        const Position& b = m_leaves[i]->pos;
+        const TerminalSize& b_size = m_leaves[i]->size;
+
+        // Side by side areas are a separator apart; stacked ones touch
+        bool adjacent = false;
+        bool level = false;
+        switch (direction) {
+            case WINDOW_LEFT:
+            case WINDOW_RIGHT:
+                adjacent = direction == WINDOW_LEFT ? b.col + b_size.cols + 1 == a.col
+                                                    : a.col + a_size.cols + 1 == b.col;
+                adjacent = adjacent && overlaps(a.row, a_size.rows, b.row, b_size.rows);
+                level = near.row >= b.row && near.row < b.row + b_size.rows;
+                break;
+            case WINDOW_UP:
+            case WINDOW_DOWN:
+                adjacent = direction == WINDOW_UP ? b.row + b_size.rows == a.row
+                                                  : a.row + a_size.rows == b.row;
+                adjacent = adjacent && overlaps(a.col, a_size.cols, b.col, b_size.cols);
+                level = near.col >= b.col && near.col < b.col + b_size.cols;
+                break;
+        }
+
+        if (adjacent) {
+            if (level) {
+                return m_leaves[i]->window;
+            }
+            if (!found) {
+                found = m_leaves[i]->window;
+            }
+        }
+    }
+    return found;
+}
+
+shared_ptr<WindowLayout::Node> WindowLayout::findNode(const shared_ptr<Node>& node, const Window* window) const {
+    if (node->window) {
+        return node->window.get() == window ? node : shared_ptr<Node>();
+    }
+    for (size_t i = 0; i < node->children.size(); ++i) {
+        shared_ptr<Node> found = findNode(node->children[i], window);
+        if (found) {
+            return found;
+        }
+    }
+    return shared_ptr<Node>();
+}
+
+void WindowLayout::collectWindows(const shared_ptr<Node>& node) {
+    if (node->window) {
+        m_windows.push_back(node->window);
+        m_leaves.push_back(node);
+        return;
+    }
+    for (size_t i = 0; i < node->children.size(); ++i) {
+        collectWindows(node->children[i]);
+    }
+}
+
+} // namespace subzero
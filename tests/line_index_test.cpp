@@ -0,0 +1,118 @@
+// Tests for LineIndex: random edits checked against a plain list of
+// lines, and the cost of repeated deletes across block boundaries.
+#include "line_index.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace subzero;
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++g_failures; \
+        } \
+    } while (0)
+
+LineInfo makeLine(size_t n) {
+    size_t bytes = n % 97;
+    return LineInfo(bytes, bytes - (n % 3 == 0 ? bytes / 4 : 0), 1);
+}
+
+void fill(LineIndex& index, std::vector<LineInfo>& model, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        model.push_back(makeLine(i));
+        index.append(model.back());
+    }
+}
+
+// Every line's offsets, and the reverse lookups, agree with the model
+bool matches(const LineIndex& index, const std::vector<LineInfo>& model) {
+    if (index.getLineCount() != model.size()) {
+        return false;
+    }
+    size_t bytes = 0;
+    size_t chars = 0;
+    for (size_t i = 0; i < model.size(); ++i) {
+        if (index.getLineOffset(i) != bytes || index.getLineCharOffset(i) != chars ||
+            index.getLine(i).bytes() != model[i].bytes()) {
+            return false;
+        }
+        if (model[i].totalBytes() > 0 && index.findLineByOffset(bytes) != i) {
+            return false;
+        }
+        bytes += model[i].totalBytes();
+        chars += model[i].totalChars();
+    }
+    return index.getTotalBytes() == bytes && index.getTotalChars() == chars;
+}
+
+void testRandomEdits() {
+    LineIndex index;
+    std::vector<LineInfo> model;
+    fill(index, model, 5000);
+
+    srand(1);
+    for (int round = 0; round < 2000; ++round) {
+        size_t first = rand() % (model.size() + 1);
+        size_t count = std::min(static_cast<size_t>(rand() % (round % 10 == 0 ? 1200 : 4)), model.size() - first);
+        std::vector<LineInfo> lines;
+        size_t added = rand() % (round % 15 == 0 ? 900 : 3);
+        for (size_t i = 0; i < added; ++i) {
+            lines.push_back(makeLine(rand()));
+        }
+        if (count == 0 && lines.empty()) {
+            continue;
+        }
+        index.replace(first, count, lines);
+        model.erase(model.begin() + first, model.begin() + first + count);
+        model.insert(model.begin() + first, lines.begin(), lines.end());
+        if (round % 100 == 0) {
+            CHECK(matches(index, model));
+        }
+        if (model.empty()) {
+            fill(index, model, 100);
+        }
+    }
+    CHECK(matches(index, model));
+}
+
+void testDeletesAtTop() {
+    // dd at the top of a file: the first line and the start of the next are
+    // replaced by the rest of the next, which crosses into the following
+    // block whenever the first holds a single line
+    LineIndex index;
+    std::vector<LineInfo> model;
+    fill(index, model, 200000);
+    index.getLineOffset(100000);
+
+    size_t rebuilds = index.getTreeRebuilds();
+    const size_t deletes = 50000;
+    for (size_t i = 0; i < deletes; ++i) {
+        index.replace(0, 2, std::vector<LineInfo>(1, model[i + 1]));
+        index.getLineOffset(index.getLineCount() / 2);
+    }
+    model.erase(model.begin(), model.begin() + deletes);
+
+    // Blocks are only merged or removed every few hundred deletes
+    CHECK(index.getTreeRebuilds() - rebuilds < deletes / 100);
+    CHECK(matches(index, model));
+}
+
+} // anonymous namespace
+
+int main() {
+    testRandomEdits();
+    testDeletesAtTop();
+    if (g_failures > 0) {
+        printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("line_index_test: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Tests for Window drawing, into a HeadlessTerminal: syntax colors on
+// lines with multibyte characters.
+#include "window.h"
+#include "headless_terminal.h"
+#include "cpp_syntax_highlighter.h"
+#include <cstdio>
+#include <sstream>
+
+using namespace subzero;
+
+namespace {
+
+int g_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++g_failures; \
+        } \
+    } while (0)
+
+// Screen column of the n-th character of a row (counting from 0)
+int columnOfChar(const HeadlessTerminal& terminal, int row, size_t n) {
+    const ScreenGrid& screen = terminal.getScreen();
+    size_t seen = 0;
+    for (int col = 0; col < screen.getCols(); ++col) {
+        if (screen.at(row, col).glyph == ScreenCell::WIDE_TAIL) {
+            continue;
+        }
+        if (seen++ == n) {
+            return col;
+        }
+    }
+    return -1;
+}
+
+uint8_t colorOfChar(const HeadlessTerminal& terminal, int row, const std::string& text, const std::string& what) {
+    size_t byte = text.find(what);
+    int col = columnOfChar(terminal, row, utf8::byteToChar(text, byte));
+    return terminal.getScreen().at(row, col).fg;
+}
+
+void testMultibyteStringThenComment() {
+    const std::string line = "x = \"\xC3\xA9\xC3\xA9\xC3\xA9\" + y; // cmt";
+    shared_ptr<HeadlessTerminal> terminal(new HeadlessTerminal(TerminalSize(5, 60)));
+    CHECK(terminal->initialize());
+
+    shared_ptr<Buffer> buffer(new Buffer());
+    std::istringstream stream(line + "\n");
+    buffer->loadFromStream(stream);
+    buffer->ensureFullyIndexed();
+
+    CppSyntaxHighlighter highlighter;
+    Window window(terminal, buffer);
+    window.setPosition(Position(0, 0));
+    window.setSize(TerminalSize(5, 60));
+    window.setShowLineNumbers(false);
+    window.setSyntaxHighlighter(&highlighter);
+    window.render();
+
+    const std::string shown = terminal->getRowText(0);
+    CHECK(shown == line);
+
+    // The string, quotes included, has one color and stops at its quote
+    uint8_t string_color = colorOfChar(*terminal, 0, line, "\"");
+    CHECK(colorOfChar(*terminal, 0, line, "\xC3\xA9") == string_color);
+    CHECK(colorOfChar(*terminal, 0, line, "\" +") == string_color);
+    CHECK(colorOfChar(*terminal, 0, line, " +") != string_color);
+    CHECK(colorOfChar(*terminal, 0, line, "y;") != string_color);
+
+    // The comment starts at its slashes, not columns later
+    uint8_t comment_color = colorOfChar(*terminal, 0, line, "//");
+    CHECK(comment_color != colorOfChar(*terminal, 0, line, ";"));
+    CHECK(colorOfChar(*terminal, 0, line, "cmt") == comment_color);
+    CHECK(comment_color != string_color);
+}
+
+} // anonymous namespace
+
+int main() {
+    testMultibyteStringThenComment();
+    if (g_failures > 0) {
+        printf("%d check(s) failed\n", g_failures);
+        return 1;
+    }
+    printf("window_test: all checks passed\n");
+    return 0;
+}